@@ -0,0 +1,112 @@
+// bench / state_packet_bench.cpp
+// Encode + decode cost of one game state frame: the old "GAME:x:y:..." text packet against the binary one.
+// g++ -O2 -std=c++17 -o state_packet_bench state_packet_bench.cpp
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "../server/pong_packet.h"
+
+struct Frame {
+    float ball_x, ball_y, ball_dx, ball_dy;
+    int p1_y, p2_y, p1_score, p2_score;
+};
+
+// Keeps the compiler from dropping a result nobody reads
+template <typename T> static void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// What NetworkManager::sendGameState used to build
+static std::string text_encode(const Frame& f) {
+    return "GAME:" + std::to_string(f.ball_x) + ":" +
+           std::to_string(f.ball_y) + ":" +
+           std::to_string(f.ball_dx) + ":" +
+           std::to_string(f.ball_dy) + ":" +
+           std::to_string(f.p1_y) + ":" +
+           std::to_string(f.p2_y) + ":" +
+           std::to_string(f.p1_score) + ":" +
+           std::to_string(f.p2_score);
+}
+
+// What NetworkManager::receiveGameState used to parse, starting from the received buffer
+static bool text_decode(const char* buffer, Frame& f) {
+    std::string data(buffer);
+    if (data.substr(0, 5) != "GAME:") return false;
+    data = data.substr(5);
+
+    std::vector<std::string> components;
+    size_t pos = 0;
+    while ((pos = data.find(':')) != std::string::npos) {
+        components.push_back(data.substr(0, pos));
+        data.erase(0, pos + 1);
+    }
+    components.push_back(data);
+    if (components.size() != 8) return false;
+
+    f.p1_y = std::stoi(components[4]);
+    f.p2_y = std::stoi(components[5]);
+    f.ball_x = std::stof(components[0]);
+    f.ball_y = std::stof(components[1]);
+    f.ball_dx = std::stof(components[2]);
+    f.ball_dy = std::stof(components[3]);
+    f.p1_score = std::stoi(components[6]);
+    f.p2_score = std::stoi(components[7]);
+    return true;
+}
+
+static Frame frame_at(uint32_t i) {
+    Frame f;
+    f.ball_x = 12.5f + (i % 40);
+    f.ball_y = 7.25f + (i % 15);
+    f.ball_dx = 0.4871f;
+    f.ball_dy = -0.1923f;
+    f.p1_y = i % 17;
+    f.p2_y = (i / 3) % 17;
+    f.p1_score = (i / 1000) % 10;
+    f.p2_score = (i / 700) % 10;
+    return f;
+}
+
+template <typename Step> static double ns_per_frame(uint64_t frames, Step step) {
+    for (uint64_t i = 0; i < 1000; ++i) step(i); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < frames; ++i) step(i);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / frames;
+}
+
+int main(int argc, char** argv) {
+    uint64_t frames = argc > 1 ? std::stoull(argv[1]) : 2000000;
+
+    size_t text_bytes = 0;
+    double text = ns_per_frame(frames, [&](uint64_t i) {
+        Frame in = frame_at(i), out;
+        std::string packet = text_encode(in);
+        char buffer[1024] = {0}; // The receive buffer, zeroed per frame as before
+        memcpy(buffer, packet.data(), packet.size());
+        keep(text_decode(buffer, out));
+        keep(out);
+        text_bytes = packet.size();
+    });
+
+    double binary = ns_per_frame(frames, [&](uint64_t i) {
+        Frame in = frame_at(i);
+        StatePacket state = {STATE_HAS_BALL, static_cast<uint32_t>(i), in.ball_x, in.ball_y, in.ball_dx, in.ball_dy,
+                             static_cast<int16_t>(in.p1_y), static_cast<int16_t>(in.p2_y),
+                             static_cast<int16_t>(in.p1_score), static_cast<int16_t>(in.p2_score)};
+        uint8_t packet[STATE_PACKET_SIZE];
+        encode_state_packet(state, packet);
+        keep(packet);
+        StatePacket out;
+        keep(decode_state_packet(packet, sizeof(packet), out));
+        keep(out);
+    });
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "text   " << std::setw(8) << text << " ns/frame  " << text_bytes << " bytes" << std::endl;
+    std::cout << "binary " << std::setw(8) << binary << " ns/frame  " << STATE_PACKET_SIZE << " bytes" << std::endl;
+    std::cout << "speedup " << std::setprecision(1) << text / binary << "x over " << frames << " frames" << std::endl;
+    return 0;
+}
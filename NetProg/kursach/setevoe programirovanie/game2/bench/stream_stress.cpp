@@ -0,0 +1,155 @@
+// bench / stream_stress.cpp
+// Feeds FrameReader / FrameWriter streams cut at random places and checks every frame comes out whole and in order.
+// Exits non-zero on the first mismatch.
+// g++ -O2 -std=c++17 -o stream_stress stream_stress.cpp ../server/pong_stream.cpp
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../server/pong_stream.h"
+
+static std::mt19937 rng(12345);
+
+static size_t random_size(size_t max) {
+    return std::uniform_int_distribution<size_t>(0, max)(rng);
+}
+
+static void fail(const std::string& what) {
+    std::cerr << "FAIL: " << what << std::endl;
+    exit(1);
+}
+
+// Mostly short handshake-sized payloads, sometimes empty or right at the limit
+static std::string random_payload() {
+    size_t size;
+    switch (random_size(9)) {
+    case 0: size = 0; break;
+    case 1: size = MAX_FRAME_SIZE; break;
+    case 2: size = random_size(MAX_FRAME_SIZE); break;
+    default: size = random_size(64); break;
+    }
+    std::string payload(size, '\0');
+    for (char& c : payload) c = static_cast<char>(random_size(255));
+    return payload;
+}
+
+static std::string frame_bytes(const std::string& payload) {
+    std::string bytes;
+    bytes += static_cast<char>(payload.size() >> 8);
+    bytes += static_cast<char>(payload.size() & 0xFF);
+    return bytes + payload;
+}
+
+static void expect_frames(FrameReader& reader, const std::vector<std::string>& sent, size_t& received) {
+    std::string payload;
+    while (reader.next(payload)) {
+        if (received >= sent.size()) fail("more frames out than went in");
+        if (payload != sent[received]) fail("frame " + std::to_string(received) + " differs");
+        ++received;
+    }
+}
+
+// The whole stream in memory, handed to the reader in random pieces from one byte to several frames
+static void fragmented_feed(int rounds) {
+    for (int round = 0; round < rounds; ++round) {
+        std::vector<std::string> sent;
+        std::string stream;
+        size_t frames = 1 + random_size(200);
+        for (size_t i = 0; i < frames; ++i) {
+            sent.push_back(random_payload());
+            stream += frame_bytes(sent.back());
+        }
+
+        FrameReader reader;
+        size_t received = 0;
+        size_t max_piece = 1 + random_size(random_size(1) ? 8 : 10000);
+        for (size_t pos = 0; pos < stream.size();) {
+            size_t piece = std::min(stream.size() - pos, 1 + random_size(max_piece - 1));
+            reader.feed(stream.data() + pos, piece);
+            pos += piece;
+            expect_frames(reader, sent, received);
+        }
+        if (received != sent.size()) fail("lost frames after a fragmented feed");
+        if (reader.buffered() != 0) fail("bytes left over after the last frame");
+    }
+    std::cout << "fragmented feed: " << rounds << " streams ok" << std::endl;
+}
+
+// Random bytes must never crash the reader, and a length over the limit must stop it for good
+static void garbage_feed(int rounds) {
+    int rejected = 0;
+    for (int round = 0; round < rounds; ++round) {
+        FrameReader reader;
+        std::string payload;
+        for (int piece = 0; piece < 20 && !reader.malformed(); ++piece) {
+            std::string bytes(random_size(300), '\0');
+            for (char& c : bytes) c = static_cast<char>(random_size(255));
+            reader.feed(bytes.data(), bytes.size());
+            while (reader.next(payload)) {
+                if (payload.size() > MAX_FRAME_SIZE) fail("frame over the limit came out");
+            }
+        }
+        if (reader.malformed()) {
+            ++rejected;
+            if (reader.next(payload)) fail("frame came out after the stream was rejected");
+        }
+    }
+    std::cout << "garbage feed: " << rounds << " streams, " << rejected << " rejected, no crash" << std::endl;
+}
+
+// A real socket pair with tiny buffers, so writes are cut short and reads see partial frames
+static void socket_pair(int frames) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) fail("socketpair");
+    int small = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    for (int fd : fds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    std::vector<std::string> sent;
+    for (int i = 0; i < frames; ++i) sent.push_back(random_payload());
+
+    FrameWriter writer;
+    FrameReader reader;
+    size_t queued = 0, received = 0;
+    long partial_flushes = 0;
+    while (received < sent.size()) {
+        // Queue a random batch, so one vectored write covers many frames
+        size_t batch = random_size(32);
+        for (; batch > 0 && queued < sent.size(); --batch) {
+            if (!writer.queue(sent[queued++])) fail("queue refused a frame within the limit");
+        }
+        if (!writer.flush(fds[0])) fail("flush: " + std::string(strerror(errno)));
+        if (!writer.empty()) ++partial_flushes;
+
+        // Read in small pieces, as a reader that keeps up with the writer would
+        pollfd ready = {fds[1], POLLIN, 0};
+        if (poll(&ready, 1, writer.empty() ? 0 : 100) > 0) {
+            char chunk[97];
+            ssize_t got = read(fds[1], chunk, 1 + random_size(sizeof(chunk) - 1));
+            if (got > 0) reader.feed(chunk, got);
+            else if (got == 0) fail("peer closed");
+        }
+        expect_frames(reader, sent, received);
+        if (reader.malformed()) fail("stream out of sync");
+    }
+    close(fds[0]);
+    close(fds[1]);
+    std::cout << "socket pair: " << frames << " frames ok, " << partial_flushes
+              << " flushes left data queued" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int scale = argc > 1 ? std::atoi(argv[1]) : 1;
+    fragmented_feed(2000 * scale);
+    garbage_feed(20000 * scale);
+    socket_pair(20000 * scale);
+    return 0;
+}
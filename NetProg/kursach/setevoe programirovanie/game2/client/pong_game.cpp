@@ -11,6 +11,7 @@
 #include <atomic>
 #include <limits>
 #include "../server/pong_net.h"
+#include "../../pong_frame.h"
 
 // Game constants
 const int WIDTH = 68;
@@ -19,6 +20,7 @@ const int PADDLE_HEIGHT = 7;
 const float BASE_SPEED = 0.5f;
 const float SPEED_INCREASE = 0.15f;
 const int GAME_SPEED = 35000;
+const long FRAME_NS = 16666667; // 60 FPS
 const int INPUT_POLL_RATE = 50;
 
 // Game objects
@@ -36,21 +38,24 @@ struct Ball {
     int last_x, last_y;
 };
 
+// The game loop's drawing for one frame. The chat threads draw with their own buffers.
+ScreenBuffer screen;
+
 // Terminal control
 void clearScreen() {
-    std::cout << "\033[2J\033[H";
+    screen << "\033[2J\033[H";
 }
 
 void setCursor(int x, int y) {
-    std::cout << "\033[" << y << ";" << x << "H";
+    screen.moveTo(x, y);
 }
 
 void hideCursor() {
-    std::cout << "\033[?25l";
+    screen << "\033[?25l";
 }
 
 void showCursor() {
-    std::cout << "\033[?25h";
+    screen << "\033[?25h";
 }
 
 void enableRawMode() {
@@ -71,13 +76,13 @@ void disableRawMode() {
 // Drawing functions
 void drawArena() {
     // Set background color
-    std::cout << "\033[48;5;234m";
+    screen << "\033[48;5;234m";
     
     // Clear the entire play area first
     for (int y = 1; y <= HEIGHT; y++) {
         setCursor(1, y);
         for (int x = 0; x < WIDTH; x++) {
-            std::cout << " ";
+            screen << " ";
         }
     }
     
@@ -85,99 +90,98 @@ void drawArena() {
     // Top and bottom borders
     for (int x = 0; x < WIDTH; x++) {
         setCursor(x + 1, 1);
-        std::cout << "\033[38;5;255m═";
+        screen << "\033[38;5;255m═";
         setCursor(x + 1, HEIGHT);
-        std::cout << "═";
+        screen << "═";
     }
     
     // Side borders and center line
     for (int y = 2; y < HEIGHT; y++) {
         setCursor(1, y);
-        std::cout << "\033[38;5;255m║";
+        screen << "\033[38;5;255m║";
         setCursor(WIDTH, y);
-        std::cout << "║";
+        screen << "║";
         setCursor(WIDTH/2 + 1, y);
-        std::cout << (y % 2 ? "\033[38;5;239m│" : " ");
+        screen << (y % 2 ? "\033[38;5;239m│" : " ");
     }
     
     // Corners
     setCursor(1, 1);
-    std::cout << "╔";
+    screen << "╔";
     setCursor(WIDTH, 1);
-    std::cout << "╗";
+    screen << "╗";
     setCursor(1, HEIGHT);
-    std::cout << "╚";
+    screen << "╚";
     setCursor(WIDTH, HEIGHT);
-    std::cout << "╝";
+    screen << "╝";
     
-    std::cout << "\033[0m";
+    screen << "\033[0m";
 }
 
 void drawPaddle(const Paddle& p, bool erase = false) {
     if (erase) {
         for (int i = 0; i < PADDLE_HEIGHT; i++) {
             setCursor(p.x + 1, p.y + i + 1);
-            std::cout << " ";
+            screen << " ";
         }
         return;
     }
     
-    std::cout << p.color;
+    screen << p.color;
     for (int i = 0; i < PADDLE_HEIGHT; i++) {
         setCursor(p.x + 1, p.y + i + 1);
         if (i == 0 || i == PADDLE_HEIGHT - 1) {
-            std::cout << "■";
+            screen << "■";
         } else {
-            std::cout << "█";
+            screen << "█";
         }
     }
-    std::cout << "\033[0m";
+    screen << "\033[0m";
 }
 
 void drawBall(const Ball& b, bool erase = false) {
     setCursor(b.last_x + 1, b.last_y + 1);
-    std::cout << " ";
+    screen << " ";
     
     if (!erase) {
         setCursor(static_cast<int>(b.x) + 1, static_cast<int>(b.y) + 1);
         float speed_factor = sqrt(b.dx*b.dx + b.dy*b.dy) / BASE_SPEED;
         if (speed_factor > 1.5f) {
-            std::cout << "\033[1;33;48;5;234m●\033[0m";
+            screen << "\033[1;33;48;5;234m●\033[0m";
         } else {
-            std::cout << "\033[1;93;48;5;234m◦\033[0m";
+            screen << "\033[1;93;48;5;234m◦\033[0m";
         }
     }
-    std::cout.flush();
 }
 
 void drawScore(const Paddle& p1, const Paddle& p2) {
     for (int x = WIDTH/2 - 10; x <= WIDTH/2 + 10; x++) {
         setCursor(x, HEIGHT + 2);
-        std::cout << "\033[48;5;236m ";
+        screen << "\033[48;5;236m ";
     }
     
     setCursor(WIDTH/2 - 8, HEIGHT + 2);
-    std::cout << p1.color << "PLAYER 1: " << p1.score << "\033[0m";
+    screen << p1.color << "PLAYER 1: " << p1.score << "\033[0m";
     
     setCursor(WIDTH/2 + 2, HEIGHT + 2);
-    std::cout << p2.color << "PLAYER 2: " << p2.score << "\033[0m";
+    screen << p2.color << "PLAYER 2: " << p2.score << "\033[0m";
 }
 
 void drawControls() {
     setCursor(2, HEIGHT + 4);
-    std::cout << "\033[38;5;245mCONTROLS: \033[1;37mP1 (W/S)   P2 (↑/↓)   \033[1;31mQUIT (Q)\033[0m";
+    screen << "\033[38;5;245mCONTROLS: \033[1;37mP1 (W/S)   P2 (↑/↓)   \033[1;31mQUIT (Q)\033[0m";
 }
 
 void drawChatArea(const std::string& opponent_name) {
     int chat_start_y = HEIGHT + 6;
     
     setCursor(2, chat_start_y - 1);
-    std::cout << "\033[38;5;245m--- CHAT WITH " << opponent_name << " ---\033[0m";
+    screen << "\033[38;5;245m--- CHAT WITH " << opponent_name << " ---\033[0m";
     
     // Clear chat area
     for (int y = chat_start_y; y < chat_start_y + 5; y++) {
         setCursor(2, y);
-        std::cout << "\033[K"; // Clear line
+        screen << "\033[K"; // Clear line
     }
 }
 
@@ -240,12 +244,12 @@ void updateBall(Ball& ball, Paddle& p1, Paddle& p2) {
         
         for (int i = 0; i < 3; i++) {
             setCursor(WIDTH/2 - 3, HEIGHT/2);
-            std::cout << "\033[1;5;37;48;5;196m GOAL! \033[0m";
-            std::cout.flush();
+            screen << "\033[1;5;37;48;5;196m GOAL! \033[0m";
+            screen.flush();
             usleep(150000);
             setCursor(WIDTH/2 - 3, HEIGHT/2);
-            std::cout << "       ";
-            std::cout.flush();
+            screen << "       ";
+            screen.flush();
             usleep(150000);
         }
         
@@ -265,29 +269,33 @@ void displayChatMessages() {
     int chat_start_y = HEIGHT + 6;
     
     // Display up to the last 5 messages
+    ScreenBuffer out;
     int start_idx = std::max(0, static_cast<int>(chat_messages.size()) - 5);
     for (int i = 0; i < 5 && (start_idx + i) < chat_messages.size(); i++) {
-        setCursor(2, chat_start_y + i);
-        std::cout << "\033[K" << chat_messages[start_idx + i]; // Clear line and print message
+        out.moveTo(2, chat_start_y + i);
+        out << "\033[K" << chat_messages[start_idx + i]; // Clear line and print message
     }
     
     // Display current input if active
     if (chat_input_active) {
-        setCursor(2, chat_start_y + 5);
-        std::cout << "\033[K> " << current_chat_input;
+        out.moveTo(2, chat_start_y + 5);
+        out << "\033[K> " << current_chat_input;
     }
+    out.flush();
 }
 
 void chatReceiveThread(NetworkManager& network, const std::string& opponent_name) {
     while (true) {
         std::string message;
         if (network.receiveChatMessage(message)) {
-            std::lock_guard<std::mutex> lock(chat_mutex);
-            chat_messages.push_back(opponent_name + ": " + message);
-            if (chat_messages.size() > 5) {
-                chat_messages.erase(chat_messages.begin());
+            {
+                std::lock_guard<std::mutex> lock(chat_mutex);
+                chat_messages.push_back(opponent_name + ": " + message);
+                if (chat_messages.size() > 5) {
+                    chat_messages.erase(chat_messages.begin());
+                }
             }
-            displayChatMessages();
+            displayChatMessages(); // Takes chat_mutex itself
         }
         usleep(100000); // Slightly longer sleep to reduce CPU usage
     }
@@ -312,7 +320,9 @@ void chatInputThread(NetworkManager& network, const std::string& my_name) {
                 fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
                 
                 // Get player's input
-                setCursor(4, HEIGHT + 11);
+                ScreenBuffer prompt;
+                prompt.moveTo(4, HEIGHT + 11);
+                prompt.flush();
                 std::string message;
                 std::getline(std::cin, message);
                 
@@ -429,6 +439,7 @@ int main() {
     drawBall(ball);
     drawScore(p1, p2);
     drawControls();
+    screen.flush();
     
     GameMode mode = LOCAL;
     NetworkManager network;
@@ -438,6 +449,7 @@ int main() {
     // Add menu to choose game mode
     while (true) {
         clearScreen();
+        screen.flush();
         std::cout << "Choose game mode:\n";
         std::cout << "1. Local 2-player\n";
         std::cout << "2. Online multiplayer\n";
@@ -477,6 +489,7 @@ int main() {
             std::cerr << "Failed to connect to server or find match\n";
             disableRawMode();
             showCursor();
+            screen.flush();
             return 1;
         }
         
@@ -510,18 +523,16 @@ int main() {
         
         // Add chat instructions
         setCursor(2, HEIGHT + 5);
-        std::cout << "\033[38;5;245mPress 'T' to chat\033[0m";
+        screen << "\033[38;5;245mPress 'T' to chat\033[0m";
     }
+    screen.flush();
 
     enableRawMode();
     // Game loop
 bool running = true;
-auto last_frame = std::chrono::steady_clock::now();
-const auto frame_duration = std::chrono::microseconds(16667); // ~60fps
+FramePacer pacer(FRAME_NS);
 
 while (running) {
-    auto frame_start = std::chrono::steady_clock::now();
-    
     // Handle input for local controls
     handleInput(p1, p2, running, mode == ONLINE, isPlayer1);
     
@@ -532,7 +543,7 @@ while (running) {
                                 p1.y, p2.y, p1.score, p2.score);
         } else {
             // Just send our paddle position
-            network.sendGameState(0, 0, 0, 0, 0, p2.y, 0, 0);
+            network.sendGameState(0, 0, 0, 0, 0, p2.y, 0, 0, false);
         }
         
         // Try to receive game state
@@ -574,27 +585,25 @@ while (running) {
         drawScore(p1, p2);
         last_p1_score = p1.score;
         last_p2_score = p2.score;
+        pacer.restart(); // Don't count the goal animation as a late frame
     }
     
-    // Calculate frame time and sleep only the remaining time
-    auto frame_end = std::chrono::steady_clock::now();
-    auto frame_time = frame_end - frame_start;
-    auto sleep_time = frame_duration - frame_time;
-    
-    if (sleep_time > std::chrono::microseconds::zero()) {
-        usleep(std::chrono::duration_cast<std::chrono::microseconds>(sleep_time).count());
-    }
+    // The frame is ready, show it when it is due
+    pacer.wait();
+    screen.flush();
 }
     
     // Clean up
     showCursor();
     disableRawMode();
     clearScreen();
+    screen.flush();
     
     // Game over message
     std::cout << "\n  \033[1;36mGAME OVER\033[0m\n\n";
     std::cout << "  \033[1;32mPlayer 1: " << p1.score << "\033[0m\n";
     std::cout << "  \033[1;34mPlayer 2: " << p2.score << "\033[0m\n\n";
+    std::cout << "  " << pacer.report() << "\n";
     
     return 0;
 }
\ No newline at end of file
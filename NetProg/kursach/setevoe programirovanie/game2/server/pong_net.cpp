@@ -40,36 +40,41 @@ bool NetworkManager::connectToServer(const std::string& serverIp, int port,
     std::string request = username + ":" + std::to_string(mmr) + ":" + 
                          std::to_string(udp_port) + ":" + std::to_string(tcp_port);
     
-    // Send request to server
-    send(sock, request.c_str(), request.length(), 0);
+    // Send request to server, every message either way is one frame
+    FrameWriter output;
+    output.queue(request);
+    if (!output.flushAll(sock)) {
+        std::cerr << "Failed to send request to server" << std::endl;
+        close(sock);
+        sock = -1;
+        return false;
+    }
     
     // Wait for response
-    char buffer[1024] = {0};
-    int bytes_read = read(sock, buffer, sizeof(buffer));
-    if (bytes_read <= 0) {
+    FrameReader input;
+    std::string response;
+    if (input.readFrame(sock, response) != ReadStatus::OK) {
         std::cerr << "Failed to read from server" << std::endl;
         close(sock);
         sock = -1;
         return false;
     }
     
-    // Parse response
-    std::string response(buffer);
-    
     if (response == "WAITING") {
         std::cout << "Waiting for an opponent..." << std::endl;
         
-        // Wait for match notification
-        memset(buffer, 0, sizeof(buffer));
-        bytes_read = read(sock, buffer, sizeof(buffer));
-        if (bytes_read <= 0) {
-            std::cerr << "Lost connection while waiting for match" << std::endl;
-            close(sock);
-            sock = -1;
-            return false;
+        // Wait for match notification, answering the server's heartbeat meanwhile
+        while (true) {
+            if (input.readFrame(sock, response) != ReadStatus::OK) {
+                std::cerr << "Lost connection while waiting for match" << std::endl;
+                close(sock);
+                sock = -1;
+                return false;
+            }
+            if (response != "PING") break;
+            output.queue("PONG");
+            output.flushAll(sock);
         }
-        
-        response = std::string(buffer);
     }
     
     // Check if we got matched
@@ -161,20 +166,25 @@ void NetworkManager::setupTCP(const std::string& ip, int port) {
 
 
 void NetworkManager::sendGameState(float ball_x, float ball_y, float ball_dx, float ball_dy,
-                                 int p1_y, int p2_y, int p1_score, int p2_score) {
+                                 int p1_y, int p2_y, int p1_score, int p2_score, bool with_ball) {
     if (udp_sock < 0) return;
     
-    // Format: GAME:ball_x:ball_y:ball_dx:ball_dy:p1_y:p2_y:p1_score:p2_score
-    std::string data = "GAME:" + std::to_string(ball_x) + ":" +
-                      std::to_string(ball_y) + ":" +
-                      std::to_string(ball_dx) + ":" +
-                      std::to_string(ball_dy) + ":" +
-                      std::to_string(p1_y) + ":" +
-                      std::to_string(p2_y) + ":" +
-                      std::to_string(p1_score) + ":" +
-                      std::to_string(p2_score);
+    StatePacket state;
+    state.flags = with_ball ? STATE_HAS_BALL : 0;
+    state.sequence = ++send_sequence;
+    state.ball_x = ball_x;
+    state.ball_y = ball_y;
+    state.ball_dx = ball_dx;
+    state.ball_dy = ball_dy;
+    state.p1_y = p1_y;
+    state.p2_y = p2_y;
+    state.p1_score = p1_score;
+    state.p2_score = p2_score;
+
+    uint8_t data[STATE_PACKET_SIZE];
+    encode_state_packet(state, data);
     
-    int result = sendto(udp_sock, data.c_str(), data.length(), 0,
+    int result = sendto(udp_sock, data, sizeof(data), 0,
           (struct sockaddr*)&opponent_addr, sizeof(opponent_addr));
           
     if (result > 0) packets_sent++;
@@ -190,76 +200,72 @@ void NetworkManager::sendGameState(float ball_x, float ball_y, float ball_dx, fl
     }
 }
 
-// Modify the receiveGameState method to be smarter about what it updates
 bool NetworkManager::receiveGameState(float& ball_x, float& ball_y, float& ball_dx, float& ball_dy,
                                     int& p1_y, int& p2_y, int& p1_score, int& p2_score) {
     if (udp_sock < 0) return false;
     
-    char buffer[1024] = {0};
-    sockaddr_in sender_addr;
-    socklen_t addr_len = sizeof(sender_addr);
-    
-    int bytes_received = recvfrom(udp_sock, buffer, sizeof(buffer), 0,
-                                (struct sockaddr*)&sender_addr, &addr_len);
-    
-    if (bytes_received <= 0) return false;
-    packets_received++;
-    
-    std::string data(buffer);
-    if (data.substr(0, 5) != "GAME:") return false;
-    
-    data = data.substr(5); // Remove "GAME:" prefix
-    
-    // Parse all components
-    std::vector<std::string> components;
-    size_t pos = 0;
-    while ((pos = data.find(':')) != std::string::npos) {
-        components.push_back(data.substr(0, pos));
-        data.erase(0, pos + 1);
+    // One byte more than a packet, so a longer datagram shows up as the wrong size
+    uint8_t buffer[STATE_PACKET_SIZE + 1];
+    StatePacket state;
+    StatePacket newest;
+    bool updated = false;
+
+    // Drain everything queued, only the newest state matters and late or duplicate packets are dropped
+    while (true) {
+        int bytes_received = recvfrom(udp_sock, buffer, sizeof(buffer), 0, nullptr, nullptr);
+        if (bytes_received <= 0) break;
+        packets_received++;
+
+        if (!decode_state_packet(buffer, bytes_received, state)) continue;
+        if (received_any && !sequence_newer(state.sequence, last_received_sequence)) continue;
+
+        received_any = true;
+        last_received_sequence = state.sequence;
+        newest = state;
+        updated = true;
     }
-    components.push_back(data); // Add last component
-    
-    if (components.size() != 8) return false;
-    
-    try {
-        // Always update both paddles
-        p1_y = std::stoi(components[4]);
-        p2_y = std::stoi(components[5]);
-        
-        // Only player 1 is authoritative about ball and score
-        if (components[0] != "0") { // Check if ball data is included
-            ball_x = std::stof(components[0]);
-            ball_y = std::stof(components[1]);
-            ball_dx = std::stof(components[2]);
-            ball_dy = std::stof(components[3]);
-            p1_score = std::stoi(components[6]);
-            p2_score = std::stoi(components[7]);
-        }
-        
-        return true;
-    } catch (...) {
-        return false;
+    if (!updated) return false;
+    
+    // Always update both paddles
+    p1_y = newest.p1_y;
+    p2_y = newest.p2_y;
+    
+    // Only player 1 is authoritative about ball and score
+    if (newest.flags & STATE_HAS_BALL) {
+        ball_x = newest.ball_x;
+        ball_y = newest.ball_y;
+        ball_dx = newest.ball_dx;
+        ball_dy = newest.ball_dy;
+        p1_score = newest.p1_score;
+        p2_score = newest.p2_score;
     }
+    
+    return true;
 }
 
 void NetworkManager::sendChatMessage(const std::string& message) {
-    if (udp_sock < 0) return;
+    if (tcp_sock < 0) return;
     
+    // Too long for a frame is cut to fit
     std::string data = "CHAT:" + message;
+    chat_output.queue(data.substr(0, MAX_FRAME_SIZE));
     
-    send(tcp_sock, data.c_str(), data.length(), 0);
+    // Whatever the socket does not take now goes out with the next message
+    chat_output.flush(tcp_sock);
 }
 
 // Add a method to receive chat messages
 bool NetworkManager::receiveChatMessage(std::string& message) {
     if (tcp_sock < 0) return false;
     
-    char buffer[1024] = {0};
-    int bytes_received = recv(tcp_sock, buffer, sizeof(buffer), 0);
-    
-    if (bytes_received <= 0) return false;
+    // One message per call, the rest stay buffered for the next calls
+    std::string data;
+    while (!chat_input.next(data)) {
+        if (chat_input.malformed()) return false;
+        size_t before = chat_input.buffered();
+        if (chat_input.readSome(tcp_sock) != ReadStatus::OK || chat_input.buffered() == before) return false;
+    }
     
-    std::string data(buffer);
     if (data.substr(0, 5) != "CHAT:") return false;
     
     message = data.substr(5);
@@ -7,6 +7,8 @@
 #include <mutex>
 #include <vector>
 #include <map>
+#include "pong_packet.h"
+#include "pong_stream.h"
 
 enum GameMode { LOCAL, ONLINE };
 
@@ -17,9 +19,11 @@ public:
                         int udp_port, int tcp_port);
     void setupUDP(const std::string& ip, int port);
     void setupTCP(const std::string& ip, int port);
+    // with_ball is false for player 2, who only reports its paddle
     void sendGameState(float ball_x, float ball_y, float ball_dx, float ball_dy, 
-                      int p1_y, int p2_y, int p1_score, int p2_score);
+                      int p1_y, int p2_y, int p1_score, int p2_score, bool with_ball = true);
                       
+    // Applies the newest queued state packet; ball and score only if the sender included them
     bool receiveGameState(float& ball_x, float& ball_y, float& ball_dx, float& ball_dy,
                         int& p1_y, int& p2_y, int& p1_score, int& p2_score);
     void sendChatMessage(const std::string& message);
@@ -29,7 +33,10 @@ public:
 private:
     int sock = -1;
     int udp_sock = -1;
-    int tcp_sock;
+    int tcp_sock = -1;
+    // Chat is read by the chat thread and written by the input thread, each owns one side
+    FrameReader chat_input;
+    FrameWriter chat_output;
     sockaddr_in opponent_tcp_addr;
     sockaddr_in opponent_addr;
     std::string opponent_username;
@@ -39,6 +46,9 @@ private:
     int opponent_tcp_port;
     int packets_sent = 0;
     int packets_received = 0;
+    uint32_t send_sequence = 0;
+    uint32_t last_received_sequence = 0;
+    bool received_any = false;
     std::chrono::steady_clock::time_point last_debug_time = std::chrono::steady_clock::now();
 };
 
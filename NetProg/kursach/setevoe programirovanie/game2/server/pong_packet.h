@@ -0,0 +1,121 @@
+// server / pong_packet.h
+#ifndef PONG_PACKET_H
+#define PONG_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <arpa/inet.h>
+
+// Peer-to-peer game state, one UDP datagram per frame. Fixed layout, everything in network byte order:
+//
+//   offset  size  field
+//   0       2     magic 'P','S'
+//   2       1     version
+//   3       1     flags (STATE_HAS_BALL)
+//   4       4     sequence, increases by one per packet sent
+//   8       16    ball x, y, dx, dy (IEEE 754 floats)
+//   24      8     p1_y, p2_y, p1_score, p2_score (signed 16 bit)
+//
+// Encoding and decoding only copy bytes, nothing is allocated.
+
+const uint16_t STATE_PACKET_MAGIC = 0x5053; // "PS"
+const uint8_t STATE_PACKET_VERSION = 1;
+const size_t STATE_PACKET_SIZE = 32;
+
+// Only player 1 simulates the ball, player 2's packets carry just its paddle
+const uint8_t STATE_HAS_BALL = 0x01;
+
+struct StatePacket {
+    uint8_t flags;
+    uint32_t sequence;
+    float ball_x, ball_y, ball_dx, ball_dy;
+    int16_t p1_y, p2_y;
+    int16_t p1_score, p2_score;
+};
+
+inline uint8_t* put_u16(uint8_t* out, uint16_t value) {
+    value = htons(value);
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+inline uint8_t* put_u32(uint8_t* out, uint32_t value) {
+    value = htonl(value);
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+inline uint8_t* put_float(uint8_t* out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return put_u32(out, bits);
+}
+
+inline const uint8_t* get_u16(const uint8_t* in, uint16_t& value) {
+    memcpy(&value, in, sizeof(value));
+    value = ntohs(value);
+    return in + sizeof(value);
+}
+
+inline const uint8_t* get_u32(const uint8_t* in, uint32_t& value) {
+    memcpy(&value, in, sizeof(value));
+    value = ntohl(value);
+    return in + sizeof(value);
+}
+
+inline const uint8_t* get_float(const uint8_t* in, float& value) {
+    uint32_t bits;
+    in = get_u32(in, bits);
+    memcpy(&value, &bits, sizeof(value));
+    return in;
+}
+
+// Writes exactly STATE_PACKET_SIZE bytes
+inline void encode_state_packet(const StatePacket& state, uint8_t* out) {
+    out = put_u16(out, STATE_PACKET_MAGIC);
+    *out++ = STATE_PACKET_VERSION;
+    *out++ = state.flags;
+    out = put_u32(out, state.sequence);
+    out = put_float(out, state.ball_x);
+    out = put_float(out, state.ball_y);
+    out = put_float(out, state.ball_dx);
+    out = put_float(out, state.ball_dy);
+    out = put_u16(out, static_cast<uint16_t>(state.p1_y));
+    out = put_u16(out, static_cast<uint16_t>(state.p2_y));
+    out = put_u16(out, static_cast<uint16_t>(state.p1_score));
+    put_u16(out, static_cast<uint16_t>(state.p2_score));
+}
+
+// False for anything that is not a state packet of this version
+inline bool decode_state_packet(const uint8_t* in, size_t size, StatePacket& state) {
+    if (size != STATE_PACKET_SIZE) return false;
+
+    uint16_t magic, p1_y, p2_y, p1_score, p2_score;
+    in = get_u16(in, magic);
+    if (magic != STATE_PACKET_MAGIC || *in++ != STATE_PACKET_VERSION) return false;
+
+    state.flags = *in++;
+    in = get_u32(in, state.sequence);
+    in = get_float(in, state.ball_x);
+    in = get_float(in, state.ball_y);
+    in = get_float(in, state.ball_dx);
+    in = get_float(in, state.ball_dy);
+    in = get_u16(in, p1_y);
+    in = get_u16(in, p2_y);
+    in = get_u16(in, p1_score);
+    get_u16(in, p2_score);
+
+    state.p1_y = static_cast<int16_t>(p1_y);
+    state.p2_y = static_cast<int16_t>(p2_y);
+    state.p1_score = static_cast<int16_t>(p1_score);
+    state.p2_score = static_cast<int16_t>(p2_score);
+    return true;
+}
+
+// Sequence numbers wrap, a packet is newer if it is less than half the range ahead
+inline bool sequence_newer(uint32_t sequence, uint32_t than) {
+    return static_cast<int32_t>(sequence - than) > 0;
+}
+
+#endif
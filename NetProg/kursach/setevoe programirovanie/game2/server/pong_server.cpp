@@ -1,19 +1,30 @@
 // server / pong_server.cpp
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <string>
+#include <unordered_map>
 #include <vector>
-#include <map>
-#include <thread>
-#include <mutex>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <fcntl.h>
-#include <condition_variable>
-#include <chrono>
+#include <errno.h>
+#include "pong_stream.h"
 
 const int PORT = 8080;
+const int MAX_EVENTS = 256;
+// A connection that sends nothing for this long is dropped, --timeout changes it
+const int DEFAULT_TIMEOUT_SECONDS = 15;
+
+using Clock = std::chrono::steady_clock;
 
 struct Player {
     std::string username;
@@ -21,19 +32,44 @@ struct Player {
     sockaddr_in address;
     int udp_port;
     int tcp_port;
-    int client_socket;
 };
 
-struct PendingMatch {
-    Player player1;
-    Player player2;
-    bool notification_sent;
+enum ConnectionState {
+    HANDSHAKE, // Request not read yet
+    WAITING,   // In the queue, the socket stays open for the match notification
+    CLOSING,   // Closed once the output is flushed
+};
+
+// Everything runs on the epoll loop in main, so nothing here is locked
+struct Connection {
+    int fd;
+    uint64_t id;
+    ConnectionState state;
+    Player player;
+    FrameReader input;
+    FrameWriter output;  // Frames the socket did not take yet
+    bool want_write;     // EPOLLOUT is registered
+    Clock::time_point last_heard;  // Last time anything arrived from the client
+    Clock::time_point next_check;  // When its timer is due, older timer entries for it are stale
+};
+
+// One timer per connection, soonest first. Checking a connection looks only at it, nothing sweeps the table.
+struct Timer {
+    Clock::time_point when;
+    int fd;
+    uint64_t id;
+    bool operator>(const Timer& other) const { return when > other.when; }
 };
 
-std::vector<Player> waiting_players;
-std::map<std::string, PendingMatch> pending_matches;
-std::mutex players_mutex;
-std::condition_variable match_cv;
+std::unordered_map<int, Connection> connections;
+// Oldest first. A descriptor can be reused after close, the id tells a stale entry from a new connection.
+std::deque<std::pair<int, uint64_t>> waiting_players;
+uint64_t next_connection_id = 1;
+int epoll_fd = -1;
+std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+std::chrono::seconds timeout(DEFAULT_TIMEOUT_SECONDS);
+// Waiting players are pinged well inside the timeout and answer with PONG
+std::chrono::milliseconds ping_interval(DEFAULT_TIMEOUT_SECONDS * 1000 / 3);
 
 // Function to set socket to non-blocking mode
 void set_nonblocking(int sock) {
@@ -41,205 +77,338 @@ void set_nonblocking(int sock) {
     fcntl(sock, F_SETFL, flags | O_NONBLOCK);
 }
 
-// Function to send match notification to a player
-bool send_match_notification(const Player& player, const Player& opponent) {
-std::string response = "MATCHED:" + opponent.username + ":" + 
-                     std::to_string(opponent.mmr) + ":" + 
-                     inet_ntoa(opponent.address.sin_addr) + ":" + 
-                     std::to_string(opponent.udp_port) + ":" +
-                     std::to_string(opponent.tcp_port);
-    
-    int bytes_sent = send(player.client_socket, response.c_str(), response.size(), 0);
-    return bytes_sent > 0;
-}
-
-// Main function to handle a client connection
-void handle_client(int client_socket, sockaddr_in client_addr) {
-    char buffer[1024] = {0};
-    int bytes_read = read(client_socket, buffer, 1024);
-    
-    if (bytes_read <= 0) {
-        close(client_socket);
-        return;
+// Every waiting player holds a socket, the default of 1024 descriptors is far too few
+void raise_fd_limit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        std::cout << "Up to " << limit.rlim_cur << " open connections" << std::endl;
+    }
+}
+
+// Kernel probes for a peer that vanished without a FIN, e.g. a pulled cable, while the socket is idle
+void enable_keepalive(int sock) {
+    int on = 1;
+    int idle = std::max<int>(1, timeout.count() / 3);
+    int interval = std::max<int>(1, timeout.count() / 6);
+    int count = 3;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    // Unacknowledged pings must not keep a dead connection around longer than the timeout either
+    unsigned int user_timeout = timeout.count() * 1000;
+    setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+}
+
+void schedule(Connection& conn, Clock::time_point when) {
+    conn.next_check = when;
+    timers.push({when, conn.fd, conn.id});
+}
+
+void watch(Connection& conn, bool want_write) {
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | (want_write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = conn.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.want_write = want_write;
+}
+
+void close_connection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+
+    if (it->second.state == WAITING) {
+        std::cout << "Player " << it->second.player.username << " disconnected while waiting" << std::endl;
+    }
+    // Its timer entry stays queued and is skipped when it comes up
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+}
+
+// Sends what the socket takes and leaves the rest for EPOLLOUT. Returns false if the connection was closed.
+bool flush_output(Connection& conn) {
+    if (!conn.output.flush(conn.fd)) {
+        close_connection(conn.fd);
+        return false;
     }
-    
-    std::string request(buffer);
+    if (!conn.output.empty()) {
+        if (!conn.want_write) watch(conn, true);
+        return true;
+    }
+
+    if (conn.state == CLOSING) {
+        close_connection(conn.fd);
+        return false;
+    }
+    if (conn.want_write) watch(conn, false);
+    return true;
+}
+
+bool send_text(Connection& conn, const std::string& text) {
+    conn.output.queue(text);
+    return flush_output(conn);
+}
+
+std::string match_notification(const Player& opponent) {
+    return "MATCHED:" + opponent.username + ":" +
+           std::to_string(opponent.mmr) + ":" +
+           inet_ntoa(opponent.address.sin_addr) + ":" +
+           std::to_string(opponent.udp_port) + ":" +
+           std::to_string(opponent.tcp_port);
+}
+
+// username:mmr:udp_port:tcp_port
+bool parse_request(const std::string& request, Player& player) {
     size_t colon1 = request.find(':');
     size_t colon2 = request.find(':', colon1+1);
     size_t colon3 = request.find(':', colon2+1);
-    
+
     if (colon1 == std::string::npos || colon2 == std::string::npos || colon3 == std::string::npos) {
-        const char* response = "INVALID_REQUEST";
-        send(client_socket, response, strlen(response), 0);
-        close(client_socket);
-        return;
+        return false;
     }
-    
-    Player player;
-    player.username = request.substr(0, colon1);
-    player.mmr = std::stoi(request.substr(colon1+1, colon2-colon1-1));
-    player.udp_port = std::stoi(request.substr(colon2+1, colon3-colon2-1));
-    player.tcp_port = std::stoi(request.substr(colon3+1));
-    player.address = client_addr;
-    player.client_socket = client_socket;
-    
-    // Set client socket as non-blocking
-    set_nonblocking(client_socket);
-    
-    Player matched_player;
-    bool found_match = false;
-    
-    {
-        std::lock_guard<std::mutex> lock(players_mutex);
-        
-        // Check if there are any waiting players
-        if (!waiting_players.empty()) {
-            matched_player = waiting_players[0];
-            waiting_players.erase(waiting_players.begin());
-            found_match = true;
-            
-            // Create a pending match
-            PendingMatch match = {matched_player, player, false};
-            pending_matches[matched_player.username] = match;
-            pending_matches[player.username] = match;
-        } else {
-            // No match found, add player to waiting list
-            waiting_players.push_back(player);
-            const char* response = "WAITING";
-            send(client_socket, response, strlen(response), 0);
-            
-            // Don't close the socket - keep it open for match notification
-            return;
-        }
+
+    try {
+        player.username = request.substr(0, colon1);
+        player.mmr = std::stoi(request.substr(colon1+1, colon2-colon1-1));
+        player.udp_port = std::stoi(request.substr(colon2+1, colon3-colon2-1));
+        player.tcp_port = std::stoi(request.substr(colon3+1));
+    } catch (...) {
+        return false;
     }
-    
-    if (found_match) {
-        // Send match notifications to both players
-        bool p1_notified = send_match_notification(player, matched_player);
-        bool p2_notified = send_match_notification(matched_player, player);
-        
-        if (p1_notified && p2_notified) {
-            std::cout << "Match made between " << player.username 
-                      << " and " << matched_player.username << std::endl;
-            
-            // Mark match as notified
-            std::lock_guard<std::mutex> lock(players_mutex);
-            pending_matches[player.username].notification_sent = true;
-            pending_matches[matched_player.username].notification_sent = true;
-        } else {
-            std::cerr << "Failed to notify players about match" << std::endl;
+    return !player.username.empty();
+}
+
+// The oldest waiting player whose connection is still open, skipping stale queue entries
+Connection* take_waiting_player() {
+    while (!waiting_players.empty()) {
+        auto [fd, id] = waiting_players.front();
+        waiting_players.pop_front();
+
+        auto it = connections.find(fd);
+        if (it != connections.end() && it->second.id == id && it->second.state == WAITING) {
+            return &it->second;
         }
     }
-    
-    // Don't close client_socket yet - keep it open for potential future notifications
+    return nullptr;
 }
 
-// Thread to periodically check for pending matches and send notifications
-void match_notification_thread() {
+void handle_request(Connection& conn, const std::string& request) {
+    if (!parse_request(request, conn.player)) {
+        conn.state = CLOSING;
+        send_text(conn, "INVALID_REQUEST");
+        return;
+    }
+
+    Connection* opponent = take_waiting_player();
+    if (!opponent) {
+        // Don't close the socket - keep it open for match notification
+        conn.state = WAITING;
+        waiting_players.push_back({conn.fd, conn.id});
+        send_text(conn, "WAITING");
+        return;
+    }
+
+    // Both are told right away, neither socket is needed after that
+    std::cout << "Match made between " << conn.player.username
+              << " and " << opponent->player.username << std::endl;
+
+    Player player = conn.player;
+    Player matched_player = opponent->player;
+    conn.state = CLOSING;
+    opponent->state = CLOSING;
+    send_text(*opponent, match_notification(player));
+    send_text(conn, match_notification(matched_player));
+}
+
+void handle_readable(int fd) {
     while (true) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        
-        std::lock_guard<std::mutex> lock(players_mutex);
-        for (auto it = pending_matches.begin(); it != pending_matches.end();) {
-            PendingMatch& match = it->second;
-            
-            if (!match.notification_sent) {
-                // Try to send notifications
-                bool p1_notified = send_match_notification(match.player1, match.player2);
-                bool p2_notified = send_match_notification(match.player2, match.player1);
-                
-                if (p1_notified && p2_notified) {
-                    std::cout << "Match notification resent successfully" << std::endl;
-                    match.notification_sent = true;
-                } else {
-                    std::cerr << "Failed to send match notification" << std::endl;
-                }
-            }
-            
-            // Clean up completed matches after a while
-            if (match.notification_sent) {
-                // In a real implementation, we'd wait longer and track game completion
-                it = pending_matches.erase(it);
-            } else {
-                ++it;
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        Connection& conn = it->second;
+
+        size_t before = conn.input.buffered();
+        ReadStatus status = conn.input.readSome(fd);
+        if (status != ReadStatus::OK) {
+            close_connection(fd);
+            return;
+        }
+        if (conn.input.buffered() == before) break; // Drained
+
+        conn.last_heard = Clock::now();
+
+        // After the request clients only answer pings, anything they send just shows they are alive
+        std::string request;
+        while (conn.input.next(request)) {
+            if (conn.state == HANDSHAKE) {
+                handle_request(conn, request);
+                if (connections.find(fd) == connections.end()) return;
             }
         }
+        if (conn.input.malformed()) {
+            close_connection(fd);
+            return;
+        }
+    }
+}
+
+// Drops connections that went quiet and pings the waiting ones. Returns the epoll_wait timeout until the next timer.
+int run_timers() {
+    Clock::time_point now = Clock::now();
+    while (!timers.empty() && timers.top().when <= now) {
+        Timer timer = timers.top();
+        timers.pop();
+
+        auto it = connections.find(timer.fd);
+        if (it == connections.end() || it->second.id != timer.id || it->second.next_check != timer.when) continue;
+        Connection& conn = it->second;
+
+        Clock::time_point deadline = conn.last_heard + timeout;
+        if (now >= deadline) {
+            std::cout << "Connection " << conn.id << " timed out";
+            if (!conn.player.username.empty()) std::cout << " (" << conn.player.username << ")";
+            std::cout << std::endl;
+            close_connection(conn.fd);
+            continue;
+        }
+        if (conn.state == WAITING && !send_text(conn, "PING")) continue;
+        schedule(conn, std::min(deadline, now + ping_interval));
     }
+
+    if (timers.empty()) return -1;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(timers.top().when - now).count();
+    return static_cast<int>(wait) + 1;
 }
 
-// Thread to clean up disconnected waiting players
-void cleanup_thread() {
+void accept_clients(int server_fd) {
     while (true) {
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        
-        std::lock_guard<std::mutex> lock(players_mutex);
-        for (auto it = waiting_players.begin(); it != waiting_players.end();) {
-            // Send a ping to check if client is still connected
-            char ping = 0;
-            if (send(it->client_socket, &ping, 0, MSG_NOSIGNAL) < 0) {
-                std::cout << "Player " << it->username << " disconnected while waiting" << std::endl;
-                close(it->client_socket);
-                it = waiting_players.erase(it);
-            } else {
-                ++it;
-            }
+        sockaddr_in client_addr;
+        socklen_t addrlen = sizeof(client_addr);
+        int client_socket = accept4(server_fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK);
+
+        if (client_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
         }
+
+        std::cout << "New connection from " << inet_ntoa(client_addr.sin_addr)
+                  << ":" << ntohs(client_addr.sin_port) << std::endl;
+
+        Connection conn;
+        conn.fd = client_socket;
+        conn.id = next_connection_id++;
+        conn.state = HANDSHAKE;
+        conn.player.address = client_addr;
+        conn.want_write = false;
+        conn.last_heard = Clock::now();
+        enable_keepalive(client_socket);
+
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            perror("epoll_ctl");
+            close(client_socket);
+            continue;
+        }
+        // A client that never sends its request is dropped at the same deadline
+        Connection& added = connections[client_socket] = std::move(conn);
+        schedule(added, added.last_heard + std::min<Clock::duration>(timeout, ping_interval));
     }
 }
 
-int main() {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == 0) {
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--timeout" && i + 1 < argc) {
+            timeout = std::chrono::seconds(std::max(1, atoi(argv[++i])));
+            ping_interval = std::chrono::duration_cast<std::chrono::milliseconds>(timeout) / 3;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--timeout SECONDS]" << std::endl;
+            return 1;
+        }
+    }
+
+    raise_fd_limit();
+
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (server_fd < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
-    
+
     // Set socket options to allow address reuse
     int opt = 1;
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
-    
+
     sockaddr_in address;
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(PORT);
-    
+
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
-    
-    if (listen(server_fd, 10) < 0) {
+
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
-    
-    std::cout << "Pong server running on port " << PORT << std::endl;
-    
-    // Start maintenance threads
-    std::thread notify_thread(match_notification_thread);
-    notify_thread.detach();
-    
-    std::thread cleanup(cleanup_thread);
-    cleanup.detach();
-    
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_event listen_event = {};
+    listen_event.events = EPOLLIN;
+    listen_event.data.fd = server_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &listen_event);
+
+    std::cout << "Pong server running on port " << PORT << ", idle connections dropped after "
+              << timeout.count() << "s" << std::endl;
+
+    // One thread for every connection: accepts, requests, matches and disconnects all arrive as events
+    epoll_event events[MAX_EVENTS];
     while (true) {
-        sockaddr_in client_addr;
-        socklen_t addrlen = sizeof(client_addr);
-        int client_socket = accept(server_fd, (struct sockaddr *)&client_addr, &addrlen);
-        
-        if (client_socket < 0) {
-            perror("accept");
-            continue;
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, run_timers());
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == server_fd) {
+                accept_clients(server_fd);
+                continue;
+            }
+
+            // An earlier event in this batch may have closed it
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                handle_readable(fd);
+            }
+            if (events[i].events & EPOLLOUT) {
+                auto it = connections.find(fd);
+                if (it != connections.end()) flush_output(it->second);
+            }
+            // Peer shut down its side, whatever it sent before that was read above
+            if (events[i].events & EPOLLRDHUP) {
+                close_connection(fd);
+            }
         }
-        
-        std::cout << "New connection from " << inet_ntoa(client_addr.sin_addr) 
-                  << ":" << ntohs(client_addr.sin_port) << std::endl;
-        
-        std::thread(handle_client, client_socket, client_addr).detach();
     }
-    
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,117 @@
+// server / pong_stream.cpp
+#include "pong_stream.h"
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Pieces per sendmsg call, two per frame, well under IOV_MAX
+const int MAX_IOVECS = 64;
+
+void FrameReader::feed(const char* data, size_t size) {
+    // Drop what was already returned before the buffer grows, so it does not keep every frame ever read
+    if (offset > 0 && offset == buffer.size()) {
+        buffer.clear();
+        offset = 0;
+    } else if (offset >= 4096 && offset * 2 >= buffer.size()) {
+        buffer.erase(0, offset);
+        offset = 0;
+    }
+    buffer.append(data, size);
+}
+
+ReadStatus FrameReader::readSome(int fd) {
+    char chunk[4096];
+    while (true) {
+        ssize_t bytes_read = read(fd, chunk, sizeof(chunk));
+        if (bytes_read > 0) {
+            feed(chunk, bytes_read);
+            return bad_frame ? ReadStatus::BAD_FRAME : ReadStatus::OK;
+        }
+        if (bytes_read == 0) return ReadStatus::CLOSED;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return ReadStatus::OK;
+        return ReadStatus::FAILED;
+    }
+}
+
+bool FrameReader::next(std::string& payload) {
+    if (bad_frame || buffer.size() - offset < FRAME_HEADER_SIZE) return false;
+
+    size_t size = (static_cast<uint8_t>(buffer[offset]) << 8) | static_cast<uint8_t>(buffer[offset + 1]);
+    if (size > MAX_FRAME_SIZE) {
+        bad_frame = true;
+        return false;
+    }
+    if (buffer.size() - offset < FRAME_HEADER_SIZE + size) return false;
+
+    payload.assign(buffer, offset + FRAME_HEADER_SIZE, size);
+    offset += FRAME_HEADER_SIZE + size;
+    return true;
+}
+
+ReadStatus FrameReader::readFrame(int fd, std::string& payload) {
+    while (!next(payload)) {
+        if (bad_frame) return ReadStatus::BAD_FRAME;
+        ReadStatus status = readSome(fd);
+        if (status != ReadStatus::OK) return status;
+    }
+    return ReadStatus::OK;
+}
+
+bool FrameWriter::queue(const std::string& payload) {
+    if (payload.size() > MAX_FRAME_SIZE) return false;
+
+    Frame frame;
+    frame.header[0] = static_cast<uint8_t>(payload.size() >> 8);
+    frame.header[1] = static_cast<uint8_t>(payload.size() & 0xFF);
+    frame.payload = payload;
+    frames.push_back(std::move(frame));
+    return true;
+}
+
+bool FrameWriter::flush(int fd) {
+    while (!frames.empty()) {
+        iovec pieces[MAX_IOVECS];
+        int count = 0;
+        size_t skip = front_written;
+        for (auto it = frames.begin(); it != frames.end() && count + 2 <= MAX_IOVECS; ++it) {
+            // Only the front frame can be partly written
+            if (skip < FRAME_HEADER_SIZE) {
+                pieces[count++] = {it->header + skip, FRAME_HEADER_SIZE - skip};
+                skip = 0;
+            } else {
+                skip -= FRAME_HEADER_SIZE;
+            }
+            if (skip < it->payload.size()) {
+                pieces[count++] = {const_cast<char*>(it->payload.data()) + skip, it->payload.size() - skip};
+            }
+            skip = 0;
+        }
+
+        msghdr message = {};
+        message.msg_iov = pieces;
+        message.msg_iovlen = count;
+        ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        // Retire every frame the write covered
+        size_t remaining = front_written + written;
+        while (!frames.empty() && remaining >= FRAME_HEADER_SIZE + frames.front().payload.size()) {
+            remaining -= FRAME_HEADER_SIZE + frames.front().payload.size();
+            frames.pop_front();
+        }
+        front_written = frames.empty() ? 0 : remaining;
+    }
+    return true;
+}
+
+bool FrameWriter::flushAll(int fd) {
+    while (!frames.empty()) {
+        if (!flush(fd)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+// server / pong_stream.h
+#ifndef PONG_STREAM_H
+#define PONG_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+// Framing for the TCP streams (matchmaking handshake and chat). TCP keeps no message boundaries, a read
+// may return half a message or two of them, so every message is sent as a frame: a 16-bit payload length
+// in network byte order followed by the payload.
+const size_t FRAME_HEADER_SIZE = 2;
+const size_t MAX_FRAME_SIZE = 4096;
+
+enum class ReadStatus {
+    OK,          // Read something, or nothing was there (non-blocking socket)
+    CLOSED,      // Peer closed the connection
+    FAILED,      // Socket error
+    BAD_FRAME,   // Length over MAX_FRAME_SIZE, the stream can not be trusted any more
+};
+
+// Per-connection read buffer that cuts the stream into frames
+class FrameReader {
+public:
+    // Appends bytes from the stream, used by the socket reads and by bench/stream_stress
+    void feed(const char* data, size_t size);
+    // One read() call. Non-blocking sockets return OK with nothing read when there is no data.
+    ReadStatus readSome(int fd);
+    // Pops the next complete frame's payload, false until one has fully arrived
+    bool next(std::string& payload);
+    // Blocking socket: reads until a whole frame is there
+    ReadStatus readFrame(int fd, std::string& payload);
+
+    bool malformed() const { return bad_frame; }
+    size_t buffered() const { return buffer.size() - offset; }
+
+private:
+    std::string buffer;
+    size_t offset = 0; // Start of the first frame not returned yet
+    bool bad_frame = false;
+};
+
+// Per-connection write queue. Frames are kept as header + payload pieces and written as one vectored
+// sendmsg (writev with MSG_NOSIGNAL), as many as fit in one call, picking up where a partial write stopped.
+class FrameWriter {
+public:
+    // False if the payload is too big for a frame
+    bool queue(const std::string& payload);
+    // Writes as much as the socket takes. False on a socket error; on a non-blocking socket a full
+    // buffer is not an error, what is left stays queued for the next call.
+    bool flush(int fd);
+    // Blocking socket: keeps writing until everything queued has gone
+    bool flushAll(int fd);
+
+    bool empty() const { return frames.empty(); }
+
+private:
+    struct Frame {
+        uint8_t header[FRAME_HEADER_SIZE];
+        std::string payload;
+    };
+
+    std::deque<Frame> frames;
+    size_t front_written = 0; // Bytes of the front frame (header included) already written
+};
+
+#endif
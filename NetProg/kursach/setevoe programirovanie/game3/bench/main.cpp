@@ -0,0 +1,255 @@
+// bench/main.cpp
+#include "../common/game_state.h"
+#include "../common/network.h"
+#include "../common/utils.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every allocation in the process goes through here, so a benchmark can report allocs/op
+static std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+// Keeps the compiler from dropping a result nobody reads
+template <typename T> static void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Benchmark
+{
+    std::string name;
+    // Runs the operation `iterations` times
+    std::function<void(uint64_t iterations)> run;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+// Doubles the iteration count until one batch takes at least minTime, then reports that batch
+static Result measure(const Benchmark &benchmark, std::chrono::milliseconds minTime)
+{
+    benchmark.run(16); // Warm up caches and lazily allocated state
+
+    uint64_t iterations = 1;
+    while (true)
+    {
+        uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run(iterations);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+        if (elapsed >= minTime || iterations >= (1ull << 40))
+        {
+            double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+            return {benchmark.name, iterations, ns / iterations, static_cast<double>(allocations) / iterations};
+        }
+        iterations *= 2;
+    }
+}
+
+static GameState servingState(GameVariant variant)
+{
+    GameState state(variant);
+    state.seed(12345);
+    state.reset(true);
+    return state;
+}
+
+static std::vector<Benchmark> benchmarks()
+{
+    std::vector<Benchmark> list;
+
+    list.push_back({"createPacket/GameState", [](uint64_t n) {
+                        GameState state = servingState(GameVariant::CLASSIC);
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            std::vector<uint8_t> packet =
+                                pong::createPacket(pong::MessageType::GAME_STATE_UPDATE, i, &state, sizeof(state));
+                            keep(packet.data());
+                        }
+                    }});
+
+    list.push_back({"createPacket/InputBatch", [](uint64_t n) {
+                        pong::InputBatch batch{};
+                        batch.count = pong::INPUT_BATCH_SIZE;
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            std::vector<uint8_t> packet = pong::createInputBatchPacket(batch);
+                            keep(packet.data());
+                        }
+                    }});
+
+    list.push_back({"createChatPacket", [](uint64_t n) {
+                        std::string sender = "alice";
+                        std::string message = "good game, one more?";
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            std::vector<uint8_t> packet = pong::createChatPacket(sender, message);
+                            keep(packet.data());
+                        }
+                    }});
+
+    list.push_back({"parseHeader", [](uint64_t n) {
+                        GameState state = servingState(GameVariant::CLASSIC);
+                        std::vector<uint8_t> packet =
+                            pong::createPacket(pong::MessageType::GAME_STATE_UPDATE, 7, &state, sizeof(state));
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            keep(packet.data());
+                            pong::NetworkHeader header = pong::parseHeader(packet);
+                            keep(header);
+                        }
+                    }});
+
+    for (GameVariant variant : {GameVariant::CLASSIC, GameVariant::BIG_ARENA})
+    {
+        list.push_back({std::string("GameState::update/") + variantName(variant), [variant](uint64_t n) {
+                            GameState state = servingState(variant);
+                            for (uint64_t i = 0; i < n; ++i)
+                            {
+                                state.movePaddle(1, i % 7 == 0, i % 11 == 0);
+                                keep(state.update());
+                            }
+                            keep(state);
+                        }});
+    }
+
+    list.push_back({"GameState::deserialize", [](uint64_t n) {
+                        GameState source = servingState(GameVariant::CLASSIC);
+                        std::vector<uint8_t> payload(sizeof(GameState));
+                        memcpy(payload.data(), &source, sizeof(GameState));
+                        GameState state;
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            keep(payload.data());
+                            keep(state.deserialize(payload));
+                        }
+                    }});
+
+    list.push_back({"ThreadSafeQueue/push+tryPop", [](uint64_t n) {
+                        pong::ThreadSafeQueue<std::vector<uint8_t>> queue;
+                        std::vector<uint8_t> packet(64);
+                        std::vector<uint8_t> out;
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            queue.push(packet);
+                            keep(queue.tryPop(out));
+                        }
+                    }});
+
+    // One producer, one blocking consumer: the lock handoff between the two threads
+    list.push_back({"ThreadSafeQueue/push->pop 2 threads", [](uint64_t n) {
+                        pong::ThreadSafeQueue<uint64_t> queue;
+                        std::thread consumer([&queue, n]() {
+                            for (uint64_t i = 0; i < n; ++i)
+                            {
+                                keep(queue.pop());
+                            }
+                        });
+                        for (uint64_t i = 0; i < n; ++i)
+                        {
+                            queue.push(i);
+                        }
+                        consumer.join();
+                    }});
+
+    return list;
+}
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [--json] [--filter substring] [--min-time ms]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    std::string filter;
+    std::chrono::milliseconds minTime(200);
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+        {
+            json = true;
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (arg == "--min-time" && i + 1 < argc)
+        {
+            minTime = std::chrono::milliseconds(std::max(1, std::atoi(argv[++i])));
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Benchmark &benchmark : benchmarks())
+    {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+            continue;
+
+        results.push_back(measure(benchmark, minTime));
+        if (!json)
+        {
+            const Result &result = results.back();
+            std::cout << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(10) << result.nsPerOp << " ns/op" << std::setprecision(2) << std::setw(8)
+                      << result.allocsPerOp << " allocs/op" << std::setw(14) << result.iterations << " ops"
+                      << std::endl;
+        }
+    }
+
+    if (json)
+    {
+        // One object per benchmark, stable keys so runs can be diffed or fed to a regression check
+        std::cout << std::fixed << "{\"benchmarks\":[";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &result = results[i];
+            std::cout << (i ? ",\n" : "\n") << "{\"name\":\"" << result.name << "\",\"iterations\":"
+                      << result.iterations << std::setprecision(3) << ",\"ns_per_op\":" << result.nsPerOp
+                      << ",\"allocs_per_op\":" << result.allocsPerOp << "}";
+        }
+        std::cout << "\n]}" << std::endl;
+    }
+
+    return 0;
+}
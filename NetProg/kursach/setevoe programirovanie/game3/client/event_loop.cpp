@@ -0,0 +1,117 @@
+// client/event_loop.cpp
+#include "event_loop.h"
+#include <cerrno>
+#include <cstdio>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace pong
+{
+
+EventLoop::EventLoop() : epollFd(epoll_create1(EPOLL_CLOEXEC)), timerFd(-1)
+{
+    if (epollFd < 0)
+    {
+        perror("epoll_create1");
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (timerFd >= 0)
+        close(timerFd);
+    if (epollFd >= 0)
+        close(epollFd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+
+    int op = handlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epollFd, op, fd, &event) < 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    handlers[fd] = std::move(handler);
+    return true;
+}
+
+void EventLoop::remove(int fd)
+{
+    if (handlers.erase(fd))
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+bool EventLoop::setFrameInterval(int milliseconds, std::function<void(uint64_t frames)> handler)
+{
+    if (milliseconds <= 0)
+    {
+        if (timerFd >= 0)
+        {
+            remove(timerFd);
+            close(timerFd);
+            timerFd = -1;
+        }
+        frameHandler = nullptr;
+        return true;
+    }
+
+    if (timerFd < 0)
+    {
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFd < 0)
+        {
+            perror("timerfd_create");
+            return false;
+        }
+        add(timerFd, EPOLLIN, [this](uint32_t) {
+            uint64_t expirations = 0;
+            if (read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations) && frameHandler)
+            {
+                frameHandler(expirations);
+            }
+        });
+    }
+
+    frameHandler = std::move(handler);
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec = milliseconds / 1000;
+    spec.it_interval.tv_nsec = (milliseconds % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    return timerfd_settime(timerFd, 0, &spec, nullptr) == 0;
+}
+
+void EventLoop::runOnce(int timeoutMs)
+{
+    const int maxEvents = 16;
+    epoll_event events[maxEvents];
+
+    int count = epoll_wait(epollFd, events, maxEvents, timeoutMs);
+    if (count < 0)
+    {
+        if (errno != EINTR)
+            perror("epoll_wait");
+        return;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        // A handler may remove another fd (or itself), look it up fresh every time
+        auto it = handlers.find(events[i].data.fd);
+        if (it == handlers.end())
+            continue;
+
+        Handler handler = it->second;
+        handler(events[i].events);
+    }
+}
+
+} // namespace pong
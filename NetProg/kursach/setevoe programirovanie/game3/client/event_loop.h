@@ -0,0 +1,37 @@
+// client/event_loop.h
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace pong
+{
+
+// The client's only loop: one epoll set over the UDP socket, the chat socket, stdin and a
+// timerfd frame clock. Handlers run on the calling thread, so nothing they touch needs locking.
+class EventLoop
+{
+  public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    bool add(int fd, uint32_t events, Handler handler);
+    void remove(int fd);
+
+    // Periodic frame clock, 0 stops it. The handler gets the number of elapsed frames.
+    bool setFrameInterval(int milliseconds, std::function<void(uint64_t frames)> handler);
+
+    // Waits up to timeoutMs (-1 forever) and dispatches whatever became ready
+    void runOnce(int timeoutMs);
+
+  private:
+    int epollFd;
+    int timerFd;
+    std::function<void(uint64_t)> frameHandler;
+    std::unordered_map<int, Handler> handlers;
+};
+
+} // namespace pong
@@ -3,15 +3,17 @@
 #include "../common/utils.h"
 #include <chrono>
 #include <iostream>
-#include <thread>
+#include <sys/epoll.h>
 
 namespace pong
 {
 
-Game::Game(InputHandler &inputHandler, Renderer &renderer, NetworkManager &networkManager)
-    : inputHandler(inputHandler), renderer(renderer), networkManager(networkManager), gameMode(GameMode::LOCAL),
-      isPlayer1(true), running(false), ready(false), currentInput(0), udpPort(-1), tcpPort(-1)
+Game::Game(InputHandler &inputHandler, Renderer &renderer, NetworkManager &networkManager, EventLoop &loop)
+    : ready(false), running(false), udpPort(-1), tcpPort(-1), inputHandler(inputHandler), renderer(renderer),
+      networkManager(networkManager), loop(loop), gameMode(GameMode::LOCAL), isPlayer1(true), currentInput(0),
+      quitPressed(false), variant(GameVariant::CLASSIC), peerSeed(0), stalledInput(0)
 {
+    gameState.seed(rand());
     gameState.reset(rand() % 2 == 0);
 }
 
@@ -37,6 +39,14 @@ void Game::setOpponentInfo(const ConnectResponse &response)
         return;
     }
     ready = true;
+    variant = static_cast<GameVariant>(response.variant);
+
+    // The server picked the sides and the seed, both peers have to agree on them
+    if (response.peerMatch)
+    {
+        isPlayer1 = response.isPlayer1;
+        peerSeed = response.seed;
+    }
 
     std::cout << "!!!!! Opponent info set: " << opponentName << "(" << response.mmr << ")" << "@" << opponentAddress
               << ":udp" << opponentUdpPort << ":tcp" << opponentTcpPort << std::endl;
@@ -51,24 +61,88 @@ void Game::start()
 {
     inputHandler.enableRawMode();
     running = true;
-    gameState.reset(rand() % 2 == 0);
+    if (gameMode == GameMode::PEER)
+    {
+        rollback.start(peerSeed, isPlayer1, variant);
+        gameState = rollback.getState();
+        stalledInput = InputFlags::NONE;
+    }
+    else
+    {
+        // Online the server's snapshots take over, this only gets the arena size right from the start
+        gameState = GameState(variant);
+        gameState.seed(rand());
+        gameState.reset(rand() % 2 == 0);
+    }
 
-    auto lastFrameTime = std::chrono::steady_clock::now();
-    const std::chrono::milliseconds frameTime(16); // ~60 FPS
+    // Keys are read the moment they arrive, the frame clock drives simulation and drawing
+    loop.add(STDIN_FILENO, EPOLLIN, [this](uint32_t) { onStdinReadable(); });
+    loop.setFrameInterval(16, [this](uint64_t) { // ~60 FPS, missed frames are not made up
+        update();
+        renderer.renderGameState(gameState);
+    });
 
     while (running)
     {
-        auto currentTime = std::chrono::steady_clock::now();
-        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastFrameTime);
+        loop.runOnce(-1);
+    }
+
+    loop.setFrameInterval(0, nullptr);
+    loop.remove(STDIN_FILENO);
+
+    // However the match ended, tell the server we are done
+    if (gameMode == GameMode::PEER)
+    {
+        networkManager.leavePeerMatch(false);
+    }
+}
+
+void Game::onPeerInput(const PeerInput &input)
+{
+    if (gameMode != GameMode::PEER)
+    {
+        return;
+    }
+    rollback.addRemoteInputs(input.startFrame, input.flags, input.count);
+    rollback.acknowledge(input.ackFrame);
+}
+
+void Game::onStdinReadable()
+{
+    if (inputHandler.isInChatMode())
+    {
+        std::string message;
+        if (inputHandler.readChatLine(message))
+        {
+            finishChat(message);
+        }
+        return;
+    }
 
-        if (elapsedTime >= frameTime)
+    size_t firstKey = pendingKeys.size();
+    uint8_t input = inputHandler.poll(&pendingKeys);
+
+    // Online keys go out the moment they are read, each stamped with its own frame
+    if (gameMode == GameMode::ONLINE)
+    {
+        for (size_t i = firstKey; i < pendingKeys.size(); ++i)
         {
-            update();
-            renderer.renderGameState(gameState);
-            lastFrameTime = currentTime;
+            networkManager.queueInput(pendingKeys[i]);
         }
+    }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    if (input & InputFlags::QUIT)
+    {
+        if (gameMode == GameMode::ONLINE || gameMode == GameMode::SPECTATOR)
+        {
+            networkManager.sendPlayerInput(InputFlags::QUIT, gameState.frame);
+        }
+        else if (gameMode == GameMode::PEER)
+        {
+            networkManager.leavePeerMatch(true);
+        }
+        quitPressed = true;
+        handleInput();
     }
 }
 
@@ -76,9 +150,10 @@ void Game::update()
 {
     handleInput();
 
-    if (gameMode == GameMode::ONLINE)
+    if (gameMode == GameMode::ONLINE || gameMode == GameMode::SPECTATOR)
     {
-        networkManager.sendPlayerInput(currentInput, gameState.frame);
+        // Keys were already sent as they arrived, this only covers for a lost packet
+        networkManager.resendInputs();
 
         GameState receivedState;
         if (networkManager.receiveGameState(receivedState))
@@ -86,9 +161,16 @@ void Game::update()
             gameState = receivedState;
         }
     }
+    else if (gameMode == GameMode::PEER)
+    {
+        updatePeerMatch();
+    }
     else if (gameMode == LOCAL)
     {
-        updatePlayerPaddle(currentInput);
+        for (uint8_t key : frameKeys)
+        {
+            updatePlayerPaddle(key);
+        }
         updateAI();
         if (gameState.update())
         {
@@ -96,7 +178,7 @@ void Game::update()
 
             int playerScore = gameState.player1.score;
             int AIScore = gameState.player2.score;
-            if (playerScore >= gameState.VICTORY_CONDITION || AIScore >= gameState.VICTORY_CONDITION)
+            if (gameState.hasWinner())
             {
                 std::cout << "WINNING" << std::endl;
 
@@ -109,15 +191,18 @@ void Game::update()
     }
     else if (gameMode == LOCALMULTIPLAYER)
     {
-        updatePlayer1Paddle(currentInput);
-        updatePlayer2Paddle(currentInput);
+        for (uint8_t key : frameKeys)
+        {
+            updatePlayer1Paddle(key);
+            updatePlayer2Paddle(key);
+        }
         if (gameState.update())
         {
             renderer.renderGoalAnimation();
 
             int player1Score = gameState.player1.score;
             int player2Score = gameState.player2.score;
-            if (player1Score >= gameState.VICTORY_CONDITION || player2Score >= gameState.VICTORY_CONDITION)
+            if (gameState.hasWinner())
             {
                 std::string winnerName = (player1Score >= player2Score) ? "P1" : "P2";
                 running = false;
@@ -130,6 +215,50 @@ void Game::update()
     }
 }
 
+void Game::updatePeerMatch()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    // One input per frame, so every key pressed since the last frame that ran goes in together
+    stalledInput |= currentInput;
+    if (rollback.advance(stalledInput))
+    {
+        stalledInput = InputFlags::NONE;
+    }
+    networkManager.sendPeerInput(rollback.outgoing());
+
+    // Draw the predicted state, but only end the match on a confirmed one.
+    // Goals are not animated, a predicted goal may still be rolled back.
+    gameState = rollback.getState();
+
+    const GameState &confirmed = rollback.getConfirmedState();
+    if (confirmed.hasWinner())
+    {
+        int player1Score = confirmed.player1.score;
+        int player2Score = confirmed.player2.score;
+
+        // The peer settles the same frame only once it has our inputs up to it
+        for (int i = 0; i < 2; ++i)
+        {
+            networkManager.sendPeerInput(rollback.outgoing());
+        }
+
+        bool player1Won = player1Score > player2Score;
+        running = false;
+        renderer.showVictoryScreen(player1Won == isPlayer1 ? "You" : opponentName, player1Score, player2Score);
+        return;
+    }
+
+    if (networkManager.isPeerTimedOut())
+    {
+        renderer.showDisconnectMessage();
+        running = false;
+    }
+}
+
 const GameState &Game::getGameState() const
 {
     return gameState;
@@ -137,16 +266,23 @@ const GameState &Game::getGameState() const
 
 void Game::handleInput()
 {
-    uint8_t input = inputHandler.poll();
+    // Local modes apply every key on its own, two presses within a frame move the paddle twice
+    frameKeys.swap(pendingKeys);
+    pendingKeys.clear();
 
-    if (input & InputFlags::QUIT)
+    if (quitPressed)
     {
+        quitPressed = false;
         currentInput = InputFlags::QUIT;
         running = false;
         return;
     }
 
-    currentInput = input;
+    currentInput = InputFlags::NONE;
+    for (uint8_t key : frameKeys)
+    {
+        currentInput |= key;
+    }
 }
 
 void Game::updatePlayerPaddle(uint8_t input)
@@ -160,7 +296,7 @@ void Game::updatePlayerPaddle(uint8_t input)
     }
     if (input & InputFlags::DOWN || input & InputFlags::ARROW_DOWN)
     {
-        if (gameState.player1.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
+        if (gameState.player1.position.y < gameState.height() - gameState.player1.size.y - 1)
         {
             gameState.player1.position.y += 1;
         }
@@ -178,7 +314,7 @@ void Game::updatePlayer1Paddle(uint8_t input)
     }
     if (input & InputFlags::DOWN)
     {
-        if (gameState.player1.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
+        if (gameState.player1.position.y < gameState.height() - gameState.player1.size.y - 1)
         {
             gameState.player1.position.y += 1;
         }
@@ -196,7 +332,7 @@ void Game::updatePlayer2Paddle(uint8_t input)
     }
     if (input & InputFlags::ARROW_DOWN)
     {
-        if (gameState.player2.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
+        if (gameState.player2.position.y < gameState.height() - gameState.player2.size.y - 1)
         {
             gameState.player2.position.y += 1;
         }
@@ -206,7 +342,7 @@ void Game::updatePlayer2Paddle(uint8_t input)
 void Game::updateAI()
 {
     // ai follow the ball
-    const float centerOfPaddle = gameState.player2.position.y + Paddle::HEIGHT / 2.0f;
+    const float centerOfPaddle = gameState.player2.position.y + gameState.player2.size.y / 2.0f;
     const float ballY = gameState.ball.position.y;
 
     if (gameState.ball.velocity.x > 0)
@@ -222,7 +358,7 @@ void Game::updateAI()
         else if (ballY > centerOfPaddle + 1.0f)
         {
             // Move down
-            if (gameState.player2.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
+            if (gameState.player2.position.y < gameState.height() - gameState.player2.size.y - 1)
             {
                 gameState.player2.position.y += 0.15f;
             }
@@ -237,26 +373,26 @@ void Game::toggleChat()
 
     chatActive = true;
     inputHandler.startChatMode();
+}
 
-    std::thread([this]() {
-        std::string message = inputHandler.getChatInput();
-        if (!message.empty())
-        {
-            networkManager.sendChatMessage(message);
-            ChatMessageData cm;
-            std::string name = "You";
-            strncpy(cm.content, message.data(), message.size());
-            cm.contentLength = message.size();
-            strncpy(cm.sender, name.data(), name.size());
-            auto now = std::chrono::system_clock::now();
-            cm.timestamp = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
-
-            addChatMessage(cm);
-            renderer.renderChatMessages(getChatMessages());
-        }
-        chatActive = false;
-        inputHandler.stopChatMode();
-    }).detach();
+void Game::finishChat(const std::string &message)
+{
+    if (!message.empty())
+    {
+        networkManager.sendChatMessage(message);
+        ChatMessageData cm{};
+        std::string name = "You";
+        strncpy(cm.content, message.data(), std::min(message.size(), sizeof(cm.content) - 1));
+        cm.contentLength = std::min(message.size(), sizeof(cm.content) - 1);
+        strncpy(cm.sender, name.data(), name.size());
+        auto now = std::chrono::system_clock::now();
+        cm.timestamp = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+
+        addChatMessage(cm);
+        renderer.renderChatMessages(getChatMessages());
+    }
+    chatActive = false;
+    inputHandler.stopChatMode();
 }
 
 void Game::addChatMessage(const ChatMessageData message)
@@ -2,6 +2,8 @@
 #pragma once
 
 #include "../common/game_state.h"
+#include "../common/rollback.h"
+#include "event_loop.h"
 #include "input.h"
 #include "network.h"
 #include "render.h"
@@ -13,13 +15,15 @@ enum GameMode
 {
     LOCAL,
     ONLINE,
-    LOCALMULTIPLAYER
+    LOCALMULTIPLAYER,
+    SPECTATOR,
+    PEER
 };
 
 class Game
 {
   public:
-    Game(InputHandler &inputHandler, Renderer &renderer, NetworkManager &networkManager);
+    Game(InputHandler &inputHandler, Renderer &renderer, NetworkManager &networkManager, EventLoop &loop);
     ~Game();
 
     void setGameMode(GameMode mode);
@@ -36,6 +40,7 @@ class Game
     void update();
     const GameState &getGameState() const;
     void setOpponentInfo(const ConnectResponse &response);
+    void onPeerInput(const PeerInput &input);
     bool ready;
     bool running;
     void toggleChat();
@@ -45,11 +50,14 @@ class Game
     int udpPort, tcpPort;
 
   private:
+    void onStdinReadable();
+    void finishChat(const std::string &message);
     void handleInput();
     void updatePlayerPaddle(uint8_t input);
     void updatePlayer1Paddle(uint8_t input);
     void updatePlayer2Paddle(uint8_t input);
     void updateAI();
+    void updatePeerMatch();
 
     std::vector<ChatMessageData> chatMessages;
     bool chatActive = false;
@@ -57,10 +65,18 @@ class Game
     InputHandler &inputHandler;
     Renderer &renderer;
     NetworkManager &networkManager;
+    EventLoop &loop;
     GameState gameState;
     GameMode gameMode;
     bool isPlayer1;
     uint8_t currentInput;
+    std::vector<uint8_t> pendingKeys; // Every key since the last frame, in order
+    std::vector<uint8_t> frameKeys;
+    bool quitPressed;
+    GameVariant variant;
+    RollbackSession rollback;
+    uint32_t peerSeed;
+    uint8_t stalledInput; // Keys from frames the rollback session refused to run yet
     std::string opponentName;
     std::string opponentAddress;
     std::string opponentUdpPort;
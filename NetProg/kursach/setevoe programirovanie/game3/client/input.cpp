@@ -95,9 +95,10 @@ void InputHandler::enableRawMode()
     // Apply settings
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
 
-    // Set stdin to non-blocking mode
+    // VMIN/VTIME 0 already make reads return at once. No O_NONBLOCK: stdin shares its file
+    // description with stdout on a tty, and a non-blocking stdout drops frames when the tty is slow.
     int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
 
     rawModeEnabled = true;
 }
@@ -143,7 +144,7 @@ char InputHandler::readChar()
     return c;
 }
 
-uint8_t InputHandler::poll()
+uint8_t InputHandler::poll(std::vector<uint8_t> *keys)
 {
     if (forcedQuit)
     {
@@ -156,9 +157,10 @@ uint8_t InputHandler::poll()
 
     uint8_t input = InputFlags::NONE;
 
-    while (hasInput())
+    char c;
+    while (read(STDIN_FILENO, &c, 1) == 1)
     {
-        char c = readChar();
+        uint8_t key = InputFlags::NONE;
 
         if (c == 'q' || c == 'Q')
         {
@@ -169,9 +171,9 @@ uint8_t InputHandler::poll()
         }
 
         if (c == 'w' || c == 'W')
-            input |= InputFlags::UP;
+            key = InputFlags::UP;
         if (c == 's' || c == 'S')
-            input |= InputFlags::DOWN;
+            key = InputFlags::DOWN;
 
         // arrow keys
         if (c == '\033')
@@ -182,17 +184,28 @@ uint8_t InputHandler::poll()
                 if (seq[0] == '[')
                 {
                     if (seq[1] == 'A')
-                        input |= InputFlags::ARROW_UP;
+                        key = InputFlags::ARROW_UP;
                     if (seq[1] == 'B')
-                        input |= InputFlags::ARROW_DOWN;
+                        key = InputFlags::ARROW_DOWN;
                 }
             }
         }
 
+        if (key != InputFlags::NONE)
+        {
+            input |= key;
+            if (keys)
+                keys->push_back(key);
+        }
+
         if (c == 't' || c == 'T')
         {
             if (chatCallback)
                 chatCallback();
+
+            // The rest is chat text, leave it for readChatLine
+            if (chatMode)
+                break;
         }
     }
 
@@ -204,51 +217,37 @@ void InputHandler::startChatMode()
     chatMode = true;
     currentChatInput = "";
 
-    // Switch to blocking mode for chat
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
+    // Canonical mode with echo, so stdin only turns readable once the line is entered
+    disableRawMode();
+    terminal::showCursor();
 }
 
 void InputHandler::stopChatMode()
 {
     chatMode = false;
-
-    // Switch back to non-blocking mode
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    enableRawMode();
 }
 
-std::string InputHandler::getChatInput()
+bool InputHandler::readChatLine(std::string &line)
 {
     if (!chatMode)
-        return "";
-
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-
-    disableRawMode();
-    terminal::showCursor();
-    newt.c_lflag |= (ECHO | ICANON);
+        return false;
 
-    if (fcntl(STDIN_FILENO, F_GETFL) == -1)
+    // Called when epoll reports stdin readable, so a single read does not block
+    char buffer[256];
+    ssize_t bytes = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (bytes > 0)
     {
-        std::cerr << "[WARN] STDIN_FILENO invalid @ getChatInput, skipping terminal ops" << std::endl;
-        return "";
+        currentChatInput.append(buffer, bytes);
     }
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-
-    std::string input;
-    std::getline(std::cin, input);
 
-    if (fcntl(STDIN_FILENO, F_GETFL) == -1)
-    {
-        std::cerr << "[WARN] STDIN_FILENO invalid @ getChatInput, skipping terminal ops" << std::endl;
-        return "";
-    }
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    size_t newline = currentChatInput.find('\n');
+    if (newline == std::string::npos)
+        return false;
 
-    return input;
+    line = currentChatInput.substr(0, newline);
+    currentChatInput.erase(0, newline + 1);
+    return true;
 }
 
-} // namespace pong
\ No newline at end of file
+} // namespace pong
@@ -4,8 +4,8 @@
 #include "../common/network.h"
 #include <fcntl.h>
 #include <functional>
-#include <mutex>
-#include <queue>
+#include <string>
+#include <vector>
 #include <termios.h>
 #include <unistd.h>
 
@@ -27,11 +27,12 @@ class InputHandler
 
     bool initialize();
 
-    uint8_t poll();
+    // Reads everything stdin has ready without blocking. Returns the keys OR-ed together,
+    // and each key separately in `keys` if given.
+    uint8_t poll(std::vector<uint8_t> *keys = nullptr);
 
     void forceQuit()
     {
-        std::lock_guard<std::mutex> lock(forcedInputMutex);
         forcedQuit = true;
     }
 
@@ -55,7 +56,8 @@ class InputHandler
     {
         return chatMode;
     }
-    std::string getChatInput();
+    // Collects typed chat text as stdin becomes readable, true once a full line is in `line`
+    bool readChatLine(std::string &line);
 
   private:
     struct termios originalTermios;
@@ -63,7 +65,6 @@ class InputHandler
     bool chatMode;
     std::string currentChatInput;
 
-    std::mutex forcedInputMutex;
     bool forcedQuit;
 
     std::function<void()> quitCallback;
@@ -2,10 +2,13 @@
 #include "../common/game_state.h"
 #include "../common/network.h"
 #include "../common/utils.h"
+#include "event_loop.h"
 #include "game.h"
 #include "input.h"
 #include "network.h"
 #include "render.h"
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <signal.h>
 #include <thread>
@@ -33,9 +36,10 @@ int main()
     {
         pong::InputHandler inputHandler;
         pong::Renderer renderer;
-        pong::NetworkManager networkManager;
+        pong::EventLoop loop;
+        pong::NetworkManager networkManager(loop);
 
-        auto game = std::make_shared<pong::Game>(inputHandler, renderer, networkManager);
+        auto game = std::make_shared<pong::Game>(inputHandler, renderer, networkManager, loop);
 
         // Rest of initialization...
         srand(time(NULL));
@@ -51,6 +55,9 @@ int main()
         std::cout << "2. Local multiplayer" << std::endl;
         std::cout << "3. Multiplayer (Host)" << std::endl;
         std::cout << "4. Multiplayer (Join)" << std::endl;
+        std::cout << "5. Spectate" << std::endl;
+        std::cout << "6. Multiplayer (Peer, rollback)" << std::endl;
+        std::cout << "7. Leaderboard" << std::endl;
         std::cout << "9. (Q)uit" << std::endl;
         std::cout << "Select mode: ";
 
@@ -79,10 +86,11 @@ int main()
         {
             game->setGameMode(pong::GameMode::LOCALMULTIPLAYER);
         }
-        else if (choice == "3" || choice == "4")
+        else if (choice == "3" || choice == "4" || choice == "6")
         {
-            // Multiplayer mode
-            game->setGameMode(pong::GameMode::ONLINE);
+            // Multiplayer mode, the peer variant only uses the server to find an opponent
+            bool peerMatch = choice == "6";
+            game->setGameMode(peerMatch ? pong::GameMode::PEER : pong::GameMode::ONLINE);
 
             std::string serverAddress;
             std::string username;
@@ -97,6 +105,14 @@ int main()
                 serverAddress = "127.0.0.1";
             }
 
+            std::string variantText;
+            std::cout << "Game variant (0 classic, 1 big arena, 2 marathon, empty for classic): ";
+            std::getline(std::cin, variantText);
+            unsigned long variantNumber = variantText.empty() ? 0 : std::strtoul(variantText.c_str(), nullptr, 10);
+            GameVariant variant = variantNumber < static_cast<unsigned long>(GameVariant::COUNT)
+                                            ? static_cast<GameVariant>(variantNumber)
+                                            : GameVariant::CLASSIC;
+
             if (choice == "3")
                 game->setIsPlayer1(true);
             else
@@ -108,7 +124,8 @@ int main()
             {
                 game->tcpPort = 8082 + rand() % 1000; // Making sure they dont match
             }
-            if (!networkManager.connectToServer(serverAddress, game->udpPort, game->tcpPort, username))
+            if (!networkManager.connectToServer(serverAddress, game->udpPort, game->tcpPort, username, peerMatch,
+                                                variant))
             {
                 std::cerr << "Failed to connect to server." << std::endl;
                 std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -129,7 +146,16 @@ int main()
 
             networkManager.onMatchFound = [&](const pong::ConnectResponse &response) {
                 game->setOpponentInfo(response);
-                if (response.isPlayer1)
+                if (response.peerMatch)
+                {
+                    networkManager.startPeerMatch(response.hostAddress, response.hostUdpPort);
+                }
+                if (response.chatRoom != 0)
+                {
+                    // Server relays the chat, nothing to listen on or connect to directly
+                    networkManager.connectToChatRelay(response.chatRoom, response.chatToken);
+                }
+                else if (response.isPlayer1)
                 {
                     networkManager.startChatServer(game->tcpPort);
                     std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -139,6 +165,11 @@ int main()
                     std::this_thread::sleep_for(std::chrono::milliseconds(100));
                     networkManager.connectToChat(response.hostAddress, response.hostTcpPort);
                 }
+                // After the relay, which stays on the server we connected to
+                if (response.gameServerPort != 0)
+                {
+                    networkManager.redirect(response.gameServerAddress, response.gameServerPort);
+                }
                 // std::cout << "\n\nDebug: " << response.hostAddress << response.hostTcpPort << response.hostUdpPort
                 //   << response.opponentName << response.success << response.isPlayer1 << std::flush;
 
@@ -162,12 +193,106 @@ int main()
                 game->running = false;
             };
 
+            networkManager.onPeerInput = [game](const pong::PeerInput &input) { game->onPeerInput(input); };
+
             networkManager.onChatMessage = [&](const pong::ChatMessageData &message) {
                 game->addChatMessage(message);
                 renderer.renderChatMessages(game->getChatMessages());
             };
             std::cout << "Connected to server. Waiting for game to start..." << std::endl;
         }
+        else if (choice == "5")
+        {
+            game->setGameMode(pong::GameMode::SPECTATOR);
+
+            std::string serverAddress;
+            std::string gameIdText;
+
+            std::cout << "Enter server address: ";
+            std::getline(std::cin, serverAddress);
+            if (serverAddress.size() <= 0)
+            {
+                serverAddress = "127.0.0.1";
+            }
+
+            std::cout << "Enter game id (empty for any): ";
+            std::getline(std::cin, gameIdText);
+            uint32_t gameId = gameIdText.empty() ? 0 : std::strtoul(gameIdText.c_str(), nullptr, 10);
+
+            game->udpPort = 8081 + rand() % 1000;
+            pong::SpectateResponse response;
+            if (!networkManager.spectate(serverAddress, game->udpPort, gameId, response))
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                pong::terminal::clearScreen();
+
+                if (!running)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            networkManager.onScoreEvent = [game](const pong::ScoreEvent &) {
+                game->getRenderer().renderGoalAnimation();
+            };
+
+            networkManager.onVictoryEvent = [&](const pong::VictoryEvent &event) {
+                game->getRenderer().showVictoryScreen(event.winnerName, event.player1Score, event.player2Score);
+                game->running = false;
+            };
+
+            networkManager.onDisconnectEvent = [&]() {
+                game->getRenderer().showDisconnectMessage();
+                game->running = false;
+            };
+
+            std::cout << "Watching game " << response.gameId << ": " << response.player1Name << " vs "
+                      << response.player2Name << std::endl;
+            game->ready = true;
+        }
+        else if (choice == "7")
+        {
+            std::string serverAddress;
+            std::string username;
+
+            std::cout << "Enter server address: ";
+            std::getline(std::cin, serverAddress);
+            if (serverAddress.size() <= 0)
+            {
+                serverAddress = "127.0.0.1";
+            }
+
+            std::cout << "Show players around (empty for the top): ";
+            std::getline(std::cin, username);
+
+            pong::LeaderboardRequest request{};
+            request.query = username.empty() ? pong::LeaderboardQuery::TOP : pong::LeaderboardQuery::AROUND;
+            request.count = pong::LEADERBOARD_PAGE_SIZE;
+            strncpy(request.username, username.c_str(), sizeof(request.username) - 1);
+
+            pong::LeaderboardResponse response;
+            if (networkManager.queryLeaderboard(serverAddress, 8081 + rand() % 1000, request, response))
+            {
+                std::cout << "\n  Rank  Rating  Player (" << response.totalPlayers << " rated)" << std::endl;
+                for (uint8_t i = 0; i < response.count; ++i)
+                {
+                    const pong::LeaderboardEntry &entry = response.entries[i];
+                    std::string name(entry.username, strnlen(entry.username, sizeof(entry.username)));
+                    std::cout << (name == username ? ">" : " ") << std::setw(5) << entry.rank << "  " << std::setw(6)
+                              << entry.rating << "  " << name << std::endl;
+                }
+                if (request.query == pong::LeaderboardQuery::AROUND && response.playerRank == 0)
+                {
+                    std::cout << username << " has no rating yet" << std::endl;
+                }
+            }
+
+            std::cout << "\nPress Enter to return to the menu";
+            std::getline(std::cin, username);
+            pong::terminal::clearScreen();
+            continue;
+        }
         else if (choice == "9" || choice == "q" || choice == "Q")
         {
             running = false;
@@ -193,7 +318,7 @@ int main()
             {
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(64));
+            loop.runOnce(64);
         }
 
         renderer.initialize();
@@ -1,57 +1,50 @@
 // client/network.cpp
 
 #include "network.h"
+#include <chrono>
+#include <cstddef>
+#include <sys/epoll.h>
 
 namespace pong
 {
 
-NetworkManager::NetworkManager()
-    : udpSocket(-1), tcpSocket(-1), hasPendingResponse(false), pendingResponse({}), chatClientSocket(-1)
+// A chat message on the wire is always a full header + ChatMessageData
+static constexpr size_t CHAT_PACKET_SIZE = sizeof(NetworkHeader) + sizeof(ChatMessageData);
+
+// Resend the latest input batch on this many frames after a key, so losing the last packet is survivable too
+static constexpr int INPUT_RESEND_FRAMES = 3;
+
+static bool sameAddress(const sockaddr_in &a, const sockaddr_in &b)
+{
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+NetworkManager::NetworkManager(EventLoop &loop)
+    : loop(loop), udpSocket(-1), tcpSocket(-1), hasPendingResponse(false), pendingResponse({}), spectateResponse({}),
+      chatClientSocket(-1), gameStateUpdated(false), isPlayer1(true), receiveBuffer(MAX_PACKET_SIZE)
 {
+    serverAddr = {};
+    peerAddr = {};
 }
 
 NetworkManager::~NetworkManager()
 {
-    running = false;
+    closeChatSockets();
 
-    // Force wakeup the network thread if it's blocked in recvfrom
-    if (udpSocket != -1 && udpSocket != 0)
+    if (udpSocket != -1)
     {
-        shutdown(udpSocket, SHUT_RDWR);
-        if (serverAddr.sin_port != 0)
-        {
-            sendto(udpSocket, "", 0, 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-        }
+        loop.remove(udpSocket);
         close(udpSocket);
         udpSocket = -1;
     }
-
-    if (tcpSocket != -1 && udpSocket != 0)
-    {
-        shutdown(tcpSocket, SHUT_RDWR);
-        close(tcpSocket);
-        tcpSocket = -1;
-    }
-
-    if (listenThread.joinable())
-    {
-        listenThread.join();
-    }
-
-    if (chatThread.joinable())
-    {
-        chatThread.join();
-    }
 }
 
-bool NetworkManager::connectToServer(const std::string &serverAddress, uint16_t udpPort, uint16_t tcpPort,
-                                     const std::string &username)
+bool NetworkManager::openSocket(const std::string &serverAddress, uint16_t udpPort)
 {
     this->serverAddress = serverAddress;
     this->udpPort = udpPort;
-    this->username = username;
 
-    udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    udpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
     if (udpSocket == -1)
     {
         perror("udp socket");
@@ -67,6 +60,7 @@ bool NetworkManager::connectToServer(const std::string &serverAddress, uint16_t
     {
         perror("udp bind");
         close(udpSocket);
+        udpSocket = -1;
         return false;
     }
 
@@ -78,15 +72,50 @@ bool NetworkManager::connectToServer(const std::string &serverAddress, uint16_t
     {
         std::cerr << "Invalid server address: " << serverAddress << std::endl;
         close(udpSocket);
+        udpSocket = -1;
+        return false;
+    }
+
+    loop.add(udpSocket, EPOLLIN, [this](uint32_t) { onUdpReadable(); });
+    return true;
+}
+
+bool NetworkManager::waitFor(const std::function<bool()> &done, int seconds)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (!done())
+    {
+        auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+        {
+            return false;
+        }
+        loop.runOnce(remaining);
+    }
+    return true;
+}
+
+bool NetworkManager::connectToServer(const std::string &serverAddress, uint16_t udpPort, uint16_t tcpPort,
+                                     const std::string &username, bool peerMatch, GameVariant variant)
+{
+    this->username = username;
+    this->tcpPort = tcpPort;
+
+    if (!openSocket(serverAddress, udpPort))
+    {
         return false;
     }
 
     // Prepare connection request
-    ConnectRequest request;
-    strncpy(request.username, username.c_str(), sizeof(request.username));
+    ConnectRequest &request = connectRequest;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.username, username.c_str(), sizeof(request.username) - 1);
     request.udpPort = udpPort;
     request.tcpPort = tcpPort; // For player-to-player chat
     request.mmr = 69;          // unneeded
+    request.peerMatch = peerMatch;
+    request.variant = static_cast<uint8_t>(variant);
 
     std::vector<uint8_t> packet = createPacket(MessageType::CONNECT_REQUEST, 0, &request, sizeof(request));
 
@@ -94,103 +123,119 @@ bool NetworkManager::connectToServer(const std::string &serverAddress, uint16_t
         packet.size())
     {
         perror("sendto");
-        close(udpSocket);
         return false;
     }
 
     connectionSuccess = false;
-    bool connectionDeclined = false;
-    running = true;
-    std::thread connectionThread([&]() {
-        fd_set readSet;
-        struct timeval timeout;
+    connectionDeclined = false;
+    waitFor([this]() { return connectionSuccess || connectionDeclined; }, 5);
 
-        FD_ZERO(&readSet);
-        FD_SET(udpSocket, &readSet);
-
-        timeout.tv_sec = 5;
-        timeout.tv_usec = 0;
+    if (connectionDeclined)
+    {
+        std::cerr << "Connection declined by server (are you already logged in?)" << std::endl;
+        return false;
+    }
 
-        int result = select(udpSocket + 1, &readSet, NULL, NULL, &timeout);
+    if (!connectionSuccess)
+    {
+        std::cerr << "Connection to server failed or timed out" << std::endl;
+        return false;
+    }
 
-        if (result > 0 && FD_ISSET(udpSocket, &readSet))
-        {
-            std::vector<uint8_t> buffer(1024);
-            sockaddr_in fromAddr;
-            socklen_t fromLen = sizeof(fromAddr);
+    std::cout << "Successfully connected to server" << std::endl;
+    return true;
+}
 
-            ssize_t bytesReceived =
-                recvfrom(udpSocket, buffer.data(), buffer.size(), 0, (struct sockaddr *)&fromAddr, &fromLen);
+bool NetworkManager::spectate(const std::string &serverAddress, uint16_t udpPort, uint32_t gameId,
+                              SpectateResponse &response)
+{
+    if (!openSocket(serverAddress, udpPort))
+    {
+        return false;
+    }
 
-            if (bytesReceived > sizeof(NetworkHeader))
-            {
-                NetworkHeader *header = reinterpret_cast<NetworkHeader *>(buffer.data());
-
-                if (header->type == MessageType::CONNECT_RESPONSE &&
-                    bytesReceived >= sizeof(NetworkHeader) + sizeof(ConnectResponse))
-                {
-                    ConnectResponse *response =
-                        reinterpret_cast<ConnectResponse *>(buffer.data() + sizeof(NetworkHeader));
-
-                    if (response->success)
-                    {
-                        std::lock_guard<std::mutex> lock(connectionMutex);
-                        isPlayer1 = response->isPlayer1;
-                        serverAddr = fromAddr;
-                        connectionSuccess = true;
-
-                        std::cout << "Successfully connected to server" << std::endl;
-                        if (onMatchFound)
-                            onMatchFound(*response);
-                    }
-                    else
-                    {
-                        connectionDeclined = true;
-                    }
-                    connectionCV.notify_one();
-                }
-            }
-        }
+    SpectateRequest request{};
+    request.gameId = gameId;
+    request.udpPort = udpPort;
+    std::vector<uint8_t> packet = createPacket(MessageType::SPECTATE_REQUEST, 0, &request, sizeof(request));
+    sendto(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
 
-        startListening();
-    });
-    connectionThread.detach();
+    // Snapshots may race the response, handlePacket keeps them as usual
+    spectateAnswered = false;
+    if (!waitFor([this]() { return spectateAnswered; }, 5))
+    {
+        std::cerr << "Spectate request timed out" << std::endl;
+        return false;
+    }
 
+    response = spectateResponse;
+    if (!response.success)
     {
-        std::unique_lock<std::mutex> lock(connectionMutex);
-        connectionCV.wait_for(lock, std::chrono::seconds(5), [this]() { return connectionSuccess; });
+        std::cerr << "No such game to spectate" << std::endl;
+        return false;
     }
 
-    if (connectionDeclined)
+    isPlayer1 = true;
+    connectionSuccess = true;
+    return true;
+}
+
+bool NetworkManager::queryLeaderboard(const std::string &serverAddress, uint16_t udpPort,
+                                      const LeaderboardRequest &request, LeaderboardResponse &response)
+{
+    if (!openSocket(serverAddress, udpPort))
     {
-        std::cerr << "Connection declined by server (are you already logged in?)" << std::endl;
         return false;
     }
 
-    if (!connectionSuccess)
+    LeaderboardRequest query = request;
+    query.udpPort = udpPort;
+    std::vector<uint8_t> packet = createPacket(MessageType::LEADERBOARD_REQUEST, 0, &query, sizeof(query));
+    sendto(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+
+    leaderboardAnswered = false;
+    if (!waitFor([this]() { return leaderboardAnswered; }, 5))
     {
-        std::cerr << "Connection to server failed or timed out" << std::endl;
+        std::cerr << "Leaderboard request timed out" << std::endl;
         return false;
     }
 
+    response = leaderboardResponse;
+    response.count = std::min<uint8_t>(response.count, LEADERBOARD_PAGE_SIZE);
     return true;
 }
 
-void NetworkManager::startListening()
+void NetworkManager::onUdpReadable()
 {
-    listenThread = std::thread([this]() {
-        while (running)
+    sockaddr_in fromAddr;
+    socklen_t fromLen;
+
+    // Level-triggered: drain what is queued now, anything later wakes the loop again
+    while (udpSocket != -1)
+    {
+        fromLen = sizeof(fromAddr);
+        ssize_t bytesReceived = recvfrom(udpSocket, receiveBuffer.data(), receiveBuffer.size(), 0,
+                                         (struct sockaddr *)&fromAddr, &fromLen);
+        if (bytesReceived < 0)
         {
-            std::vector<uint8_t> packet = receivePacket();
-            if (!packet.empty())
+            if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
             {
-                handlePacket(packet);
+                perror("recvfrom");
             }
+            return;
         }
-    });
+
+        // During a peer match only the server and the opponent get a say
+        if (peerActive && !sameAddress(fromAddr, peerAddr) && !sameAddress(fromAddr, serverAddr))
+        {
+            continue;
+        }
+
+        handlePacket(std::vector<uint8_t>(receiveBuffer.begin(), receiveBuffer.begin() + bytesReceived), fromAddr);
+    }
 }
 
-void NetworkManager::handlePacket(const std::vector<uint8_t> &packet)
+void NetworkManager::handlePacket(const std::vector<uint8_t> &packet, const sockaddr_in &from)
 {
     if (packet.size() < sizeof(NetworkHeader))
         return;
@@ -199,31 +244,87 @@ void NetworkManager::handlePacket(const std::vector<uint8_t> &packet)
 
     switch (header->type)
     {
+    case MessageType::CONNECT_CHALLENGE: {
+        if (packet.size() < sizeof(NetworkHeader) + sizeof(ConnectChallenge) || connectionSuccess)
+            break;
+
+        // Repeat the request with the cookie, proving we receive at this address. The server answers from
+        // the address it will keep using.
+        serverAddr = from;
+        ConnectChallenge challenge;
+        memcpy(&challenge, packet.data() + sizeof(NetworkHeader), sizeof(challenge));
+        connectRequest.cookie = challenge.cookie;
+        std::vector<uint8_t> retry =
+            createPacket(MessageType::CONNECT_REQUEST, 0, &connectRequest, sizeof(connectRequest));
+        sendto(udpSocket, retry.data(), retry.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+        break;
+    }
+
     case MessageType::CONNECT_RESPONSE: {
+        if (packet.size() < sizeof(NetworkHeader) + sizeof(ConnectResponse))
+            break;
+
         const ConnectResponse *response =
             reinterpret_cast<const ConnectResponse *>(packet.data() + sizeof(NetworkHeader));
 
+        // The first response only accepts or declines the connection
+        if (!connectionSuccess)
+        {
+            if (response->success)
+            {
+                serverAddr = from;
+                isPlayer1 = response->isPlayer1;
+                connectionSuccess = true;
+            }
+            else
+            {
+                connectionDeclined = true;
+            }
+            break;
+        }
+
         std::cout << "[MATCHMAKING] Opponent: " << response->opponentName << "(" << response->mmr << ")" << std::endl;
         std::cout << "Address: " << response->hostAddress << ", UDP: " << response->hostUdpPort
                   << ", TCP: " << response->hostTcpPort << std::endl;
         std::cout << "You are player " << (response->isPlayer1 ? "1" : "2") << std::endl;
         isPlayer1 = response->isPlayer1;
 
-        std::lock_guard<std::mutex> lock(callbackMutex);
         pendingResponse = *response;
         hasPendingResponse = true;
 
         break;
     }
 
+    case MessageType::SPECTATE_RESPONSE: {
+        if (packet.size() >= sizeof(NetworkHeader) + sizeof(SpectateResponse))
+        {
+            memcpy(&spectateResponse, packet.data() + sizeof(NetworkHeader), sizeof(spectateResponse));
+            spectateAnswered = true;
+            if (!connectionSuccess)
+            {
+                serverAddr = from;
+            }
+        }
+        break;
+    }
+
+    case MessageType::LEADERBOARD_RESPONSE: {
+        if (packet.size() >= sizeof(NetworkHeader) + sizeof(LeaderboardResponse))
+        {
+            memcpy(&leaderboardResponse, packet.data() + sizeof(NetworkHeader), sizeof(leaderboardResponse));
+            leaderboardAnswered = true;
+        }
+        break;
+    }
+
     case MessageType::GAME_STATE_UPDATE: {
         if (packet.size() >= sizeof(NetworkHeader) + sizeof(GameState))
         {
             GameState state;
             if (state.deserialize(std::vector<uint8_t>(packet.begin() + sizeof(NetworkHeader), packet.end())))
             {
-                std::lock_guard<std::mutex> lock(gameStateMutex);
                 latestGameState = state;
+                latestGameStateTime = std::chrono::steady_clock::now();
                 gameStateUpdated = true;
             }
         }
@@ -269,7 +370,30 @@ void NetworkManager::handlePacket(const std::vector<uint8_t> &packet)
         break;
     }
 
+    case MessageType::PEER_INPUT: {
+        const size_t minimumSize = sizeof(NetworkHeader) + offsetof(PeerInput, flags);
+        if (!peerActive || packet.size() < minimumSize)
+            break;
+
+        PeerInput input{};
+        size_t payloadSize = std::min(packet.size() - sizeof(NetworkHeader), sizeof(input));
+        memcpy(&input, packet.data() + sizeof(NetworkHeader), payloadSize);
+        if (input.count > PEER_INPUT_WINDOW || packet.size() < minimumSize + input.count)
+            break;
+
+        lastPeerPacketTime = std::chrono::steady_clock::now();
+        if (onPeerInput)
+        {
+            onPeerInput(input);
+        }
+        break;
+    }
+
     case MessageType::DISCONNECT_EVENT: {
+        // A peer sends a few copies
+        if (disconnectReported)
+            break;
+        disconnectReported = true;
         if (onDisconnectEvent)
         {
             onDisconnectEvent();
@@ -277,6 +401,17 @@ void NetworkManager::handlePacket(const std::vector<uint8_t> &packet)
         break;
     }
 
+    case MessageType::PING: {
+        if (packet.size() >= sizeof(NetworkHeader) + sizeof(PingData))
+        {
+            // Echo the payload back so the server can measure the round trip
+            std::vector<uint8_t> pong = createPacket(MessageType::PONG, header->frame,
+                                                     packet.data() + sizeof(NetworkHeader), sizeof(PingData));
+            sendto(udpSocket, pong.data(), pong.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+        }
+        break;
+    }
+
     default:
         std::cerr << "Unknown message type: " << static_cast<int>(header->type) << "\n";
         break;
@@ -304,75 +439,162 @@ void NetworkManager::sendPlayerInput(uint8_t inputFlags, uint32_t currentFrame)
     }
 }
 
-bool NetworkManager::receiveGameState(GameState &state)
+uint32_t NetworkManager::estimateServerFrame() const
 {
-    std::lock_guard<std::mutex> lock(gameStateMutex);
-    state = latestGameState;
-    bool updated = gameStateUpdated;
-    gameStateUpdated = false;
+    if (latestGameState.frame == 0)
+    {
+        return 0;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - latestGameStateTime;
+    auto ticks = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * SERVER_TICK_RATE / 1000000;
+    return latestGameState.frame + static_cast<uint32_t>(ticks);
+}
+
+void NetworkManager::queueInput(uint8_t inputFlags)
+{
+    if (inputFlags == 0)
+    {
+        return;
+    }
+
+    InputEvent event{};
+    event.sequence = ++inputSequence;
+    event.frame = estimateServerFrame();
+    event.flags = inputFlags;
+
+    inputHistory.push_back(event);
+    if (inputHistory.size() > INPUT_BATCH_SIZE)
+    {
+        inputHistory.pop_front();
+    }
+
+    inputResendsLeft = INPUT_RESEND_FRAMES;
+    resendInputs();
+}
+
+void NetworkManager::resendInputs()
+{
+    if (inputResendsLeft <= 0 || inputHistory.empty())
+    {
+        return;
+    }
+    inputResendsLeft--;
+
+    InputBatch batch{};
+    batch.playerId = isPlayer1 ? 1 : 2;
+    batch.count = inputHistory.size();
+    std::copy(inputHistory.begin(), inputHistory.end(), batch.events);
+
+    std::vector<uint8_t> packet = createInputBatchPacket(batch);
+    if (sendto(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) !=
+        static_cast<ssize_t>(packet.size()))
+    {
+        std::cerr << "Failed to send input packet" << std::endl;
+    }
+}
+
+bool NetworkManager::redirect(const std::string &address, uint16_t port)
+{
+    sockaddr_in gameServer{};
+    gameServer.sin_family = AF_INET;
+    gameServer.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &gameServer.sin_addr) <= 0)
+    {
+        std::cerr << "Invalid game server address: " << address << std::endl;
+        return false;
+    }
+
+    serverAddr = gameServer;
     return true;
 }
 
-std::vector<uint8_t> NetworkManager::receivePacket()
+bool NetworkManager::startPeerMatch(const std::string &address, uint16_t port)
 {
-    std::vector<uint8_t> packet(MAX_PACKET_SIZE);
-    sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
+    peerAddr = {};
+    peerAddr.sin_family = AF_INET;
+    peerAddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &peerAddr.sin_addr) <= 0)
+    {
+        std::cerr << "Invalid peer address: " << address << std::endl;
+        return false;
+    }
+
+    peerActive = true;
+    lastPeerPacketTime = std::chrono::steady_clock::now();
+    return true;
+}
 
-    int bytesReceived = recvfrom(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&addr, &addrlen);
-    if (bytesReceived < 0)
+void NetworkManager::sendPeerInput(const PeerInput &input)
+{
+    if (!peerActive)
     {
-        if (errno == EBADF)
-        {
-            return {};
-        }
-        if (errno != EWOULDBLOCK && errno != EAGAIN)
+        return;
+    }
+
+    std::vector<uint8_t> packet = createPeerInputPacket(input);
+    if (sendto(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&peerAddr, sizeof(peerAddr)) !=
+        static_cast<ssize_t>(packet.size()))
+    {
+        std::cerr << "Failed to send peer input" << std::endl;
+    }
+}
+
+void NetworkManager::leavePeerMatch(bool notifyPeer)
+{
+    if (!peerActive)
+    {
+        return;
+    }
+
+    // Nobody acknowledges this, a few copies make losing all of them unlikely
+    if (notifyPeer)
+    {
+        std::vector<uint8_t> packet = createPacket(MessageType::DISCONNECT_EVENT, 0, nullptr, 0);
+        for (int i = 0; i < 3; ++i)
         {
-            perror("recvfrom");
+            sendto(udpSocket, packet.data(), packet.size(), 0, (struct sockaddr *)&peerAddr, sizeof(peerAddr));
         }
-        return {};
     }
 
-    packet.resize(bytesReceived);
-    return packet;
+    peerActive = false;
+    sendPlayerInput(InputFlags::QUIT, 0);
+}
+
+bool NetworkManager::isPeerTimedOut() const
+{
+    return peerActive &&
+           std::chrono::steady_clock::now() - lastPeerPacketTime > std::chrono::seconds(CLIENT_TIMEOUT_SECONDS);
+}
+
+bool NetworkManager::receiveGameState(GameState &state)
+{
+    if (!gameStateUpdated)
+    {
+        return false;
+    }
+    state = latestGameState;
+    gameStateUpdated = false;
+    return true;
 }
 
 bool NetworkManager::isConnected()
 {
     return connectionSuccess;
 }
+
 void NetworkManager::processCallbacks()
 {
-    std::lock_guard<std::mutex> lock(callbackMutex);
-
-    // Make a local copy of the response to ensure thread safety
-    ConnectResponse response;
-    bool shouldProcess = false;
-
-    if (hasPendingResponse)
+    if (hasPendingResponse && onMatchFound)
     {
-        // Copy all fields explicitly to avoid padding issues
-        response.success = pendingResponse.success;
-        response.isPlayer1 = pendingResponse.isPlayer1;
-        response.hostUdpPort = pendingResponse.hostUdpPort;
-        response.hostTcpPort = pendingResponse.hostTcpPort;
-        strncpy(response.hostAddress, pendingResponse.hostAddress, sizeof(response.hostAddress));
-        strncpy(response.opponentName, pendingResponse.opponentName, sizeof(response.opponentName));
-        response.mmr = pendingResponse.mmr;
-
-        shouldProcess = true;
         hasPendingResponse = false;
-    }
-
-    if (shouldProcess && onMatchFound)
-    {
-        onMatchFound(response);
+        onMatchFound(pendingResponse);
     }
 }
 
 bool NetworkManager::startChatServer(uint16_t port)
 {
-    tcpSocket = socket(AF_INET, SOCK_STREAM, 0);
+    tcpSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (tcpSocket == -1)
     {
         perror("chat socket");
@@ -388,6 +610,7 @@ bool NetworkManager::startChatServer(uint16_t port)
     {
         perror("chat bind");
         close(tcpSocket);
+        tcpSocket = -1;
         return false;
     }
 
@@ -395,56 +618,33 @@ bool NetworkManager::startChatServer(uint16_t port)
     {
         perror("chat listen");
         close(tcpSocket);
+        tcpSocket = -1;
         return false;
     }
 
-    chatRunning = true;
-    chatThread = std::thread([this]() {
-        sockaddr_in clientAddr{};
-        socklen_t clientLen = sizeof(clientAddr);
-        int clientSocket = accept(tcpSocket, (struct sockaddr *)&clientAddr, &clientLen);
-        chatClientSocket = clientSocket;
+    loop.add(tcpSocket, EPOLLIN, [this](uint32_t) { acceptChatPeer(); });
+    return true;
+}
 
-        if (clientSocket < 0)
-        {
+void NetworkManager::acceptChatPeer()
+{
+    sockaddr_in clientAddr{};
+    socklen_t clientLen = sizeof(clientAddr);
+    int clientSocket = accept4(tcpSocket, (struct sockaddr *)&clientAddr, &clientLen, SOCK_NONBLOCK);
+    if (clientSocket < 0)
+    {
+        if (errno != EWOULDBLOCK && errno != EAGAIN)
             perror("chat accept");
-            return;
-        }
-
-        struct timeval timeout;
-        timeout.tv_sec = 2;
-        timeout.tv_usec = 0;
-        setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
-        std::vector<uint8_t> buffer(sizeof(NetworkHeader) + sizeof(ChatMessageData));
-        while (chatRunning)
-        {
-            ssize_t bytes = recv(clientSocket, buffer.data(), buffer.size(), 0);
-            if (bytes <= 0)
-            {
-                if (errno == EWOULDBLOCK || errno == EAGAIN)
-                {
-                    continue;
-                }
-                std::cerr << "recv error: " << strerror(errno) << std::endl;
-                break;
-            }
-
-            std::lock_guard<std::mutex> lock(chatMutex);
-
-            const NetworkHeader *header = reinterpret_cast<const NetworkHeader *>(buffer.data());
-            ChatMessageData *message = reinterpret_cast<ChatMessageData *>(buffer.data() + sizeof(NetworkHeader));
+        return;
+    }
 
-            chatMessages.push_back(*message);
-            if (onChatMessage)
-            {
-                onChatMessage(*message);
-            }
-        }
-        close(clientSocket);
-    });
+    // Only one opponent, stop listening once they are in
+    loop.remove(tcpSocket);
+    close(tcpSocket);
+    tcpSocket = -1;
 
-    return true;
+    chatClientSocket = clientSocket;
+    watchChatSocket(chatClientSocket);
 }
 
 bool NetworkManager::connectToChat(const std::string &address, uint16_t port)
@@ -456,11 +656,6 @@ bool NetworkManager::connectToChat(const std::string &address, uint16_t port)
         return false;
     }
 
-    struct timeval timeout;
-    timeout.tv_sec = 2;
-    timeout.tv_usec = 0;
-    setsockopt(tcpSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
     sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(port);
@@ -470,47 +665,213 @@ bool NetworkManager::connectToChat(const std::string &address, uint16_t port)
     {
         perror("chat connect");
         close(tcpSocket);
+        tcpSocket = -1;
         return false;
     }
 
-    chatRunning = true;
-    chatThread = std::thread([this]() {
-        std::vector<uint8_t> buffer(sizeof(NetworkHeader) + sizeof(ChatMessageData));
-        while (chatRunning)
+    int flags = fcntl(tcpSocket, F_GETFL, 0);
+    fcntl(tcpSocket, F_SETFL, flags | O_NONBLOCK);
+    watchChatSocket(tcpSocket);
+    return true;
+}
+
+void NetworkManager::watchChatSocket(int socket)
+{
+    chatBuffer.clear();
+    loop.add(socket, EPOLLIN | EPOLLRDHUP, [this, socket](uint32_t) { onChatReadable(socket); });
+}
+
+void NetworkManager::onChatReadable(int socket)
+{
+    uint8_t buffer[4096];
+    while (true)
+    {
+        ssize_t bytes = recv(socket, buffer, sizeof(buffer), 0);
+        if (bytes > 0)
         {
-            ssize_t bytes = recv(tcpSocket, buffer.data(), buffer.size(), 0);
-            if (bytes <= 0)
-            {
-                if (errno == EWOULDBLOCK || errno == EAGAIN)
-                {
-                    continue;
-                }
-                std::cerr << "recv error: " << strerror(errno) << std::endl;
-                break;
-            }
-            std::lock_guard<std::mutex> lock(chatMutex);
+            chatBuffer.insert(chatBuffer.end(), buffer, buffer + bytes);
+            continue;
+        }
+        if (bytes < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+        {
+            break;
+        }
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        // Peer is gone, chat just goes quiet
+        if (bytes < 0)
+        {
+            std::cerr << "recv error: " << strerror(errno) << std::endl;
+        }
+        loop.remove(socket);
+        break;
+    }
+
+    // TCP may split or coalesce messages, hand out only complete ones
+    size_t offset = 0;
+    while (chatBuffer.size() - offset >= CHAT_PACKET_SIZE)
+    {
+        ChatMessageData message;
+        memcpy(&message, chatBuffer.data() + offset + sizeof(NetworkHeader), sizeof(message));
+        offset += CHAT_PACKET_SIZE;
+
+        chatMessages.push_back(message);
+        if (onChatMessage)
+        {
+            onChatMessage(message);
+        }
+    }
+    chatBuffer.erase(chatBuffer.begin(), chatBuffer.begin() + offset);
+}
+
+bool NetworkManager::connectToChatRelay(uint32_t room, uint32_t token)
+{
+    relaySocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (relaySocket == -1)
+    {
+        perror("chat relay socket");
+        return false;
+    }
+
+    sockaddr_in relayAddr = serverAddr;
+    relayAddr.sin_port = htons(TCP_SERVER_PORT);
+
+    if (connect(relaySocket, (struct sockaddr *)&relayAddr, sizeof(relayAddr)))
+    {
+        perror("chat relay connect");
+        close(relaySocket);
+        relaySocket = -1;
+        return false;
+    }
+
+    int flags = fcntl(relaySocket, F_GETFL, 0);
+    fcntl(relaySocket, F_SETFL, flags | O_NONBLOCK);
+
+    relayInput.clear();
+    relayOutput.clear();
+    loop.add(relaySocket, EPOLLIN | EPOLLRDHUP, [this](uint32_t events) { onRelayEvent(events); });
+
+    ChatHello hello{};
+    hello.room = room;
+    hello.token = token;
+    strncpy(hello.username, username.c_str(), sizeof(hello.username) - 1);
+    sendRelayFrame(createChatFrame(&hello, sizeof(hello), ""));
+    return true;
+}
+
+void NetworkManager::onRelayEvent(uint32_t events)
+{
+    if (events & EPOLLOUT)
+    {
+        sendRelayFrame({});
+    }
+    if (relaySocket == -1 || !(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    {
+        return;
+    }
 
-            const NetworkHeader *header = reinterpret_cast<const NetworkHeader *>(buffer.data());
-            const ChatMessageData *message =
-                reinterpret_cast<const ChatMessageData *>(buffer.data() + sizeof(NetworkHeader));
-            chatMessages.push_back(*message);
-            if (onChatMessage)
+    uint8_t buffer[4096];
+    while (true)
+    {
+        ssize_t bytes = recv(relaySocket, buffer, sizeof(buffer), 0);
+        if (bytes > 0)
+        {
+            relayInput.insert(relayInput.end(), buffer, buffer + bytes);
+            continue;
+        }
+        if (bytes < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+        {
+            break;
+        }
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        // Relay is gone (or restarted), chat just goes quiet
+        loop.remove(relaySocket);
+        close(relaySocket);
+        relaySocket = -1;
+        break;
+    }
+
+    size_t offset = 0;
+    while (relayInput.size() - offset >= CHAT_FRAME_PREFIX_SIZE)
+    {
+        uint16_t length;
+        memcpy(&length, relayInput.data() + offset, CHAT_FRAME_PREFIX_SIZE);
+        length = ntohs(length);
+        if (relayInput.size() - offset - CHAT_FRAME_PREFIX_SIZE < length)
+            break;
+
+        const uint8_t *payload = relayInput.data() + offset + CHAT_FRAME_PREFIX_SIZE;
+        offset += CHAT_FRAME_PREFIX_SIZE + length;
+        if (length < sizeof(ChatRelayHeader))
+            continue;
+
+        ChatRelayHeader header;
+        memcpy(&header, payload, sizeof(header));
+
+        ChatMessageData message{};
+        memcpy(message.sender, header.sender, sizeof(message.sender));
+        message.sender[sizeof(message.sender) - 1] = '\0';
+        message.timestamp = header.timestamp;
+        message.contentLength = std::min<size_t>(length - sizeof(header), sizeof(message.content) - 1);
+        memcpy(message.content, payload + sizeof(header), message.contentLength);
+
+        chatMessages.push_back(message);
+        if (onChatMessage)
+        {
+            onChatMessage(message);
+        }
+    }
+    relayInput.erase(relayInput.begin(), relayInput.begin() + offset);
+}
+
+void NetworkManager::sendRelayFrame(const std::vector<uint8_t> &frame)
+{
+    if (relaySocket == -1)
+        return;
+
+    relayOutput.insert(relayOutput.end(), frame.begin(), frame.end());
+    size_t sent = 0;
+    while (sent < relayOutput.size())
+    {
+        ssize_t bytes = send(relaySocket, relayOutput.data() + sent, relayOutput.size() - sent, MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+        {
+            if (errno != EWOULDBLOCK && errno != EAGAIN)
             {
-                onChatMessage(*message);
+                std::cerr << "send error: " << strerror(errno) << std::endl;
             }
+            break;
         }
-    });
+        sent += bytes;
+    }
+    relayOutput.erase(relayOutput.begin(), relayOutput.begin() + sent);
 
-    return true;
+    // Wait for room in the socket only while something is queued
+    uint32_t events = EPOLLIN | EPOLLRDHUP | (relayOutput.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT));
+    loop.add(relaySocket, events, [this](uint32_t events) { onRelayEvent(events); });
 }
 
 void NetworkManager::sendChatMessage(const std::string &message_text)
 {
+    if (relaySocket != -1)
+    {
+        sendRelayFrame(createChatFrame(nullptr, 0, message_text));
+        return;
+    }
+
     int socket = chatClientSocket != -1 ? chatClientSocket : tcpSocket;
     if (socket != -1)
     {
         std::vector<uint8_t> packet = createChatPacket(username, message_text);
-        std::cout << "Sending to tcpSocket on " << socket << "\n" << std::flush;
         ssize_t bytesSent = send(socket, packet.data(), packet.size(), MSG_NOSIGNAL);
         if (bytesSent <= 0)
         {
@@ -533,23 +894,35 @@ void NetworkManager::sendChatMessage(const std::string &message_text)
 
 std::vector<ChatMessageData> NetworkManager::getChatMessages()
 {
-    std::lock_guard<std::mutex> lock(chatMutex);
     return chatMessages;
 }
 
-void NetworkManager::stopChat()
+void NetworkManager::closeChatSockets()
 {
-    chatRunning = false;
+    if (relaySocket != -1)
+    {
+        loop.remove(relaySocket);
+        close(relaySocket);
+        relaySocket = -1;
+    }
+    if (chatClientSocket != -1)
+    {
+        loop.remove(chatClientSocket);
+        close(chatClientSocket);
+        chatClientSocket = -1;
+    }
     if (tcpSocket != -1)
     {
+        loop.remove(tcpSocket);
         shutdown(tcpSocket, SHUT_RDWR);
         close(tcpSocket);
         tcpSocket = -1;
     }
-    if (chatThread.joinable())
-    {
-        chatThread.join();
-    }
 }
 
-} // namespace pong
\ No newline at end of file
+void NetworkManager::stopChat()
+{
+    closeChatSockets();
+}
+
+} // namespace pong
@@ -3,21 +3,18 @@
 #pragma once
 
 #include "../common/network.h"
+#include "event_loop.h"
 #include <arpa/inet.h>
-#include <atomic>
-#include <condition_variable>
 #include <fcntl.h>
 #include <functional>
 #include <iostream>
-#include <mutex>
 #include <netinet/in.h>
-#include <queue>
 #include <string.h>
 #include <string>
 #include <sys/socket.h>
-#include <thread>
+#include <chrono>
+#include <deque>
 #include <unistd.h>
-#include <unordered_map>
 #include <vector>
 
 namespace pong
@@ -26,20 +23,42 @@ namespace pong
 class NetworkManager
 {
   public:
-    NetworkManager();
+    explicit NetworkManager(EventLoop &loop);
     ~NetworkManager();
 
     bool connectToServer(const std::string &serverAddress, uint16_t udpPort, uint16_t tcpPort,
-                         const std::string &username);
+                         const std::string &username, bool peerMatch = false,
+                         GameVariant variant = GameVariant::CLASSIC);
+    bool spectate(const std::string &serverAddress, uint16_t udpPort, uint32_t gameId, SpectateResponse &response);
+    bool queryLeaderboard(const std::string &serverAddress, uint16_t udpPort, const LeaderboardRequest &request,
+                          LeaderboardResponse &response);
     void sendPlayerInput(uint8_t inputFlags, uint32_t currentFrame);
+    // Stamps a key event with the current server frame and sends it with the previous few
+    void queueInput(uint8_t inputFlags);
+    // Called every frame, repeats the last batch for a few frames after the latest key
+    void resendInputs();
+    // Last snapshot's frame advanced by the time since it arrived
+    uint32_t estimateServerFrame() const;
     bool receiveGameState(GameState &state);
-    void startListening();
-    void handlePacket(const std::vector<uint8_t> &packet);
+
+    // Cluster mode: inputs and keepalive replies go to the game server hosting the match from now on
+    bool redirect(const std::string &address, uint16_t port);
+
+    // Peer match: inputs go straight to the opponent, the server only hears about the end
+    bool startPeerMatch(const std::string &address, uint16_t port);
+    void sendPeerInput(const PeerInput &input);
+    void leavePeerMatch(bool notifyPeer);
+    bool isPeerTimedOut() const;
+
+    // from is adopted as the server's address by the answers to our own requests, nothing else
+    void handlePacket(const std::vector<uint8_t> &packet, const sockaddr_in &from);
     bool isConnected();
     void processCallbacks();
 
     bool startChatServer(uint16_t port);
     bool connectToChat(const std::string &address, uint16_t port);
+    // Chat through the server's relay instead of directly, the room and token come with the match
+    bool connectToChatRelay(uint32_t room, uint32_t token);
     void sendChatMessage(const std::string &message);
     std::vector<ChatMessageData> getChatMessages();
     void stopChat();
@@ -49,37 +68,60 @@ class NetworkManager
     std::function<void(const VictoryEvent &)> onVictoryEvent;
     std::function<void(const ScoreEvent &)> onScoreEvent;
     std::function<void(const ChatMessageData &)> onChatMessage;
+    std::function<void(const PeerInput &)> onPeerInput;
 
   private:
+    // Binds the UDP socket, registers it with the loop and points serverAddr at the server
+    bool openSocket(const std::string &serverAddress, uint16_t udpPort);
+    // Runs the event loop until `done` holds or `seconds` pass
+    bool waitFor(const std::function<bool()> &done, int seconds);
+
+    void onUdpReadable();
+    void acceptChatPeer();
+    void watchChatSocket(int socket);
+    void onChatReadable(int socket);
+    void onRelayEvent(uint32_t events);
+    void sendRelayFrame(const std::vector<uint8_t> &frame);
+    void closeChatSockets();
+
+    EventLoop &loop;
     ConnectResponse pendingResponse;
+    ConnectRequest connectRequest; // Sent again with the cookie from a CONNECT_CHALLENGE
+    SpectateResponse spectateResponse;
     sockaddr_in serverAddr;
     int udpSocket;
     int tcpSocket;
-    std::thread chatThread;
-    std::atomic<bool> chatRunning{false};
-    std::vector<ChatMessageData> chatMessages;
-    std::mutex chatMutex;
     int chatClientSocket;
+    std::vector<ChatMessageData> chatMessages;
+    std::vector<uint8_t> chatBuffer;
+    int relaySocket = -1;
+    std::vector<uint8_t> relayInput;
+    std::vector<uint8_t> relayOutput; // What the socket did not take yet
+    std::vector<uint8_t> receiveBuffer;
 
     std::string serverAddress;
     uint16_t udpPort;
     uint16_t tcpPort;
     std::string username;
-    std::mutex mutex;
-    std::mutex callbackMutex;
-    std::mutex connectionMutex;
-    std::mutex gameStateMutex;
-    std::condition_variable connectionCV;
     bool connectionSuccess = false;
+    bool connectionDeclined = false;
+    bool spectateAnswered = false;
+    bool leaderboardAnswered = false;
+    LeaderboardResponse leaderboardResponse;
     bool isPlayer1;
     bool hasPendingResponse;
     bool gameStateUpdated;
     GameState latestGameState;
-    std::thread listenThread;
-    bool running;
+    std::chrono::steady_clock::time_point latestGameStateTime;
+
+    sockaddr_in peerAddr;
+    bool peerActive = false;
+    bool disconnectReported = false;
+    std::chrono::steady_clock::time_point lastPeerPacketTime;
 
-    // void sendPacket(const std::vector<uint8_t> &packet, std::string opponentUdpPort);
-    std::vector<uint8_t> receivePacket();
+    std::deque<InputEvent> inputHistory;
+    uint32_t inputSequence = 0;
+    int inputResendsLeft = 0;
 };
 
 } // namespace pong
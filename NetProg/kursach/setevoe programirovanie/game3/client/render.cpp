@@ -9,7 +9,7 @@
 namespace pong
 {
 
-Renderer::Renderer() : lastBallX(0), lastBallY(0), width(GameState::WIDTH), height(GameState::HEIGHT)
+Renderer::Renderer() : lastBallX(0), lastBallY(0), width(ClassicRules::WIDTH), height(ClassicRules::HEIGHT)
 {
 }
 
@@ -104,6 +104,7 @@ void Renderer::drawPaddle(const Paddle &paddle, bool erase)
 
     const int paddleX = static_cast<int>(paddle.position.x + 0.5f);
     const int paddleY = static_cast<int>(paddle.position.y + 0.5f);
+    const int paddleHeight = static_cast<int>(paddle.size.y);
 
     if (erase)
     {
@@ -118,14 +119,14 @@ void Renderer::drawPaddle(const Paddle &paddle, bool erase)
         std::cout << "\033[38;5;39m"; // Blue for right paddle
     }
 
-    for (int i = 0; i < Paddle::HEIGHT; i++)
+    for (int i = 0; i < paddleHeight; i++)
     {
         terminal::setCursor(paddleX + 1, paddleY + i + 1);
         if (erase)
         {
             std::cout << " ";
         }
-        else if (i == 0 || i == Paddle::HEIGHT - 1)
+        else if (i == 0 || i == paddleHeight - 1)
         {
             std::cout << "■"; // Top and bottom
         }
@@ -416,6 +417,15 @@ void Renderer::renderGameState(const GameState &state, float interpolation)
         return;
     std::lock_guard<std::recursive_mutex> lock(renderMutex);
 
+    // The arena follows the variant being played, everything below it moves along
+    if (state.width() != width || state.height() != height)
+    {
+        width = state.width();
+        height = state.height();
+        prevState = state;
+        terminal::clearScreen();
+    }
+
     drawArena();
 
     GameState interpolatedState = interpolateStates(prevState, state, interpolation);
@@ -57,10 +57,9 @@ struct Vec2
 
 struct Paddle
 {
-    Paddle() : position{0, 0}, size{1.0f, HEIGHT}, score(0), color(0)
+    Paddle() : position{0, 0}, size{WIDTH, 8.0f}, score(0), color(0)
     {
     }
-    static constexpr float HEIGHT = 8.0f;
     static constexpr float WIDTH = 1.0f;
 
     Vec2 position;
@@ -83,63 +82,196 @@ struct Ball
     float speed;
 };
 
-struct GameState
+// Rules of a game variant. The simulation is a template over them, so every variant gets its
+// own update loop with its constants folded in.
+struct ClassicRules
 {
-    GameState() : lastScoringPlayerIsPlayer1(false), frame(0)
+    static constexpr int WIDTH = 80;
+    static constexpr int HEIGHT = 20;
+    static constexpr int VICTORY_CONDITION = 2;
+    static constexpr float PADDLE_HEIGHT = 8.0f;
+    static constexpr float BALL_BASE_SPEED = 0.2f;
+    static constexpr float BALL_HIT_SPEEDUP = 0.1f; // Added to the ball speed on every paddle hit
+};
+
+// Needs a bigger terminal, longer paddles and a faster serve to make up for the distance
+struct BigArenaRules : ClassicRules
+{
+    static constexpr int WIDTH = 100;
+    static constexpr int HEIGHT = 26;
+    static constexpr float PADDLE_HEIGHT = 10.0f;
+    static constexpr float BALL_BASE_SPEED = 0.25f;
+};
+
+// First to seven, the ball gains speed slower so rallies last
+struct MarathonRules : ClassicRules
+{
+    static constexpr int VICTORY_CONDITION = 7;
+    static constexpr float BALL_HIT_SPEEDUP = 0.05f;
+};
+
+enum class GameVariant : uint8_t
+{
+    CLASSIC = 0,
+    BIG_ARENA,
+    MARATHON,
+    COUNT
+};
+
+// Calls visit(Rules{}) with the rules of a variant. Anything unknown plays classic.
+template <typename Visitor> auto withRules(GameVariant variant, Visitor &&visit)
+{
+    switch (variant)
     {
-        memset(this, 0, sizeof(GameState));
+    case GameVariant::BIG_ARENA:
+        return visit(BigArenaRules{});
+    case GameVariant::MARATHON:
+        return visit(MarathonRules{});
+    default:
+        return visit(ClassicRules{});
+    }
+}
 
-        player1.score = 0;
-        player2.score = 0;
+inline const char *variantName(GameVariant variant)
+{
+    switch (variant)
+    {
+    case GameVariant::BIG_ARENA:
+        return "big arena";
+    case GameVariant::MARATHON:
+        return "marathon";
+    default:
+        return "classic";
+    }
+}
 
-        player1.size = {1.0f, Paddle::HEIGHT};
-        player2.size = {1.0f, Paddle::HEIGHT};
-        reset(true);
+// Plain data, sent over the network and copied around as is. The rules come from `variant`.
+struct GameState
+{
+    GameState() : GameState(GameVariant::CLASSIC)
+    {
     }
 
-    static constexpr int WIDTH = 80;
-    static constexpr int HEIGHT = 20;
-    static constexpr int VICTORY_CONDITION = 2;
-    static constexpr float PADDLE_SPEED = 1.75f;
-    static constexpr float BALL_BASE_SPEED = 0.2f;
-    static constexpr float BALL_SPEED_INCREASE = 0.05f;
+    explicit GameState(GameVariant gameVariant)
+    {
+        memset(this, 0, sizeof(GameState));
+        variant = gameVariant;
+        reset(true);
+    }
 
     Paddle player1;
     Paddle player2;
     bool lastScoringPlayerIsPlayer1;
     Ball ball;
     uint32_t frame;
+    uint32_t rngState; // Per-game RNG so a match can be re-simulated from its seed
+    GameVariant variant;
+
+    void seed(uint32_t value)
+    {
+        rngState = value;
+    }
 
-    void reset(bool serve_left)
+    // Same LCG constants as the classic rand() reference implementation
+    uint32_t nextRandom()
     {
-        player1.position = {2.0f, HEIGHT / 2 - player1.size.y / 2};
-        player2.position = {WIDTH - 2 - player2.size.x, HEIGHT / 2 - player2.size.y / 2};
+        rngState = rngState * 1103515245u + 12345u;
+        return (rngState >> 16) & 0x7FFF;
+    }
+
+    int width() const
+    {
+        return withRules(variant, [](auto rules) { return decltype(rules)::WIDTH; });
+    }
+
+    int height() const
+    {
+        return withRules(variant, [](auto rules) { return decltype(rules)::HEIGHT; });
+    }
 
-        ball.position = {WIDTH / 2.0f, HEIGHT / 2.0f};
-        ball.speed = BALL_BASE_SPEED;
-        float angle = ((std::rand() % 100) / 100.0f - 0.5f) * (3.14159f / 2);
-        ball.velocity.x = ((serve_left) ? -1.0f : 1.0f) * BALL_BASE_SPEED * std::cos(angle);
-        ball.velocity.y = BALL_BASE_SPEED * std::sin(angle);
-        lastScoringPlayerIsPlayer1 = serve_left;
-        frame = 0;
+    int victoryCondition() const
+    {
+        return withRules(variant, [](auto rules) { return decltype(rules)::VICTORY_CONDITION; });
     }
-    bool update()
+
+    bool hasWinner() const
     {
+        return player1.score >= victoryCondition() || player2.score >= victoryCondition();
+    }
+
+    void movePaddle(int playerId, bool up, bool down);
+    void reset(bool serve_left);
+    // Runs one frame, returns true when someone scored
+    bool update();
+
+    bool deserialize(const std::vector<uint8_t> &const_buffer)
+    {
+        std::vector<uint8_t> buffer = const_buffer;
+        buffer.shrink_to_fit();
+        if (buffer.size() != sizeof(GameState))
+        {
+            std::cerr << "Deserialize failed: buffer size " << buffer.size() << " != expected " << sizeof(GameState)
+                      << std::endl;
+            return false;
+        }
+        memcpy(this, buffer.data(), sizeof(GameState));
+        return true;
+    }
+};
+
+template <typename Rules> struct Physics
+{
+    static void movePaddle(GameState &state, int playerId, bool up, bool down)
+    {
+        Paddle &paddle = (playerId == 1) ? state.player1 : state.player2;
+        if (up && paddle.position.y > 1)
+        {
+            paddle.position.y -= 1;
+        }
+        if (down && paddle.position.y < Rules::HEIGHT - Rules::PADDLE_HEIGHT - 1)
+        {
+            paddle.position.y += 1;
+        }
+    }
+
+    static void reset(GameState &state, bool serve_left)
+    {
+        state.player1.size = {Paddle::WIDTH, Rules::PADDLE_HEIGHT};
+        state.player2.size = {Paddle::WIDTH, Rules::PADDLE_HEIGHT};
+        state.player1.position = {2.0f, Rules::HEIGHT / 2 - Rules::PADDLE_HEIGHT / 2};
+        state.player2.position = {Rules::WIDTH - 2 - Paddle::WIDTH, Rules::HEIGHT / 2 - Rules::PADDLE_HEIGHT / 2};
+
+        Ball &ball = state.ball;
+        ball.position = {Rules::WIDTH / 2.0f, Rules::HEIGHT / 2.0f};
+        ball.speed = Rules::BALL_BASE_SPEED;
+        float angle = ((state.nextRandom() % 100) / 100.0f - 0.5f) * (3.14159f / 2);
+        ball.velocity.x = ((serve_left) ? -1.0f : 1.0f) * Rules::BALL_BASE_SPEED * std::cos(angle);
+        ball.velocity.y = Rules::BALL_BASE_SPEED * std::sin(angle);
+        state.lastScoringPlayerIsPlayer1 = serve_left;
+        state.frame = 0;
+    }
+
+    static bool update(GameState &state)
+    {
+        Ball &ball = state.ball;
+        Paddle &player1 = state.player1;
+        Paddle &player2 = state.player2;
+
         // Check for scoring
         if (ball.position.x <= 0)
         {
             player2.score++;
-            lastScoringPlayerIsPlayer1 = false;
-            frame++;
-            reset(true);
+            state.lastScoringPlayerIsPlayer1 = false;
+            state.frame++;
+            reset(state, true);
             return true;
         }
-        else if (ball.position.x >= WIDTH - 1)
+        else if (ball.position.x >= Rules::WIDTH - 1)
         {
             player1.score++;
-            lastScoringPlayerIsPlayer1 = true;
-            frame++;
-            reset(false);
+            state.lastScoringPlayerIsPlayer1 = true;
+            state.frame++;
+            reset(state, false);
             return true;
         }
 
@@ -147,7 +279,7 @@ struct GameState
         ball.position = ball.position + ball.velocity;
 
         // Check collision with walls
-        if (ball.position.y <= 1 || ball.position.y >= HEIGHT - 2)
+        if (ball.position.y <= 1 || ball.position.y >= Rules::HEIGHT - 2)
         {
             ball.velocity.y = -ball.velocity.y;
             if (ball.position.y <= 1)
@@ -156,68 +288,67 @@ struct GameState
             }
             else
             {
-                ball.position.y = HEIGHT - 2;
+                ball.position.y = Rules::HEIGHT - 2;
             }
         }
 
         // Check for collision with paddles
         if (ball.position.x <= player1.position.x + Paddle::WIDTH && ball.position.x >= player1.position.x &&
-            ball.position.y >= player1.position.y && ball.position.y <= player1.position.y + Paddle::HEIGHT)
+            ball.position.y >= player1.position.y && ball.position.y <= player1.position.y + Rules::PADDLE_HEIGHT)
         {
 
             // Calculate reflection angle based on where the ball hit the paddle
-            float relativeIntersectY = (player1.position.y + (Paddle::HEIGHT / 2)) - ball.position.y;
-            float normalizedRelativeIntersectionY = (relativeIntersectY / (Paddle::HEIGHT / 2));
+            float relativeIntersectY = (player1.position.y + (Rules::PADDLE_HEIGHT / 2)) - ball.position.y;
+            float normalizedRelativeIntersectionY = (relativeIntersectY / (Rules::PADDLE_HEIGHT / 2));
             float bounceAngle = normalizedRelativeIntersectionY * (3.14159f / 4); // Max 45 degrees
 
             ball.velocity.x = std::abs(ball.velocity.x); // Force direction away from paddle
             ball.velocity.y = -std::sin(bounceAngle) * ball.velocity.x;
 
             // Add a small speed increase on each hit
-            const float speedIncrease = 0.1f;
             float currentSpeed = std::sqrt(ball.velocity.x * ball.velocity.x + ball.velocity.y * ball.velocity.y);
-            float ratio = (currentSpeed + speedIncrease) / currentSpeed;
+            float ratio = (currentSpeed + Rules::BALL_HIT_SPEEDUP) / currentSpeed;
 
             ball.velocity.x *= ratio;
             ball.velocity.y *= ratio;
         }
 
         if (ball.position.x >= player2.position.x - Ball::RADIUS && ball.position.x <= player2.position.x &&
-            ball.position.y >= player2.position.y && ball.position.y <= player2.position.y + Paddle::HEIGHT)
+            ball.position.y >= player2.position.y && ball.position.y <= player2.position.y + Rules::PADDLE_HEIGHT)
         {
 
             // Calculate reflection angle based on where the ball hit the paddle
-            float relativeIntersectY = (player2.position.y + (Paddle::HEIGHT / 2)) - ball.position.y;
-            float normalizedRelativeIntersectionY = (relativeIntersectY / (Paddle::HEIGHT / 2));
+            float relativeIntersectY = (player2.position.y + (Rules::PADDLE_HEIGHT / 2)) - ball.position.y;
+            float normalizedRelativeIntersectionY = (relativeIntersectY / (Rules::PADDLE_HEIGHT / 2));
             float bounceAngle = normalizedRelativeIntersectionY * (3.14159f / 4); // Max 45 degrees
 
             ball.velocity.x = -std::abs(ball.velocity.x); // Force direction away from paddle
             ball.velocity.y = -std::sin(bounceAngle) * std::abs(ball.velocity.x);
 
             // Add a small speed increase on each hit
-            const float speedIncrease = 0.1f;
             float currentSpeed = std::sqrt(ball.velocity.x * ball.velocity.x + ball.velocity.y * ball.velocity.y);
-            float ratio = (currentSpeed + speedIncrease) / currentSpeed;
+            float ratio = (currentSpeed + Rules::BALL_HIT_SPEEDUP) / currentSpeed;
 
             ball.velocity.x *= ratio;
             ball.velocity.y *= ratio;
         }
 
-        frame++;
+        state.frame++;
         return false;
     }
-
-    bool deserialize(const std::vector<uint8_t> &const_buffer)
-    {
-        std::vector<uint8_t> buffer = const_buffer;
-        buffer.shrink_to_fit();
-        if (buffer.size() != sizeof(GameState))
-        {
-            std::cerr << "Deserialize failed: buffer size " << buffer.size() << " != expected " << sizeof(GameState)
-                      << std::endl;
-            return false;
-        }
-        memcpy(this, buffer.data(), sizeof(GameState));
-        return true;
-    }
 };
+
+inline void GameState::movePaddle(int playerId, bool up, bool down)
+{
+    withRules(variant, [&](auto rules) { Physics<decltype(rules)>::movePaddle(*this, playerId, up, down); });
+}
+
+inline void GameState::reset(bool serve_left)
+{
+    withRules(variant, [&](auto rules) { Physics<decltype(rules)>::reset(*this, serve_left); });
+}
+
+inline bool GameState::update()
+{
+    return withRules(variant, [this](auto rules) { return Physics<decltype(rules)>::update(*this); });
+}
@@ -1,6 +1,8 @@
 // common/network.cpp
 #include "network.h"
+#include <arpa/inet.h>
 #include <chrono>
+#include <cstddef>
 #include <cstring>
 
 namespace pong
@@ -56,6 +58,52 @@ std::vector<uint8_t> createInputPacket(const PlayerInput &input)
     return createPacket(MessageType::PLAYER_INPUT, input.frameNumber, &cleanedInput, sizeof(cleanedInput));
 }
 
+std::vector<uint8_t> createInputBatchPacket(const InputBatch &batch)
+{
+    InputBatch cleanedBatch;
+    memset(&cleanedBatch, 0, sizeof(cleanedBatch));
+    cleanedBatch.playerId = batch.playerId;
+    cleanedBatch.count = std::min<uint8_t>(batch.count, INPUT_BATCH_SIZE);
+    for (int i = 0; i < cleanedBatch.count; ++i)
+    {
+        cleanedBatch.events[i].sequence = batch.events[i].sequence;
+        cleanedBatch.events[i].frame = batch.events[i].frame;
+        cleanedBatch.events[i].flags = batch.events[i].flags;
+    }
+
+    size_t size = offsetof(InputBatch, events) + cleanedBatch.count * sizeof(InputEvent);
+    uint32_t frame = cleanedBatch.count ? cleanedBatch.events[cleanedBatch.count - 1].frame : 0;
+    return createPacket(MessageType::INPUT_BATCH, frame, &cleanedBatch, size);
+}
+
+std::vector<uint8_t> createPeerInputPacket(const PeerInput &input)
+{
+    PeerInput cleanedInput;
+    memset(&cleanedInput, 0, sizeof(cleanedInput));
+    cleanedInput.ackFrame = input.ackFrame;
+    cleanedInput.startFrame = input.startFrame;
+    cleanedInput.count = std::min<uint8_t>(input.count, PEER_INPUT_WINDOW);
+    memcpy(cleanedInput.flags, input.flags, cleanedInput.count);
+
+    size_t size = offsetof(PeerInput, flags) + cleanedInput.count;
+    return createPacket(MessageType::PEER_INPUT, cleanedInput.startFrame, &cleanedInput, size);
+}
+
+std::vector<uint8_t> createChatFrame(const void *header, size_t headerSize, const std::string &text)
+{
+    size_t textSize = std::min<size_t>(text.size(), MAX_CHAT_SIZE);
+    uint16_t length = htons(static_cast<uint16_t>(headerSize + textSize));
+
+    std::vector<uint8_t> frame(CHAT_FRAME_PREFIX_SIZE + headerSize + textSize);
+    memcpy(frame.data(), &length, CHAT_FRAME_PREFIX_SIZE);
+    if (header && headerSize > 0)
+    {
+        memcpy(frame.data() + CHAT_FRAME_PREFIX_SIZE, header, headerSize);
+    }
+    memcpy(frame.data() + CHAT_FRAME_PREFIX_SIZE + headerSize, text.data(), textSize);
+    return frame;
+}
+
 NetworkHeader parseHeader(const std::vector<uint8_t> &packet)
 {
     NetworkHeader header;
@@ -30,6 +30,33 @@ enum class MessageType : uint8_t
 
     SCORE_EVENT,
     VICTORY_EVENT,
+
+    // Keepalive messages
+    PING,
+    PONG,
+
+    // Spectator messages
+    SPECTATE_REQUEST,
+    SPECTATE_RESPONSE,
+
+    // Timestamped player input with redundancy
+    INPUT_BATCH,
+
+    // Peer-to-peer rollback matches, sent between the players directly
+    PEER_INPUT,
+
+    // Ratings table, no registration needed
+    LEADERBOARD_REQUEST,
+    LEADERBOARD_RESPONSE,
+
+    // Answer to a connect request without a valid cookie, the client repeats it with this one
+    CONNECT_CHALLENGE,
+
+    // Cluster mode, between the coordinator and its game servers
+    SERVER_HELLO,
+    MATCH_ASSIGN,
+    MATCH_ASSIGNED,
+    MATCH_RESULT,
 };
 
 // Input flags
@@ -58,6 +85,14 @@ struct ConnectRequest
     uint16_t udpPort;
     uint16_t tcpPort;
     uint32_t mmr;
+    bool peerMatch; // Only pair with another peer-match player and let the two simulate the game
+    uint8_t variant; // GameVariant, only players asking for the same one are paired
+    uint64_t cookie; // From CONNECT_CHALLENGE, 0 on the first attempt
+};
+
+struct ConnectChallenge
+{
+    uint64_t cookie; // Proves the client receives at its source address
 };
 
 struct ConnectResponse
@@ -69,6 +104,13 @@ struct ConnectResponse
     uint16_t hostUdpPort;
     uint16_t hostTcpPort;
     bool isPlayer1;
+    bool peerMatch; // No server game, play against hostAddress:hostUdpPort directly
+    uint32_t seed;  // Peer matches: both sides start the same GameState from it
+    uint8_t variant;
+    uint32_t chatRoom; // Non-zero: chat goes through the server's relay instead of a direct connection
+    uint32_t chatToken;
+    char gameServerAddress[16]; // Cluster mode: the match is played on this server, chat stays where it was
+    uint16_t gameServerPort;    // 0 if the match is played on the server that sent this
 };
 
 struct PlayerInput
@@ -78,6 +120,37 @@ struct PlayerInput
     uint32_t frameNumber;
 };
 
+// One key event, stamped with the server frame it was pressed on
+struct InputEvent
+{
+    uint32_t sequence; // Per player, increasing; the server drops what it has already seen
+    uint32_t frame;
+    uint8_t flags;
+};
+
+constexpr int INPUT_BATCH_SIZE = 8;
+
+// The newest key events (oldest first), so a lost packet is covered by the next one.
+// Only the first `count` events are sent.
+struct InputBatch
+{
+    uint8_t playerId;
+    uint8_t count;
+    InputEvent events[INPUT_BATCH_SIZE];
+};
+
+constexpr int PEER_INPUT_WINDOW = 32;
+
+// One input per frame for every frame the peer has not acknowledged yet, oldest first.
+// Only the first `count` flags are sent.
+struct PeerInput
+{
+    uint32_t ackFrame;   // The sender has the receiver's inputs for every frame before this
+    uint32_t startFrame; // Frame of flags[0]
+    uint8_t count;
+    uint8_t flags[PEER_INPUT_WINDOW];
+};
+
 struct ChatMessageData
 {
     char sender[32];
@@ -86,6 +159,24 @@ struct ChatMessageData
     char content[1024];
 };
 
+// Chat relay on TCP_SERVER_PORT. Every frame is a uint16 payload length in network byte order
+// followed by the payload. A client's first frame is a ChatHello, every later one is message text.
+// The server sends a ChatRelayHeader followed by the text, for history and new messages alike.
+struct ChatHello
+{
+    uint32_t room;
+    uint32_t token;
+    char username[32];
+};
+
+struct ChatRelayHeader
+{
+    uint32_t timestamp;
+    char sender[32];
+};
+
+constexpr size_t CHAT_FRAME_PREFIX_SIZE = sizeof(uint16_t);
+
 struct ScoreEvent
 {
     uint8_t scoringPlayer; // 1 or 2
@@ -101,18 +192,115 @@ struct VictoryEvent
     char winnerName[32];
 };
 
+struct SpectateRequest
+{
+    uint32_t gameId; // 0 picks any running game
+    uint16_t udpPort;
+};
+
+struct SpectateResponse
+{
+    bool success;
+    uint32_t gameId;
+    char player1Name[32];
+    char player2Name[32];
+};
+
+enum class LeaderboardQuery : uint8_t
+{
+    TOP,    // From position `offset`, 0 is the best
+    AROUND, // Centered on `username`
+};
+
+constexpr int LEADERBOARD_PAGE_SIZE = 16;
+
+struct LeaderboardRequest
+{
+    LeaderboardQuery query;
+    uint8_t count; // At most LEADERBOARD_PAGE_SIZE
+    uint16_t udpPort;
+    uint32_t offset;
+    char username[32];
+};
+
+struct LeaderboardEntry
+{
+    char username[32];
+    int32_t rating;
+    uint32_t rank; // Equal ratings share a rank
+};
+
+struct LeaderboardResponse
+{
+    uint32_t totalPlayers;
+    uint32_t playerRank; // AROUND: rank of the requested player, 0 if unknown
+    uint8_t count;
+    LeaderboardEntry entries[LEADERBOARD_PAGE_SIZE];
+};
+
+// Cluster mode. Game servers say hello to the coordinator every CLUSTER_HELLO_INTERVAL_MS, the coordinator
+// pairs players as usual and sends each match to the least loaded server, which acknowledges it and hosts
+// the game. Results go back to the coordinator, which owns the ratings.
+struct ServerHello
+{
+    uint16_t capacity; // Games this server takes, 0 while draining
+    uint16_t activeGames;
+};
+
+struct ClusterPlayer
+{
+    char username[32];
+    char address[16];
+    uint16_t udpPort;    // Where the client listens
+    uint16_t sourcePort; // Where it sends from, which is how the server tells clients apart
+};
+
+struct MatchAssign
+{
+    uint32_t matchId;
+    uint8_t variant;
+    ClusterPlayer player1; // The player told isPlayer1
+    ClusterPlayer player2;
+};
+
+struct MatchAssigned
+{
+    uint32_t matchId;
+};
+
+struct MatchResult
+{
+    uint32_t matchId; // From the MATCH_ASSIGN the game was created for
+    char winner[32];
+    char loser[32];
+};
+
+struct PingData
+{
+    uint32_t sequence;
+    uint64_t sendTimeUs; // Sender's steady clock, echoed back untouched in PONG
+};
+
 // Constants for network communications
 constexpr int MAX_PACKET_SIZE = 1024;
 constexpr int MAX_CHAT_SIZE = 512;
 constexpr int UDP_SERVER_PORT = 8080;
 constexpr int TCP_SERVER_PORT = 8081;
 constexpr int HEADER_SIZE = sizeof(NetworkHeader);
+constexpr int PING_INTERVAL_MS = 1000;
+constexpr int SERVER_TICK_RATE = 60;
+constexpr int CLIENT_TIMEOUT_SECONDS = 10;
+constexpr int CLUSTER_HELLO_INTERVAL_MS = 1000;
 
 // UDP packet serialization/deserialization functions
 std::vector<uint8_t> createPacket(MessageType type, uint32_t frame, const void *data, uint32_t dataSize);
 std::vector<uint8_t> createInputPacket(uint8_t inputFlags, uint32_t frame);
 std::vector<uint8_t> createChatPacket(const std::string &sender, const std::string &message);
 std::vector<uint8_t> createInputPacket(const PlayerInput &input);
+std::vector<uint8_t> createInputBatchPacket(const InputBatch &batch);
+std::vector<uint8_t> createPeerInputPacket(const PeerInput &input);
+// Length-prefixed chat relay frame: an optional fixed header followed by text cut to MAX_CHAT_SIZE
+std::vector<uint8_t> createChatFrame(const void *header, size_t headerSize, const std::string &text);
 
 // Helper to parse a network header from a buffer
 NetworkHeader parseHeader(const std::vector<uint8_t> &packet);
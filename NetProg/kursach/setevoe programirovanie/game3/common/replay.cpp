@@ -0,0 +1,221 @@
+// common/replay.cpp
+#include "replay.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace pong
+{
+
+GameState replayInitialState(const ReplayHeader &header)
+{
+    GameState state(static_cast<GameVariant>(header.variant));
+    state.player1.score = header.player1Score;
+    state.player2.score = header.player2Score;
+    state.seed(header.seed);
+    state.reset(state.nextRandom() % 2 == 0);
+    return state;
+}
+
+ReplayWriter::ReplayWriter() : lastFrame(0)
+{
+}
+
+ReplayWriter::~ReplayWriter()
+{
+    flush();
+}
+
+bool ReplayWriter::open(const std::string &path, const ReplayHeader &header)
+{
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    this->path = path;
+    buffer.clear();
+    buffer.reserve(FLUSH_THRESHOLD * 2);
+    lastFrame = 0;
+
+    const uint8_t *raw = reinterpret_cast<const uint8_t *>(&header);
+    buffer.insert(buffer.end(), raw, raw + sizeof(header));
+    return true;
+}
+
+void ReplayWriter::recordFrame(uint32_t frame, const std::vector<ReplayInput> &inputs)
+{
+    if (!file.is_open() || inputs.empty())
+    {
+        return;
+    }
+
+    // A frame never holds more than a handful of inputs, but keep the count byte clear of the end marker
+    size_t count = std::min<size_t>(inputs.size(), REPLAY_END_MARKER - 1);
+
+    writeVarint(frame - lastFrame);
+    buffer.push_back(static_cast<uint8_t>(count));
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint8_t value = inputs[i].flags & ~REPLAY_PLAYER2_BIT;
+        if (inputs[i].playerId == 2)
+        {
+            value |= REPLAY_PLAYER2_BIT;
+        }
+        buffer.push_back(value);
+    }
+    lastFrame = frame;
+
+    if (buffer.size() >= FLUSH_THRESHOLD)
+    {
+        flush();
+    }
+}
+
+void ReplayWriter::finish(uint32_t frame, int32_t player1Score, int32_t player2Score)
+{
+    if (!file.is_open())
+    {
+        return;
+    }
+
+    writeVarint(frame - lastFrame);
+    buffer.push_back(REPLAY_END_MARKER);
+    const uint8_t *p1 = reinterpret_cast<const uint8_t *>(&player1Score);
+    const uint8_t *p2 = reinterpret_cast<const uint8_t *>(&player2Score);
+    buffer.insert(buffer.end(), p1, p1 + sizeof(player1Score));
+    buffer.insert(buffer.end(), p2, p2 + sizeof(player2Score));
+
+    flush();
+    file.close();
+}
+
+void ReplayWriter::release()
+{
+    flush();
+    file.close();
+}
+
+bool ReplayWriter::resume(const std::string &path, uint32_t frame)
+{
+    file.open(path, std::ios::binary | std::ios::app);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    this->path = path;
+    buffer.clear();
+    buffer.reserve(FLUSH_THRESHOLD * 2);
+    lastFrame = frame;
+    return true;
+}
+
+void ReplayWriter::writeVarint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+void ReplayWriter::flush()
+{
+    if (file.is_open() && !buffer.empty())
+    {
+        file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+        file.flush();
+    }
+    buffer.clear();
+}
+
+bool ReplayReader::open(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (data.size() < sizeof(ReplayHeader))
+    {
+        return false;
+    }
+
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0 || header.version != REPLAY_VERSION)
+    {
+        return false;
+    }
+
+    offset = sizeof(header);
+    lastFrame = 0;
+    ended = false;
+    return true;
+}
+
+bool ReplayReader::readVarint(uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && offset < data.size(); shift += 7)
+    {
+        uint8_t byte = data[offset++];
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ReplayReader::nextFrame(uint32_t &frame, std::vector<ReplayInput> &inputs)
+{
+    inputs.clear();
+    if (ended)
+    {
+        return false;
+    }
+
+    uint32_t delta;
+    if (!readVarint(delta) || offset >= data.size())
+    {
+        return false;
+    }
+
+    frame = lastFrame + delta;
+    lastFrame = frame;
+
+    uint8_t count = data[offset++];
+    if (count == REPLAY_END_MARKER)
+    {
+        if (offset + sizeof(int32_t) * 2 <= data.size())
+        {
+            memcpy(&finalPlayer1Score, data.data() + offset, sizeof(int32_t));
+            memcpy(&finalPlayer2Score, data.data() + offset + sizeof(int32_t), sizeof(int32_t));
+            offset += sizeof(int32_t) * 2;
+            ended = true;
+            endFrame = frame;
+        }
+        return false;
+    }
+
+    if (offset + count > data.size())
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        uint8_t value = data[offset++];
+        inputs.push_back({static_cast<uint8_t>((value & REPLAY_PLAYER2_BIT) ? 2 : 1),
+                          static_cast<uint8_t>(value & ~REPLAY_PLAYER2_BIT)});
+    }
+    return true;
+}
+
+} // namespace pong
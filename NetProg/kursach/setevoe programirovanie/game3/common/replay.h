@@ -0,0 +1,131 @@
+// common/replay.h
+#pragma once
+
+#include "game_state.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace pong
+{
+
+// Replay file layout:
+//   ReplayHeader
+//   frame records: varint frame delta, uint8 input count (1..254), count input bytes
+//   end record:    varint frame delta, REPLAY_END_MARKER, int32 player1 score, int32 player2 score
+// Each input byte is the InputFlags value with the top bit set for player 2.
+// Frames without input are not written.
+
+constexpr char REPLAY_MAGIC[4] = {'P', 'R', 'P', 'L'};
+constexpr uint16_t REPLAY_VERSION = 1;
+constexpr uint8_t REPLAY_END_MARKER = 0xFF;
+constexpr uint8_t REPLAY_PLAYER2_BIT = 0x80;
+
+struct ReplayHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t variant; // GameVariant, zero in recordings made before variants existed
+    uint8_t reserved;
+    uint32_t seed;
+    uint32_t gameId;
+    int32_t player1Score; // Scores at the moment the match was started
+    int32_t player2Score;
+    char player1[32];
+    char player2[32];
+};
+
+struct ReplayInput
+{
+    uint8_t playerId;
+    uint8_t flags;
+};
+
+// Builds the state a recorded match starts from
+GameState replayInitialState(const ReplayHeader &header);
+
+// Buffered writer, flushes to disk in large chunks
+class ReplayWriter
+{
+  public:
+    ReplayWriter();
+    ~ReplayWriter();
+
+    bool open(const std::string &path, const ReplayHeader &header);
+    bool isOpen() const
+    {
+        return file.is_open();
+    }
+    void recordFrame(uint32_t frame, const std::vector<ReplayInput> &inputs);
+    void finish(uint32_t frame, int32_t player1Score, int32_t player2Score);
+
+    // Hot restart: the old process flushes and lets go without an end record, the new one appends after
+    // the last frame it was told about
+    void flush();
+    void release();
+    bool resume(const std::string &path, uint32_t frame);
+    const std::string &getPath() const
+    {
+        return path;
+    }
+    uint32_t getLastFrame() const
+    {
+        return lastFrame;
+    }
+
+  private:
+    void writeVarint(uint32_t value);
+
+    static constexpr size_t FLUSH_THRESHOLD = 4096;
+
+    std::ofstream file;
+    std::string path;
+    std::vector<uint8_t> buffer;
+    uint32_t lastFrame;
+};
+
+class ReplayReader
+{
+  public:
+    bool open(const std::string &path);
+    const ReplayHeader &getHeader() const
+    {
+        return header;
+    }
+
+    // Reads the next frame record. Returns false at the end record or end of data.
+    bool nextFrame(uint32_t &frame, std::vector<ReplayInput> &inputs);
+
+    // Valid once nextFrame returned false
+    bool hasEnd() const
+    {
+        return ended;
+    }
+    uint32_t getEndFrame() const
+    {
+        return endFrame;
+    }
+    int32_t getFinalPlayer1Score() const
+    {
+        return finalPlayer1Score;
+    }
+    int32_t getFinalPlayer2Score() const
+    {
+        return finalPlayer2Score;
+    }
+
+  private:
+    bool readVarint(uint32_t &value);
+
+    ReplayHeader header{};
+    std::vector<uint8_t> data;
+    size_t offset = 0;
+    uint32_t lastFrame = 0;
+    bool ended = false;
+    uint32_t endFrame = 0;
+    int32_t finalPlayer1Score = 0;
+    int32_t finalPlayer2Score = 0;
+};
+
+} // namespace pong
@@ -0,0 +1,122 @@
+// common/rollback.cpp
+#include "rollback.h"
+#include <algorithm>
+#include <cstring>
+
+namespace pong
+{
+
+void RollbackSession::start(uint32_t seed, bool localIsPlayer1, GameVariant variant)
+{
+    this->localIsPlayer1 = localIsPlayer1;
+
+    // Same start as a recorded server match
+    state = GameState(variant);
+    state.seed(seed);
+    state.reset(state.nextRandom() % 2 == 0);
+
+    // The first INPUT_DELAY_FRAMES frames are empty on both sides, nobody could have pressed anything yet
+    memset(localInputs, 0, sizeof(localInputs));
+    memset(remoteInputs, 0, sizeof(remoteInputs));
+    frame = 0;
+    localNext = INPUT_DELAY_FRAMES;
+    remoteNext = INPUT_DELAY_FRAMES;
+    peerAck = 0;
+    rollbackFrom = UINT32_MAX;
+    rollbacks = 0;
+}
+
+bool RollbackSession::advance(uint8_t localInput)
+{
+    resimulate();
+
+    if (frame >= remoteNext + MAX_PREDICTION_FRAMES)
+    {
+        return false;
+    }
+
+    localInputs[localNext % HISTORY_FRAMES] = localInput & ~InputFlags::QUIT;
+    ++localNext;
+
+    simulate(frame);
+    ++frame;
+    return true;
+}
+
+void RollbackSession::addRemoteInputs(uint32_t startFrame, const uint8_t *flags, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        uint32_t inputFrame = startFrame + i;
+        if (inputFrame < remoteNext)
+            continue;
+
+        // A gap is filled by a later packet, and nothing legitimate is half a ring ahead of us
+        if (inputFrame > remoteNext || inputFrame >= frame + HISTORY_FRAMES / 2)
+            break;
+
+        uint8_t input = flags[i] & ~InputFlags::QUIT;
+        remoteInputs[inputFrame % HISTORY_FRAMES] = input;
+        ++remoteNext;
+
+        // Already simulated as "no key"
+        if (inputFrame < frame && input != InputFlags::NONE)
+        {
+            rollbackFrom = std::min(rollbackFrom, inputFrame);
+        }
+    }
+}
+
+void RollbackSession::acknowledge(uint32_t ackFrame)
+{
+    peerAck = std::max(peerAck, std::min(ackFrame, localNext));
+}
+
+PeerInput RollbackSession::outgoing() const
+{
+    PeerInput packet{};
+    uint32_t first = std::max(peerAck, localNext > PEER_INPUT_WINDOW ? localNext - PEER_INPUT_WINDOW : 0);
+
+    packet.ackFrame = remoteNext;
+    packet.startFrame = first;
+    packet.count = static_cast<uint8_t>(localNext - first);
+    for (uint8_t i = 0; i < packet.count; ++i)
+    {
+        packet.flags[i] = localInputs[(first + i) % HISTORY_FRAMES];
+    }
+    return packet;
+}
+
+void RollbackSession::resimulate()
+{
+    // Stalling keeps the prediction window well inside the ring, so the frame is always there
+    if (rollbackFrom < frame)
+    {
+        state = history[rollbackFrom % HISTORY_FRAMES];
+        for (uint32_t replayed = rollbackFrom; replayed < frame; ++replayed)
+        {
+            simulate(replayed);
+        }
+        ++rollbacks;
+    }
+    rollbackFrom = UINT32_MAX;
+}
+
+void RollbackSession::simulate(uint32_t simulatedFrame)
+{
+    history[simulatedFrame % HISTORY_FRAMES] = state;
+
+    uint8_t local = localInputs[simulatedFrame % HISTORY_FRAMES];
+    uint8_t remote = simulatedFrame < remoteNext ? remoteInputs[simulatedFrame % HISTORY_FRAMES] : static_cast<uint8_t>(InputFlags::NONE);
+    uint8_t player1Input = localIsPlayer1 ? local : remote;
+    uint8_t player2Input = localIsPlayer1 ? remote : local;
+
+    // Same order as GameInstance::update and the replay tool: step the simulation, then apply the frame's inputs
+    state.update();
+    state.movePaddle(1, player1Input & (InputFlags::UP | InputFlags::ARROW_UP),
+                     player1Input & (InputFlags::DOWN | InputFlags::ARROW_DOWN));
+    state.movePaddle(2, player2Input & (InputFlags::UP | InputFlags::ARROW_UP),
+                     player2Input & (InputFlags::DOWN | InputFlags::ARROW_DOWN));
+}
+
+} // namespace pong
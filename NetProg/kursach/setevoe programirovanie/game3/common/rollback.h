@@ -0,0 +1,83 @@
+// common/rollback.h
+#pragma once
+
+#include "game_state.h"
+#include "network.h"
+#include <cstdint>
+
+namespace pong
+{
+
+// Peer-to-peer match with rollback. Both peers run the same GameState from the same seed and only
+// exchange inputs. A peer input that has not arrived yet is predicted; when the real one arrives and
+// differs, the state is restored from the ring and the frames since are simulated again.
+// Everything before getConfirmedFrame() has both inputs and is the same on both peers.
+//
+// The terminal has no key-up, a press is a one-frame event, so the prediction is "no key"
+// rather than repeating the last input.
+class RollbackSession
+{
+  public:
+    // Frames of state kept for restoring
+    static constexpr uint32_t HISTORY_FRAMES = 64;
+    // A local key is applied this many frames after it is pressed, so it usually reaches the peer in time
+    static constexpr uint32_t INPUT_DELAY_FRAMES = 2;
+    // Stall instead of predicting further than this past the peer's last known input (~200 ms)
+    static constexpr uint32_t MAX_PREDICTION_FRAMES = 12;
+
+    void start(uint32_t seed, bool localIsPlayer1, GameVariant variant);
+
+    // Re-simulates whatever was mispredicted, then runs one frame with this local input unless
+    // that would predict too far ahead of the peer. Returns false on such a stall.
+    bool advance(uint8_t localInput);
+
+    // Peer inputs from startFrame on, the ones already known are skipped
+    void addRemoteInputs(uint32_t startFrame, const uint8_t *flags, uint8_t count);
+    // The peer has every local input before this frame
+    void acknowledge(uint32_t ackFrame);
+
+    // Local inputs the peer has not acknowledged, together with our own acknowledgement
+    PeerInput outgoing() const;
+
+    // Latest state, possibly built on predictions
+    const GameState &getState() const
+    {
+        return state;
+    }
+    // State at the start of the confirmed frame, it can not change any more. Valid after advance().
+    const GameState &getConfirmedState() const
+    {
+        return remoteNext >= frame ? state : history[remoteNext % HISTORY_FRAMES];
+    }
+    uint32_t getFrame() const
+    {
+        return frame;
+    }
+    uint32_t getConfirmedFrame() const
+    {
+        return remoteNext;
+    }
+    uint32_t getRollbackCount() const
+    {
+        return rollbacks;
+    }
+
+  private:
+    void resimulate();
+    void simulate(uint32_t simulatedFrame);
+
+    GameState state;
+    GameState history[HISTORY_FRAMES]; // State at the start of a frame, by frame % HISTORY_FRAMES
+    uint8_t localInputs[HISTORY_FRAMES];
+    uint8_t remoteInputs[HISTORY_FRAMES];
+
+    bool localIsPlayer1 = true;
+    uint32_t frame = 0;      // Next frame to simulate
+    uint32_t localNext = 0;  // Next frame without a local input
+    uint32_t remoteNext = 0; // Next frame without a peer input
+    uint32_t peerAck = 0;
+    uint32_t rollbackFrom = UINT32_MAX; // Earliest frame that was simulated with a wrong prediction
+    uint32_t rollbacks = 0;
+};
+
+} // namespace pong
@@ -0,0 +1,135 @@
+// replay/main.cpp
+#include "../common/network.h"
+#include "../common/replay.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct FrameInputs
+{
+    uint32_t frame;
+    std::vector<pong::ReplayInput> inputs;
+};
+
+// Mirrors GameInstance::update: advance the frame counter, step the simulation, then apply that frame's inputs.
+// Instantiated per variant, so the loop runs on that variant's constants instead of looking them up every frame.
+template <typename Rules>
+static GameState simulate(const pong::ReplayHeader &header, const std::vector<FrameInputs> &frames, uint32_t endFrame)
+{
+    GameState state = pong::replayInitialState(header);
+    size_t next = 0;
+
+    for (uint32_t frame = 1; frame <= endFrame; ++frame)
+    {
+        state.frame = frame;
+        Physics<Rules>::update(state);
+
+        if (next < frames.size() && frames[next].frame == frame)
+        {
+            for (const auto &input : frames[next].inputs)
+            {
+                Physics<Rules>::movePaddle(state, input.playerId,
+                                           input.flags & (pong::InputFlags::UP | pong::InputFlags::ARROW_UP),
+                                           input.flags & (pong::InputFlags::DOWN | pong::InputFlags::ARROW_DOWN));
+            }
+            ++next;
+        }
+    }
+    return state;
+}
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <replay file> [-n iterations]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string path = argv[1];
+    int iterations = 1;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc)
+        {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    pong::ReplayReader reader;
+    if (!reader.open(path))
+    {
+        std::cerr << "Failed to open replay " << path << std::endl;
+        return 1;
+    }
+
+    const pong::ReplayHeader &header = reader.getHeader();
+
+    std::vector<FrameInputs> frames;
+    FrameInputs record;
+    while (reader.nextFrame(record.frame, record.inputs))
+    {
+        frames.push_back(record);
+    }
+
+    uint32_t endFrame = reader.hasEnd() ? reader.getEndFrame() : (frames.empty() ? 0 : frames.back().frame);
+    if (!reader.hasEnd())
+    {
+        std::cerr << "Replay has no end record (server stopped mid-match?), simulating up to frame " << endFrame
+                  << std::endl;
+    }
+
+    std::cout << "Game " << header.gameId << " (" << variantName(static_cast<GameVariant>(header.variant))
+              << "): " << header.player1 << " vs " << header.player2 << ", seed " << header.seed << ", " << endFrame << " frames, " << frames.size() << " input frames" << std::endl;
+
+    GameState state;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        state = withRules(static_cast<GameVariant>(header.variant), [&](auto rules) {
+            return simulate<decltype(rules)>(header, frames, endFrame);
+        });
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double totalNs = std::chrono::duration<double, std::nano>(elapsed).count();
+    double totalFrames = static_cast<double>(endFrame) * iterations;
+    double nsPerFrame = totalFrames > 0 ? totalNs / totalFrames : 0.0;
+    double matchSeconds = endFrame / 60.0;
+    double simSeconds = totalNs / 1e9 / iterations;
+
+    std::cout << "Final score: " << state.player1.score << " - " << state.player2.score << std::endl;
+    std::cout << "Simulated " << iterations << "x in " << totalNs / 1e6 << " ms (" << nsPerFrame << " ns/frame";
+    if (simSeconds > 0)
+    {
+        std::cout << ", " << matchSeconds / simSeconds << "x real time";
+    }
+    std::cout << ")" << std::endl;
+
+    if (reader.hasEnd())
+    {
+        if (state.player1.score != reader.getFinalPlayer1Score() ||
+            state.player2.score != reader.getFinalPlayer2Score())
+        {
+            std::cerr << "DESYNC: recorded final score " << reader.getFinalPlayer1Score() << " - "
+                      << reader.getFinalPlayer2Score() << std::endl;
+            return 2;
+        }
+        std::cout << "Final score matches the recording" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+// server/admission.cpp
+#include "admission.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace pong
+{
+
+// Per source IP, across all types. Several players and spectators may share one NAT address.
+static constexpr float SOURCE_PER_SECOND = 600.0f;
+static constexpr float SOURCE_BURST = 300.0f;
+
+struct TypeLimit
+{
+    MessageType type;
+    size_t minPayload;
+    float perSecond;
+    float burst;
+};
+
+// Everything a client or another cluster process sends the server; anything else is dropped unread
+static const TypeLimit TYPE_LIMITS[] = {
+    {MessageType::CONNECT_REQUEST, sizeof(ConnectRequest), 1.0f, 4.0f},
+    {MessageType::PLAYER_INPUT, sizeof(PlayerInput), 240.0f, 120.0f},
+    {MessageType::INPUT_BATCH, offsetof(InputBatch, events), 240.0f, 120.0f},
+    {MessageType::PONG, sizeof(PingData), 20.0f, 20.0f},
+    {MessageType::SPECTATE_REQUEST, sizeof(SpectateRequest), 2.0f, 5.0f},
+    {MessageType::LEADERBOARD_REQUEST, sizeof(LeaderboardRequest), 5.0f, 10.0f},
+    {MessageType::SERVER_HELLO, sizeof(ServerHello), 5.0f, 10.0f},
+    {MessageType::MATCH_ASSIGN, sizeof(MatchAssign), 100.0f, 100.0f},
+    {MessageType::MATCH_ASSIGNED, sizeof(MatchAssigned), 100.0f, 100.0f},
+    {MessageType::MATCH_RESULT, sizeof(MatchResult), 100.0f, 100.0f},
+};
+
+static_assert(sizeof(TYPE_LIMITS) / sizeof(TYPE_LIMITS[0]) == 10, "AdmissionControl::TYPE_SLOTS is out of date");
+
+static uint64_t nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// SipHash-2-4 over whole 64-bit words: a keyed hash, so a cookie can not be forged without the key
+// even by someone who has seen many of them
+static uint64_t sipHash(const uint64_t key[2], const uint64_t *words, size_t count)
+{
+    uint64_t v0 = 0x736f6d6570736575ull ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dull ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ull ^ key[0];
+    uint64_t v3 = 0x7465646279746573ull ^ key[1];
+
+    auto round = [&]() {
+        v0 += v1;
+        v1 = rotl(v1, 13) ^ v0;
+        v0 = rotl(v0, 32);
+        v2 += v3;
+        v3 = rotl(v3, 16) ^ v2;
+        v0 += v3;
+        v3 = rotl(v3, 21) ^ v0;
+        v2 += v1;
+        v1 = rotl(v1, 17) ^ v2;
+        v2 = rotl(v2, 32);
+    };
+
+    for (size_t i = 0; i <= count; ++i)
+    {
+        // The last block carries only the message length
+        uint64_t block = i < count ? words[i] : static_cast<uint64_t>(count * 8) << 56;
+        v3 ^= block;
+        round();
+        round();
+        v0 ^= block;
+    }
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+    {
+        round();
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+AdmissionControl::AdmissionControl()
+{
+    std::random_device random;
+    secret[0] = (static_cast<uint64_t>(random()) << 32) | random();
+    secret[1] = (static_cast<uint64_t>(random()) << 32) | random();
+}
+
+bool AdmissionControl::Bucket::take(float perSecond, float burst, uint64_t nowMs)
+{
+    if (updatedMs == 0)
+    {
+        tokens = burst;
+    }
+    else
+    {
+        tokens = std::min(burst, tokens + (nowMs - updatedMs) * perSecond / 1000.0f);
+    }
+    updatedMs = nowMs;
+
+    if (tokens < 1.0f)
+        return false;
+    tokens -= 1.0f;
+    return true;
+}
+
+Admission AdmissionControl::admit(const uint8_t *packet, size_t size, const sockaddr_in &sender)
+{
+    if (size < sizeof(NetworkHeader))
+    {
+        ++dropped;
+        return Admission::DROP;
+    }
+
+    NetworkHeader header;
+    memcpy(&header, packet, sizeof(header));
+
+    int slot = -1;
+    for (int i = 0; i < TYPE_SLOTS; ++i)
+    {
+        if (TYPE_LIMITS[i].type == header.type)
+        {
+            slot = i;
+            break;
+        }
+    }
+
+    const TypeLimit *limit = slot >= 0 ? &TYPE_LIMITS[slot] : nullptr;
+    if (!limit || header.dataSize != size - sizeof(NetworkHeader) || header.dataSize < limit->minPayload)
+    {
+        ++dropped;
+        return Admission::DROP;
+    }
+
+    uint64_t now = nowMs();
+    Source &source = sourceFor(sender.sin_addr.s_addr);
+
+    // The type's own bucket first, so a flood of one type does not eat the IP's budget for the others
+    if (!source.types[slot].take(limit->perSecond, limit->burst, now) ||
+        !source.total.take(SOURCE_PER_SECOND, SOURCE_BURST, now))
+    {
+        ++dropped;
+        return Admission::DROP;
+    }
+    return Admission::ACCEPT;
+}
+
+AdmissionControl::Source &AdmissionControl::sourceFor(uint32_t address)
+{
+    auto it = sources.find(address);
+    if (it != sources.end())
+    {
+        recentSources.splice(recentSources.begin(), recentSources, it->second.recent);
+        return it->second;
+    }
+
+    if (sources.size() >= ADMISSION_MAX_SOURCES)
+    {
+        sources.erase(recentSources.back());
+        recentSources.pop_back();
+    }
+
+    Source &source = sources[address];
+    recentSources.push_front(address);
+    source.recent = recentSources.begin();
+    return source;
+}
+
+uint64_t AdmissionControl::cookieFor(const sockaddr_in &sender, uint64_t slot) const
+{
+    uint64_t words[2] = {(static_cast<uint64_t>(sender.sin_addr.s_addr) << 16) | sender.sin_port, slot};
+    return sipHash(secret, words, 2);
+}
+
+uint64_t AdmissionControl::connectCookie(const sockaddr_in &sender) const
+{
+    return cookieFor(sender, nowMs() / (CONNECT_COOKIE_SLOT_SECONDS * 1000ull));
+}
+
+bool AdmissionControl::checkConnectCookie(const sockaddr_in &sender, uint64_t cookie) const
+{
+    // Also the previous slot, in case the challenge was issued just before it turned over
+    uint64_t slot = nowMs() / (CONNECT_COOKIE_SLOT_SECONDS * 1000ull);
+    return cookie == cookieFor(sender, slot) || cookie == cookieFor(sender, slot - 1);
+}
+
+void AdmissionControl::report()
+{
+    uint64_t now = nowMs();
+    if (now - lastReportMs < ADMISSION_REPORT_INTERVAL_SECONDS * 1000ull)
+        return;
+
+    if (dropped > 0)
+    {
+        std::cerr << "Admission: dropped " << dropped << " packets in the last "
+                  << (lastReportMs ? (now - lastReportMs) / 1000 : ADMISSION_REPORT_INTERVAL_SECONDS) << " s ("
+                  << sources.size() << " sources tracked)" << std::endl;
+        dropped = 0;
+    }
+    lastReportMs = now;
+}
+
+} // namespace pong
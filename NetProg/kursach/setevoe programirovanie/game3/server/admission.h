@@ -0,0 +1,80 @@
+// server/admission.h
+#pragma once
+#include "../common/network.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <netinet/in.h>
+#include <unordered_map>
+
+namespace pong
+{
+
+constexpr size_t ADMISSION_MAX_SOURCES = 4096;      // Tracked IPs, past this the stalest is evicted
+constexpr int CONNECT_COOKIE_SLOT_SECONDS = 10;     // A cookie is good for this slot and the next one
+constexpr int ADMISSION_REPORT_INTERVAL_SECONDS = 5; // Dropped packets are logged as one summary line
+
+enum class Admission
+{
+    ACCEPT,
+    DROP, // Malformed, not a client-to-server type, or over a rate limit. Nothing is logged for it.
+};
+
+// First thing the receive thread does with a datagram, before copying or logging it. Checks the header
+// against the payload, accepts only the types sent to a server, and charges a token bucket for the source
+// IP and one for the IP and type. Players' inputs get far more room than connects, so a flood of junk or
+// connect requests is dropped here and legitimate traffic from other addresses goes through untouched.
+//
+// Connects additionally need a cookie: a keyed hash of the source address and the time slot that the
+// server hands out in CONNECT_CHALLENGE and keeps no state for. A spoofed source never sees its cookie,
+// so it can not get as far as registering a player.
+//
+// A full table evicts the IP heard from least recently, so a flood from many spoofed addresses only churns
+// through its own entries and a new client still gets a bucket of its own. An evicted IP starts over with
+// full buckets, which never costs a legitimate sender anything.
+//
+// Only the receive thread uses this, nothing is locked.
+class AdmissionControl
+{
+  public:
+    AdmissionControl();
+
+    Admission admit(const uint8_t *packet, size_t size, const sockaddr_in &sender);
+
+    uint64_t connectCookie(const sockaddr_in &sender) const;
+    bool checkConnectCookie(const sockaddr_in &sender, uint64_t cookie) const;
+
+    // Logs how much was dropped since the last report, at most every ADMISSION_REPORT_INTERVAL_SECONDS
+    void report();
+
+  private:
+    struct Bucket
+    {
+        float tokens = 0.0f;
+        uint64_t updatedMs = 0;
+
+        // Refills for the time since the last packet, then takes one token if there is one
+        bool take(float perSecond, float burst, uint64_t nowMs);
+    };
+
+    static constexpr int TYPE_SLOTS = 10; // Message types a server accepts
+
+    struct Source
+    {
+        Bucket total;
+        Bucket types[TYPE_SLOTS];
+        std::list<uint32_t>::iterator recent; // Position in recentSources
+    };
+
+    Source &sourceFor(uint32_t address);
+    uint64_t cookieFor(const sockaddr_in &sender, uint64_t slot) const;
+
+    uint64_t secret[2];
+    std::unordered_map<uint32_t, Source> sources;
+    std::list<uint32_t> recentSources; // Most recently seen first
+
+    uint64_t dropped = 0;
+    uint64_t lastReportMs = 0;
+};
+
+} // namespace pong
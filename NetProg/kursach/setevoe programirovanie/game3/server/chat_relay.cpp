@@ -0,0 +1,516 @@
+// server/chat_relay.cpp
+#include "chat_relay.h"
+#include "../common/network.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pong
+{
+
+ChatRelay::ChatRelay() : listenFd(-1), epollFd(-1), wakeFd(-1), running(false)
+{
+}
+
+ChatRelay::~ChatRelay()
+{
+    stop();
+}
+
+bool ChatRelay::start(uint16_t port)
+{
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+    {
+        perror("chat relay socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0)
+    {
+        perror("chat relay bind/listen");
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0)
+    {
+        perror("chat relay epoll/eventfd");
+        stop();
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    running = true;
+    thread = std::thread(&ChatRelay::run, this);
+    std::cout << "Chat relay started on port " << port << std::endl;
+    return true;
+}
+
+void ChatRelay::stop()
+{
+    if (running)
+    {
+        running = false;
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0)
+        {
+            perror("chat relay wake");
+        }
+    }
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+
+    for (auto &[fd, connection] : connections)
+    {
+        close(fd);
+    }
+    connections.clear();
+    rooms.clear();
+
+    for (int *fd : {&listenFd, &wakeFd, &epollFd})
+    {
+        if (*fd >= 0)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void ChatRelay::openRoom(uint32_t room, const std::string &player1, uint32_t token1, const std::string &player2,
+                         uint32_t token2)
+{
+    Room newRoom;
+    newRoom.members[0].username = player1;
+    newRoom.members[0].token = token1;
+    newRoom.members[1].username = player2;
+    newRoom.members[1].token = token2;
+    newRoom.history.reserve(CHAT_ROOM_HISTORY);
+    newRoom.openedAt = Clock::now();
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pendingRooms.emplace_back(room, std::move(newRoom));
+}
+
+void ChatRelay::run()
+{
+    const int maxEvents = 64;
+    epoll_event events[maxEvents];
+    auto nextExpiry = Clock::now() + std::chrono::seconds(1);
+
+    while (running)
+    {
+        int count = epoll_wait(epollFd, events, maxEvents, 1000);
+        if (count < 0 && errno != EINTR)
+        {
+            perror("chat relay epoll_wait");
+            break;
+        }
+
+        takePendingRooms();
+
+        for (int i = 0; i < count; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenFd)
+            {
+                acceptConnections();
+                continue;
+            }
+            if (fd == wakeFd)
+            {
+                uint64_t value;
+                while (read(wakeFd, &value, sizeof(value)) > 0)
+                {
+                }
+                continue;
+            }
+
+            // Handlers may close connections, look each one up fresh
+            if (!connections.count(fd))
+                continue;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                closeConnection(fd);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            {
+                onReadable(fd);
+            }
+            if ((events[i].events & EPOLLOUT) && connections.count(fd))
+            {
+                onWritable(fd);
+            }
+        }
+
+        if (Clock::now() >= nextExpiry)
+        {
+            expire();
+            nextExpiry = Clock::now() + std::chrono::seconds(1);
+        }
+    }
+}
+
+void ChatRelay::takePendingRooms()
+{
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    for (auto &[id, room] : pendingRooms)
+    {
+        rooms[id] = std::move(room);
+    }
+    pendingRooms.clear();
+}
+
+void ChatRelay::acceptConnections()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("chat relay accept");
+            }
+            return;
+        }
+
+        Connection &connection = connections[fd];
+        connection.fd = fd;
+        connection.connectedAt = Clock::now();
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        connection.events = event.events;
+    }
+}
+
+void ChatRelay::onReadable(int fd)
+{
+    uint8_t buffer[4096];
+    while (true)
+    {
+        auto it = connections.find(fd);
+        if (it == connections.end() || !it->second.reading)
+            return;
+        Connection &connection = it->second;
+
+        ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (bytes <= 0)
+        {
+            closeConnection(fd);
+            return;
+        }
+
+        connection.input.insert(connection.input.end(), buffer, buffer + bytes);
+
+        // Hand out every complete frame, keep the partial tail for the next read
+        size_t offset = 0;
+        while (connection.input.size() - offset >= CHAT_FRAME_PREFIX_SIZE)
+        {
+            uint16_t length;
+            memcpy(&length, connection.input.data() + offset, CHAT_FRAME_PREFIX_SIZE);
+            length = ntohs(length);
+            if (connection.input.size() - offset - CHAT_FRAME_PREFIX_SIZE < length)
+                break;
+
+            if (!handleFrame(connection, connection.input.data() + offset + CHAT_FRAME_PREFIX_SIZE, length))
+            {
+                closeConnection(fd);
+                return;
+            }
+            offset += CHAT_FRAME_PREFIX_SIZE + length;
+        }
+        connection.input.erase(connection.input.begin(), connection.input.begin() + offset);
+    }
+}
+
+void ChatRelay::onWritable(int fd)
+{
+    Connection &connection = connections[fd];
+    while (connection.pending() > 0)
+    {
+        ssize_t sent = ::send(fd, connection.output.data() + connection.outputOffset, connection.pending(),
+                              MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (sent <= 0)
+        {
+            closeConnection(fd);
+            return;
+        }
+        connection.outputOffset += sent;
+    }
+
+    if (connection.pending() == 0)
+    {
+        connection.output.clear();
+        connection.outputOffset = 0;
+    }
+    updateEvents(connection);
+
+    auto room = rooms.find(connection.room);
+    if (room != rooms.end())
+    {
+        applyBackpressure(room->second);
+    }
+}
+
+bool ChatRelay::handleFrame(Connection &connection, const uint8_t *payload, size_t size)
+{
+    if (connection.room == 0)
+    {
+        return join(connection, payload, size);
+    }
+
+    auto room = rooms.find(connection.room);
+    if (room == rooms.end() || size == 0 || size > MAX_CHAT_SIZE)
+    {
+        return false;
+    }
+    relay(room->second, connection, payload, size);
+    return true;
+}
+
+bool ChatRelay::join(Connection &connection, const uint8_t *payload, size_t size)
+{
+    if (size != sizeof(ChatHello))
+        return false;
+
+    ChatHello hello;
+    memcpy(&hello, payload, sizeof(hello));
+    hello.username[sizeof(hello.username) - 1] = '\0';
+
+    // The room may have been opened after the last wakeup
+    takePendingRooms();
+    auto it = rooms.find(hello.room);
+    if (it == rooms.end())
+        return false;
+
+    Room &room = it->second;
+    for (Member &member : room.members)
+    {
+        if (member.username != hello.username || member.token != hello.token)
+            continue;
+
+        // A reconnect replaces the old connection. Closing it only detaches it from the room, rooms go
+        // in expire(), so room and member stay valid.
+        if (member.fd >= 0 && member.fd != connection.fd)
+        {
+            closeConnection(member.fd);
+        }
+        member.fd = connection.fd;
+        room.joined = true;
+        connection.room = hello.room;
+        connection.username = member.username;
+
+        // Catch up on what was said before, oldest first
+        size_t count = room.history.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            send(connection, room.history[(room.historyNext + i) % count]);
+        }
+        return true;
+    }
+    return false;
+}
+
+void ChatRelay::relay(Room &room, const Connection &from, const uint8_t *text, size_t size)
+{
+    ChatRelayHeader header{};
+    header.timestamp = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    strncpy(header.sender, from.username.c_str(), sizeof(header.sender) - 1);
+
+    std::vector<uint8_t> frame =
+        createChatFrame(&header, sizeof(header), std::string(reinterpret_cast<const char *>(text), size));
+
+    if (room.history.size() < CHAT_ROOM_HISTORY)
+    {
+        room.history.push_back(frame);
+    }
+    else
+    {
+        room.history[room.historyNext] = frame;
+        room.historyNext = (room.historyNext + 1) % CHAT_ROOM_HISTORY;
+    }
+
+    // The sender shows its own message already
+    for (Member &member : room.members)
+    {
+        if (member.fd >= 0 && member.fd != from.fd)
+        {
+            send(connections[member.fd], frame);
+        }
+    }
+    applyBackpressure(room);
+}
+
+void ChatRelay::send(Connection &connection, const std::vector<uint8_t> &frame)
+{
+    size_t offset = 0;
+
+    // Nothing queued, so try the socket right away and only buffer what it does not take
+    if (connection.pending() == 0)
+    {
+        ssize_t sent = ::send(connection.fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            offset = sent;
+        }
+    }
+
+    if (offset < frame.size())
+    {
+        connection.output.insert(connection.output.end(), frame.begin() + offset, frame.end());
+        updateEvents(connection);
+    }
+}
+
+void ChatRelay::applyBackpressure(Room &room)
+{
+    for (Member &member : room.members)
+    {
+        if (member.fd < 0)
+            continue;
+
+        size_t backlog = 0;
+        for (const Member &other : room.members)
+        {
+            if (other.fd >= 0 && other.fd != member.fd)
+            {
+                backlog = std::max(backlog, connections[other.fd].pending());
+            }
+        }
+
+        Connection &connection = connections[member.fd];
+        bool reading = connection.reading ? backlog <= CHAT_HIGH_WATER_BYTES : backlog <= CHAT_LOW_WATER_BYTES;
+        if (reading != connection.reading)
+        {
+            connection.reading = reading;
+            updateEvents(connection);
+        }
+    }
+}
+
+void ChatRelay::updateEvents(Connection &connection)
+{
+    uint32_t events = EPOLLRDHUP;
+    if (connection.reading)
+        events |= EPOLLIN;
+    if (connection.pending() > 0)
+        events |= EPOLLOUT;
+
+    if (events != connection.events)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+}
+
+void ChatRelay::closeConnection(int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+        return;
+
+    uint32_t roomId = it->second.room;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+
+    auto room = rooms.find(roomId);
+    if (room == rooms.end())
+        return;
+
+    bool anyoneLeft = false;
+    for (Member &member : room->second.members)
+    {
+        if (member.fd == fd)
+            member.fd = -1;
+        anyoneLeft = anyoneLeft || member.fd >= 0;
+    }
+
+    if (anyoneLeft)
+    {
+        // Whoever it was may have been holding the other one back
+        applyBackpressure(room->second);
+    }
+    else
+    {
+        // Kept for a reconnect or for the opponent still to join
+        room->second.emptySince = Clock::now();
+    }
+}
+
+void ChatRelay::expire()
+{
+    auto now = Clock::now();
+
+    std::vector<int> silent;
+    for (const auto &[fd, connection] : connections)
+    {
+        if (connection.room == 0 && now - connection.connectedAt > std::chrono::seconds(CHAT_HELLO_TIMEOUT_SECONDS))
+        {
+            silent.push_back(fd);
+        }
+    }
+    for (int fd : silent)
+    {
+        closeConnection(fd);
+    }
+
+    // Rooms are only ever dropped here, nothing else holds on to them across a call
+    for (auto it = rooms.begin(); it != rooms.end();)
+    {
+        const Room &room = it->second;
+        bool empty = room.members[0].fd < 0 && room.members[1].fd < 0;
+        bool abandoned =
+            !room.joined && now - room.openedAt > std::chrono::seconds(CHAT_ROOM_JOIN_TIMEOUT_SECONDS);
+        bool finished =
+            room.joined && empty && now - room.emptySince > std::chrono::seconds(CHAT_ROOM_EMPTY_TIMEOUT_SECONDS);
+        it = abandoned || finished ? rooms.erase(it) : std::next(it);
+    }
+}
+
+} // namespace pong
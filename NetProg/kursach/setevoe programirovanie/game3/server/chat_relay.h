@@ -0,0 +1,109 @@
+// server/chat_relay.h
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pong
+{
+
+constexpr size_t CHAT_ROOM_HISTORY = 32;              // Messages kept per match, replayed to whoever joins
+constexpr size_t CHAT_HIGH_WATER_BYTES = 64 * 1024;   // Stop reading a room's senders once a member has this much unsent
+constexpr size_t CHAT_LOW_WATER_BYTES = 16 * 1024;    // and read again once it is back under this
+constexpr int CHAT_HELLO_TIMEOUT_SECONDS = 10;        // For a connection to say which room it is in
+constexpr int CHAT_ROOM_JOIN_TIMEOUT_SECONDS = 60;    // For anyone to show up in a new room
+constexpr int CHAT_ROOM_EMPTY_TIMEOUT_SECONDS = 60;   // For a player who dropped out of an empty room to come back
+
+// Match chat through the server, enabled with --chat-relay. One thread runs one epoll set over the
+// listening socket and every connection, so a match costs a room and two sockets, not threads.
+// The matchmaker opens a room per match and hands each player a token for it.
+// Framing is described next to ChatHello in common/network.h.
+class ChatRelay
+{
+  public:
+    ChatRelay();
+    ~ChatRelay();
+
+    bool start(uint16_t port);
+    void stop();
+    bool isRunning() const
+    {
+        return running;
+    }
+
+    // Thread safe. Only these two usernames with their tokens may join the room.
+    void openRoom(uint32_t room, const std::string &player1, uint32_t token1, const std::string &player2,
+                  uint32_t token2);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Member
+    {
+        std::string username;
+        uint32_t token;
+        int fd = -1;
+    };
+
+    struct Room
+    {
+        Member members[2];
+        std::vector<std::vector<uint8_t>> history; // Ring of server frames, oldest at historyNext once full
+        size_t historyNext = 0;
+        bool joined = false; // Someone has been in
+        Clock::time_point openedAt;
+        Clock::time_point emptySince; // Last member left, expire() drops the room some time after
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        uint32_t room = 0; // 0 until the hello
+        std::string username;
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> output;
+        size_t outputOffset = 0;
+        bool reading = true; // Off while another member of the room is backed up
+        uint32_t events = 0; // What epoll currently watches
+        Clock::time_point connectedAt;
+
+        size_t pending() const
+        {
+            return output.size() - outputOffset;
+        }
+    };
+
+    void run();
+    void takePendingRooms();
+    void acceptConnections();
+    void onReadable(int fd);
+    void onWritable(int fd);
+    bool handleFrame(Connection &connection, const uint8_t *payload, size_t size);
+    bool join(Connection &connection, const uint8_t *payload, size_t size);
+    void relay(Room &room, const Connection &from, const uint8_t *text, size_t size);
+    void send(Connection &connection, const std::vector<uint8_t> &frame);
+    void applyBackpressure(Room &room);
+    void updateEvents(Connection &connection);
+    void closeConnection(int fd);
+    void expire();
+
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+    std::thread thread;
+    volatile bool running;
+
+    std::mutex pendingMutex;
+    std::vector<std::pair<uint32_t, Room>> pendingRooms;
+
+    // Only the relay thread touches these
+    std::unordered_map<uint32_t, Room> rooms;
+    std::unordered_map<int, Connection> connections;
+};
+
+} // namespace pong
@@ -0,0 +1,375 @@
+// server/cluster.cpp
+#include "cluster.h"
+#include "game_manager.h"
+#include "network.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+
+namespace pong
+{
+
+// A match the coordinator still resends after this was lost long ago, the member can forget it
+static constexpr int ADOPTED_MATCH_MEMORY_MS = 60000;
+
+static std::string addressOf(const sockaddr_in &address)
+{
+    char text[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+    return text;
+}
+
+static void copyName(char *destination, size_t size, const std::string &name)
+{
+    strncpy(destination, name.c_str(), size - 1);
+    destination[size - 1] = '\0';
+}
+
+static ClusterPlayer toClusterPlayer(const PlayerInfo &player)
+{
+    ClusterPlayer out;
+    memset(&out, 0, sizeof(out));
+    copyName(out.username, sizeof(out.username), player.username);
+    copyName(out.address, sizeof(out.address), player.address);
+    out.udpPort = player.udpPort;
+
+    // Client IDs are "address:source port"
+    size_t colon = player.clientId.rfind(':');
+    out.sourcePort = colon == std::string::npos ? player.udpPort : std::stoi(player.clientId.substr(colon + 1));
+    return out;
+}
+
+static PlayerInfo fromClusterPlayer(ClusterPlayer player, GameVariant variant)
+{
+    player.username[sizeof(player.username) - 1] = '\0';
+    player.address[sizeof(player.address) - 1] = '\0';
+
+    PlayerInfo out;
+    out.username = player.username;
+    out.address = player.address;
+    out.clientId = out.address + ":" + std::to_string(player.sourcePort);
+    out.udpPort = player.udpPort;
+    out.tcpPort = 0;
+    out.mmr = 0;
+    out.variant = variant;
+    return out;
+}
+
+// "address:port", the port defaulting to UDP_SERVER_PORT
+static bool parseEndpoint(const std::string &endpoint, std::string &host, uint16_t &port, sockaddr_in &address)
+{
+    size_t colon = endpoint.rfind(':');
+    host = endpoint.substr(0, colon);
+    port = UDP_SERVER_PORT;
+    if (colon != std::string::npos)
+    {
+        port = static_cast<uint16_t>(std::atoi(endpoint.c_str() + colon + 1));
+    }
+
+    address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (port == 0 || inet_pton(AF_INET, host.c_str(), &address.sin_addr) <= 0)
+    {
+        std::cerr << "Invalid address: " << endpoint << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string ClusterCoordinator::keyOf(const sockaddr_in &address)
+{
+    return addressOf(address) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+bool ClusterCoordinator::allowMember(const std::string &endpoint)
+{
+    std::string host;
+    uint16_t port;
+    sockaddr_in address;
+    if (!parseEndpoint(endpoint, host, port, address))
+        return false;
+    allowed.insert(keyOf(address));
+    return true;
+}
+
+bool ClusterCoordinator::assign(const PlayerInfo &first, const PlayerInfo &second)
+{
+    // Same order as the match notifications
+    const PlayerInfo &player1 = first.username < second.username ? first : second;
+    const PlayerInfo &player2 = first.username < second.username ? second : first;
+
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Server *best = nullptr;
+    std::string bestKey;
+    float bestLoad = 1.0f;
+    for (auto &[key, server] : servers)
+    {
+        if (server.capacity == 0 || now - server.lastHello > std::chrono::milliseconds(CLUSTER_SERVER_TIMEOUT_MS))
+            continue;
+
+        float load = static_cast<float>(server.activeGames + server.assignedSinceHello) / server.capacity;
+        if (load < bestLoad)
+        {
+            best = &server;
+            bestKey = key;
+            bestLoad = load;
+        }
+    }
+    if (!best)
+        return false;
+
+    MatchAssign message;
+    memset(&message, 0, sizeof(message));
+    message.matchId = nextMatchId++;
+    message.variant = static_cast<uint8_t>(player1.variant);
+    message.player1 = toClusterPlayer(player1);
+    message.player2 = toClusterPlayer(player2);
+
+    Assignment &assignment = matches[message.matchId];
+    assignment.server = bestKey;
+    assignment.player1 = player1;
+    assignment.player2 = player2;
+    assignment.attempts = 1;
+    assignment.lastSent = now;
+    assignment.packet = createPacket(MessageType::MATCH_ASSIGN, 0, &message, sizeof(message));
+    ++best->assignedSinceHello;
+
+    std::cout << "Match " << message.matchId << " (" << player1.username << " vs " << player2.username
+              << ") sent to game server " << bestKey << std::endl;
+    networkManager->sendToClient(addressOf(best->address), ntohs(best->address.sin_port), assignment.packet);
+    return true;
+}
+
+void ClusterCoordinator::onServerHello(const ServerHello &hello, const sockaddr_in &sender)
+{
+    // Anyone else could claim capacity, have players sent to it and rate their matches
+    std::string key = keyOf(sender);
+    if (!allowed.count(key))
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = servers.find(key);
+    if (it == servers.end())
+    {
+        std::cout << "Game server " << key << " joined, room for " << hello.capacity << " games" << std::endl;
+        it = servers.emplace(key, Server()).first;
+    }
+
+    Server &server = it->second;
+    server.address = sender;
+    server.capacity = hello.capacity;
+    server.activeGames = hello.activeGames;
+    server.assignedSinceHello = 0;
+    server.lastHello = Clock::now();
+}
+
+void ClusterCoordinator::onMatchAssigned(const MatchAssigned &assigned, const sockaddr_in &sender)
+{
+    if (!allowed.count(keyOf(sender)))
+        return;
+
+    PlayerInfo player1, player2;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = matches.find(assigned.matchId);
+        if (it == matches.end() || it->second.acknowledged || it->second.server != keyOf(sender))
+            return;
+
+        it->second.acknowledged = true;
+        it->second.packet.clear();
+        player1 = it->second.player1;
+        player2 = it->second.player2;
+    }
+
+    std::cout << "Match " << assigned.matchId << " accepted by " << keyOf(sender) << std::endl;
+    matchmaker->handOverMatch(player1, player2, addressOf(sender), ntohs(sender.sin_port));
+}
+
+void ClusterCoordinator::onMatchResult(const MatchResult &result, const sockaddr_in &sender)
+{
+    std::string winner(result.winner, strnlen(result.winner, sizeof(result.winner)));
+    std::string loser(result.loser, strnlen(result.loser, sizeof(result.loser)));
+    std::string server = keyOf(sender);
+    if (!allowed.count(server))
+        return;
+
+    // Only the server a match went to can rate it, and only once; later copies find nothing
+    uint32_t matchId = result.matchId;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = matches.find(matchId);
+        if (it == matches.end())
+            return;
+
+        const Assignment &assignment = it->second;
+        bool players = (assignment.player1.username == winner && assignment.player2.username == loser) ||
+                       (assignment.player1.username == loser && assignment.player2.username == winner);
+        if (!assignment.acknowledged || assignment.server != server || !players)
+            return;
+        matches.erase(it);
+    }
+
+    std::cout << "Match " << matchId << " on " << server << ": " << winner << " beat " << loser << std::endl;
+    matchmaker->updateMMR(winner, loser);
+}
+
+void ClusterCoordinator::process()
+{
+    struct Resend
+    {
+        sockaddr_in address;
+        std::vector<uint8_t> packet;
+    };
+    std::vector<Resend> resends;
+    std::vector<std::pair<PlayerInfo, PlayerInfo>> unassigned;
+
+    auto now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto it = servers.begin(); it != servers.end();)
+        {
+            if (now - it->second.lastHello <= std::chrono::milliseconds(CLUSTER_SERVER_TIMEOUT_MS))
+            {
+                ++it;
+                continue;
+            }
+            std::cout << "Game server " << it->first << " went quiet, the results of its matches are lost"
+                      << std::endl;
+            for (auto match = matches.begin(); match != matches.end();)
+            {
+                bool lost = match->second.acknowledged && match->second.server == it->first;
+                match = lost ? matches.erase(match) : std::next(match);
+            }
+            it = servers.erase(it);
+        }
+
+        for (auto it = matches.begin(); it != matches.end();)
+        {
+            Assignment &assignment = it->second;
+            if (assignment.acknowledged || now - assignment.lastSent < std::chrono::milliseconds(MATCH_ASSIGN_RETRY_MS))
+            {
+                ++it;
+                continue;
+            }
+
+            auto server = servers.find(assignment.server);
+            if (assignment.attempts >= MATCH_ASSIGN_ATTEMPTS || server == servers.end())
+            {
+                std::cout << "Match " << it->first << " not accepted by " << assignment.server << ", hosting it here"
+                          << std::endl;
+                unassigned.emplace_back(assignment.player1, assignment.player2);
+                it = matches.erase(it);
+                continue;
+            }
+
+            ++assignment.attempts;
+            assignment.lastSent = now;
+            resends.push_back({server->second.address, assignment.packet});
+            ++it;
+        }
+    }
+
+    for (const Resend &resend : resends)
+    {
+        networkManager->sendToClient(addressOf(resend.address), ntohs(resend.address.sin_port), resend.packet);
+    }
+    for (const auto &[player1, player2] : unassigned)
+    {
+        matchmaker->hostMatch(player1, player2);
+    }
+}
+
+bool ClusterMember::setCoordinator(const std::string &endpoint)
+{
+    return parseEndpoint(endpoint, coordinatorAddress, coordinatorPort, coordinator);
+}
+
+void ClusterMember::process()
+{
+    auto now = Clock::now();
+    if (now - lastHello < std::chrono::milliseconds(CLUSTER_HELLO_INTERVAL_MS))
+        return;
+    lastHello = now;
+
+    // A draining server takes nothing new
+    ServerHello hello;
+    hello.capacity = networkManager->isDraining() ? 0 : CLUSTER_SERVER_CAPACITY;
+    hello.activeGames = gameManager->getActiveGameCount();
+    send(MessageType::SERVER_HELLO, &hello, sizeof(hello));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = adopted.begin(); it != adopted.end();)
+    {
+        bool old = now - it->second > std::chrono::milliseconds(ADOPTED_MATCH_MEMORY_MS);
+        it = old ? adopted.erase(it) : std::next(it);
+    }
+}
+
+void ClusterMember::onMatchAssign(const MatchAssign &assign, const sockaddr_in &sender)
+{
+    if (sender.sin_addr.s_addr != coordinator.sin_addr.s_addr || sender.sin_port != coordinator.sin_port)
+    {
+        std::cerr << "Match assignment from " << addressOf(sender) << " ignored, not the coordinator" << std::endl;
+        return;
+    }
+
+    MatchAssigned assigned{assign.matchId};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (adopted.count(assign.matchId))
+        {
+            // Our acknowledgement was lost
+            send(MessageType::MATCH_ASSIGNED, &assigned, sizeof(assigned));
+            return;
+        }
+        if (networkManager->isDraining() || gameManager->getActiveGameCount() >= CLUSTER_SERVER_CAPACITY)
+        {
+            // No answer, the coordinator hosts it after a few tries
+            return;
+        }
+        adopted[assign.matchId] = Clock::now();
+    }
+
+    GameVariant variant = assign.variant < static_cast<uint8_t>(GameVariant::COUNT)
+                              ? static_cast<GameVariant>(assign.variant)
+                              : GameVariant::CLASSIC;
+    if (!matchmaker->adoptMatch(fromClusterPlayer(assign.player1, variant), fromClusterPlayer(assign.player2, variant),
+                                assign.matchId))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        adopted.erase(assign.matchId);
+        return;
+    }
+    send(MessageType::MATCH_ASSIGNED, &assigned, sizeof(assigned));
+}
+
+void ClusterMember::reportResult(uint32_t matchId, const std::string &winner, const std::string &loser)
+{
+    if (matchId == 0 || winner.empty() || loser.empty())
+        return;
+
+    MatchResult result;
+    memset(&result, 0, sizeof(result));
+    result.matchId = matchId;
+    copyName(result.winner, sizeof(result.winner), winner);
+    copyName(result.loser, sizeof(result.loser), loser);
+
+    std::cout << "Reporting match " << matchId << ": " << winner << " beat " << loser << " to the coordinator"
+              << std::endl;
+    for (int i = 0; i < MATCH_RESULT_COPIES; ++i)
+    {
+        send(MessageType::MATCH_RESULT, &result, sizeof(result));
+    }
+}
+
+void ClusterMember::send(MessageType type, const void *data, uint32_t size)
+{
+    networkManager->sendToClient(coordinatorAddress, coordinatorPort, createPacket(type, 0, data, size));
+}
+
+} // namespace pong
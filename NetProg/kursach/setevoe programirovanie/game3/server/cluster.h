@@ -0,0 +1,145 @@
+// server/cluster.h
+#pragma once
+#include "../common/network.h"
+#include "matchmaker.h"
+#include <chrono>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace pong
+{
+
+class NetworkManager;
+class GameManager;
+
+constexpr int CLUSTER_SERVER_TIMEOUT_MS = 3000; // A game server this quiet gets no more matches
+constexpr int MATCH_ASSIGN_RETRY_MS = 200;
+constexpr int MATCH_ASSIGN_ATTEMPTS = 5;        // After that the coordinator hosts the match itself
+constexpr int CLUSTER_SERVER_CAPACITY = 64;     // Games a game server advertises
+constexpr int MATCH_RESULT_COPIES = 3;          // Results are not acknowledged, a few copies cover a lost one
+
+// Cluster mode: processes on one host or LAN trust each other by address. The coordinator only listens to
+// the game servers it was started with (--member), a game server only to its coordinator. Nothing is signed,
+// so the cluster belongs on a network where source addresses can not be forged.
+//
+// The coordinator is an ordinary pong_server that clients connect to. It keeps the queue and the ratings;
+// every rated match goes to the least loaded game server that said hello recently, and once that server
+// has acknowledged it the players are told to play there and forgotten here. Peer matches, and matches no
+// server took, are played the usual way.
+class ClusterCoordinator
+{
+  public:
+    void setNetworkManager(NetworkManager *manager)
+    {
+        this->networkManager = manager;
+    }
+    void setMatchmaker(Matchmaker *matchmaker)
+    {
+        this->matchmaker = matchmaker;
+    }
+
+    // "address:port" of a game server allowed to join, false if it does not parse
+    bool allowMember(const std::string &endpoint);
+    bool hasMembers() const
+    {
+        return !allowed.empty();
+    }
+
+    // Sends the match to a game server, false if none has room
+    bool assign(const PlayerInfo &player1, const PlayerInfo &player2);
+
+    // Receive thread
+    void onServerHello(const ServerHello &hello, const sockaddr_in &sender);
+    void onMatchAssigned(const MatchAssigned &assigned, const sockaddr_in &sender);
+    void onMatchResult(const MatchResult &result, const sockaddr_in &sender);
+
+    // Main loop: resends unacknowledged matches, hosts those nobody took and forgets silent servers
+    void process();
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Server
+    {
+        sockaddr_in address;
+        uint16_t capacity = 0;
+        uint16_t activeGames = 0;
+        uint16_t assignedSinceHello = 0; // Not in activeGames yet
+        Clock::time_point lastHello;
+    };
+
+    struct Assignment
+    {
+        std::string server;
+        PlayerInfo player1; // The player told isPlayer1
+        PlayerInfo player2;
+        bool acknowledged = false;
+        int attempts = 0;
+        Clock::time_point lastSent;
+        std::vector<uint8_t> packet;
+    };
+
+    static std::string keyOf(const sockaddr_in &address);
+
+    std::unordered_set<std::string> allowed; // address:port of the members, set before the receive thread runs
+    std::mutex mutex;
+    std::unordered_map<std::string, Server> servers; // By address:port
+    std::unordered_map<uint32_t, Assignment> matches;
+    uint32_t nextMatchId = 1;
+
+    NetworkManager *networkManager = nullptr;
+    Matchmaker *matchmaker = nullptr;
+};
+
+// A game server in a cluster: says hello to the coordinator, hosts the matches it is sent and reports
+// how they end. Players do not connect to it directly.
+class ClusterMember
+{
+  public:
+    // "address:port" of the coordinator
+    bool setCoordinator(const std::string &endpoint);
+
+    void setNetworkManager(NetworkManager *manager)
+    {
+        this->networkManager = manager;
+    }
+    void setMatchmaker(Matchmaker *matchmaker)
+    {
+        this->matchmaker = matchmaker;
+    }
+    void setGameManager(GameManager *manager)
+    {
+        this->gameManager = manager;
+    }
+
+    // Main loop: the periodic hello
+    void process();
+
+    // Receive thread
+    void onMatchAssign(const MatchAssign &assign, const sockaddr_in &sender);
+
+    void reportResult(uint32_t matchId, const std::string &winner, const std::string &loser);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    void send(MessageType type, const void *data, uint32_t size);
+
+    sockaddr_in coordinator{};
+    std::string coordinatorAddress;
+    uint16_t coordinatorPort = 0;
+    Clock::time_point lastHello;
+
+    std::mutex mutex;
+    std::unordered_map<uint32_t, Clock::time_point> adopted; // Match ID to when, so a resent assign is not hosted twice
+
+    NetworkManager *networkManager = nullptr;
+    Matchmaker *matchmaker = nullptr;
+    GameManager *gameManager = nullptr;
+};
+
+} // namespace pong
@@ -1,28 +1,95 @@
 // server/game_instance.cpp
 #include "game_instance.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 
 namespace pong
 {
 
-GameInstance::GameInstance(uint32_t id, const std::string &player1, const std::string &player2)
-    : id_(id), active_(true), player1Id_(player1), player2Id_(player2), networkManager_(nullptr), matchmaker_(nullptr),
-      frameCounter_(0)
+GameInstance::GameInstance(uint32_t id, const std::string &player1, const std::string &player2,
+                           const std::string &player1Name, const std::string &player2Name, GameVariant variant,
+                           uint32_t matchId)
+    : id_(id), gameState_(variant), lastInputSequence_{0, 0}, active_(true), player1Id_(player1), player2Id_(player2),
+      player1Name_(player1Name), player2Name_(player2Name), matchId_(matchId), networkManager_(nullptr),
+      matchmaker_(nullptr), frameCounter_(0), started_(false), startAt_(Clock::time_point::max()),
+      nextTick_(Clock::now()), nextIdleSnapshot_(Clock::now()), nextLinkRefresh_(Clock::now()), forceSnapshot_(true),
+      sendIntervalTicks_{1, 1}, lastSentFrame_{0, 0}
 {
     /*
     GameState gameState_;
     std::vector<PlayerInput> pendingInputs_;
     std::mutex inputMutex_; ?
     */
-    gameState_.reset(rand() % 2 == 0);
+    gameState_.seed(rand());
+    gameState_.reset(gameState_.nextRandom() % 2 == 0);
+}
+
+GameInstance::~GameInstance()
+{
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    finishReplay();
 }
 
 void GameInstance::startGame()
 {
-    gameState_.reset(rand() % 2 == 0);
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    uint32_t seed = rand();
+    gameState_.seed(seed);
+    gameState_.reset(gameState_.nextRandom() % 2 == 0);
     active_ = true;
     frameCounter_ = 0;
-    std::cout << "Game " << id_ << " started!" << std::endl;
+    pendingInputs_.clear();
+    started_ = true;
+    nextTick_ = Clock::now();
+    forceSnapshot_ = true;
+    lastSentFrame_[0] = lastSentFrame_[1] = 0;
+    startReplay(seed);
+    std::cout << "Game " << id_ << " started! (" << variantName(gameState_.variant) << ")" << std::endl;
+}
+
+void GameInstance::scheduleStart(Clock::time_point at)
+{
+    startAt_ = at;
+}
+
+void GameInstance::startReplay(uint32_t seed)
+{
+    if (replayDirectory_.empty())
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(replayDirectory_, ec);
+
+    auto now = std::chrono::system_clock::now();
+    std::string path = replayDirectory_ + "/game_" + std::to_string(id_) + "_" +
+                       std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count()) +
+                       ".pongreplay";
+
+    ReplayHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.variant = static_cast<uint8_t>(gameState_.variant);
+    header.seed = seed;
+    header.gameId = id_;
+    header.player1Score = gameState_.player1.score;
+    header.player2Score = gameState_.player2.score;
+    strncpy(header.player1, player1Id_.c_str(), sizeof(header.player1) - 1);
+    strncpy(header.player2, player2Id_.c_str(), sizeof(header.player2) - 1);
+
+    if (!replay_.open(path, header))
+    {
+        std::cerr << "Failed to open replay file " << path << std::endl;
+    }
+}
+
+// Callers hold inputMutex_
+void GameInstance::finishReplay()
+{
+    replay_.finish(frameCounter_, gameState_.player1.score, gameState_.player2.score);
 }
 
 const GameState &GameInstance::getGameState() const
@@ -37,7 +104,9 @@ bool GameInstance::isActive() const
 
 void GameInstance::stopGame()
 {
+    std::lock_guard<std::mutex> lock(inputMutex_);
     active_ = false;
+    finishReplay();
 }
 
 uint32_t GameInstance::getId() const
@@ -55,6 +124,73 @@ std::vector<std::string> GameInstance::getAllPlayers() const
     return std::vector<std::string>{player1Id_, player2Id_};
 }
 
+void GameInstance::forfeit(const std::string &clientId)
+{
+    if (!active_ || !matchmaker_ || !hasPlayer(clientId))
+        return;
+
+    const std::string &winner = clientId == player1Id_ ? player2Name_ : player1Name_;
+    const std::string &loser = clientId == player1Id_ ? player1Name_ : player2Name_;
+    matchmaker_->updateMMR(winner, loser, matchId_);
+    std::cout << "MMR updated due to disconnect: " << winner << " beat " << loser << std::endl;
+}
+
+GameInstance::Clock::time_point GameInstance::nextDeadline() const
+{
+    if (!active_)
+        return Clock::time_point::max();
+    return started_ ? nextTick_ : std::min(nextIdleSnapshot_, startAt_);
+}
+
+void GameInstance::process(Clock::time_point now)
+{
+    TRACE_ZONE("GameInstance::process");
+    if (!active_)
+        return;
+
+    if (networkManager_ == nullptr)
+    {
+        std::cerr << "Network manager is null @ game_instance\n";
+        active_ = false;
+        return;
+    }
+
+    if (!started_ && now >= startAt_)
+    {
+        startGame();
+    }
+
+    if (!started_)
+    {
+        // Pre-serve: the board does not move, an occasional snapshot is enough to draw it
+        if (now >= nextIdleSnapshot_)
+        {
+            broadcastState(networkManager_);
+            nextIdleSnapshot_ = now + std::chrono::milliseconds(IDLE_SNAPSHOT_INTERVAL_MS);
+        }
+        return;
+    }
+
+    uint32_t ticks = 0;
+    while (active_ && now >= nextTick_ && ticks < MAX_CATCHUP_TICKS)
+    {
+        update();
+        nextTick_ += TICK_INTERVAL;
+        ticks++;
+    }
+
+    // Too far behind to catch up, drop the backlog instead of fast-forwarding the ball
+    if (now >= nextTick_)
+    {
+        nextTick_ = now + TICK_INTERVAL;
+    }
+
+    if (ticks > 0)
+    {
+        sendSnapshots(now);
+    }
+}
+
 void GameInstance::update()
 {
     if (!active_)
@@ -63,22 +199,104 @@ void GameInstance::update()
     frameCounter_++;
     gameState_.frame = frameCounter_;
 
-    if (gameState_.update())
+    bool scored;
     {
+        TRACE_ZONE("GameState::update");
+        scored = gameState_.update();
+    }
+    if (scored)
+    {
+        forceSnapshot_ = true;
         handleGoalScored();
     }
 
     processPlayerInputs();
+}
+
+// Link quality comes from the keepalive exchange. Loss and jitter mean a congested path,
+// so those players get every 2nd-4th snapshot instead of adding to the queue that hurts them.
+static uint32_t sendIntervalForLink(const LinkStats &link)
+{
+    if (link.rttMs < 0)
+        return 1;
+    if (link.lossRate > 0.15f || link.rttMs > 250.0f)
+        return MAX_SEND_INTERVAL_TICKS;
+    if (link.lossRate > 0.05f || link.jitterMs > 30.0f || link.rttMs > 120.0f)
+        return 2;
+    return 1;
+}
 
-    if (networkManager_ != nullptr)
+void GameInstance::refreshSendRates()
+{
+    const std::string *players[2] = {&player1Id_, &player2Id_};
+    for (int i = 0; i < 2; ++i)
     {
-        broadcastState(networkManager_);
+        LinkStats link;
+        if (networkManager_->getClientLinkStats(*players[i], link))
+        {
+            sendIntervalTicks_[i] = sendIntervalForLink(link);
+        }
     }
-    else
+}
+
+void GameInstance::sendSnapshots(Clock::time_point now)
+{
+    TRACE_ZONE("GameInstance::sendSnapshots");
+    if (now >= nextLinkRefresh_)
     {
-        std::cerr << "Network manager is null @ game_instance\n";
-        active_ = false;
+        refreshSendRates();
+        spectators_.refreshTiers(networkManager_);
+        nextLinkRefresh_ = now + std::chrono::milliseconds(LINK_REFRESH_INTERVAL_MS);
     }
+
+    // Encoded once per tick and shared by players and spectators
+    std::vector<uint8_t> packet =
+        createPacket(MessageType::GAME_STATE_UPDATE, gameState_.frame, &gameState_, sizeof(GameState));
+
+    // Taken in one step, a spectator joining from the receive thread meanwhile forces the next one
+    bool force = forceSnapshot_.exchange(false);
+    const std::string *players[2] = {&player1Id_, &player2Id_};
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!force && frameCounter_ - lastSentFrame_[i] < sendIntervalTicks_[i])
+            continue;
+
+        networkManager_->sendToClient(*players[i], packet);
+        lastSentFrame_[i] = frameCounter_;
+    }
+
+    spectators_.fanOut(networkManager_, packet, frameCounter_, force);
+}
+
+void GameInstance::broadcast(const std::vector<uint8_t> &packet)
+{
+    if (!networkManager_)
+        return;
+
+    networkManager_->sendToClient(player1Id_, packet);
+    networkManager_->sendToClient(player2Id_, packet);
+    spectators_.fanOut(networkManager_, packet, frameCounter_, true);
+}
+
+void GameInstance::addSpectator(const std::string &clientId, const sockaddr_in &address)
+{
+    spectators_.add(clientId, address);
+    forceSnapshot_ = true;
+}
+
+bool GameInstance::removeSpectator(const std::string &clientId)
+{
+    return spectators_.remove(clientId);
+}
+
+std::vector<std::string> GameInstance::takeSpectators()
+{
+    return spectators_.takeAll();
+}
+
+size_t GameInstance::getSpectatorCount()
+{
+    return spectators_.size();
 }
 
 void GameInstance::handleGoalScored()
@@ -91,14 +309,9 @@ void GameInstance::handleGoalScored()
     std::vector<uint8_t> packet =
         createPacket(MessageType::SCORE_EVENT, gameState_.frame, &scoreEvent, sizeof(scoreEvent));
 
-    if (networkManager_)
-    {
-        networkManager_->sendToClient(player1Id_, packet);
-        networkManager_->sendToClient(player2Id_, packet);
-    }
+    broadcast(packet);
 
-    if (scoreEvent.player1Score >= GameState::VICTORY_CONDITION ||
-        scoreEvent.player2Score >= GameState::VICTORY_CONDITION)
+    if (gameState_.hasWinner())
     {
         handleVictory();
     }
@@ -107,27 +320,16 @@ void GameInstance::handleGoalScored()
 void GameInstance::handleVictory()
 {
     VictoryEvent victoryEvent;
-    victoryEvent.winningPlayer = (gameState_.player1.score >= GameState::VICTORY_CONDITION) ? 1 : 2;
+    victoryEvent.winningPlayer = (gameState_.player1.score >= gameState_.victoryCondition()) ? 1 : 2;
     victoryEvent.player1Score = gameState_.player1.score;
     victoryEvent.player2Score = gameState_.player2.score;
 
-    // Get winner's name from matchmaker
     if (matchmaker_)
     {
-        std::string winnerName;
-        std::string loserName;
-        if (victoryEvent.winningPlayer == 1)
-        {
-            winnerName = matchmaker_->getPlayer1Name();
-            loserName = matchmaker_->getPlayer2Name();
-        }
-        else
-        {
-            winnerName = matchmaker_->getPlayer2Name();
-            loserName = matchmaker_->getPlayer1Name();
-        }
+        const std::string &winnerName = victoryEvent.winningPlayer == 1 ? player1Name_ : player2Name_;
+        const std::string &loserName = victoryEvent.winningPlayer == 1 ? player2Name_ : player1Name_;
 
-        matchmaker_->updateMMR(winnerName, loserName);
+        matchmaker_->updateMMR(winnerName, loserName, matchId_);
         strncpy(victoryEvent.winnerName, winnerName.c_str(), sizeof(victoryEvent.winnerName) - 1);
         victoryEvent.winnerName[sizeof(victoryEvent.winnerName) - 1] = '\0';
     }
@@ -136,72 +338,149 @@ void GameInstance::handleVictory()
         createPacket(MessageType::VICTORY_EVENT, gameState_.frame, &victoryEvent, sizeof(victoryEvent));
 
     // Broadcast victory event
+    broadcast(packet);
+
+    // The audience has seen the result, nothing more will be sent to it
     if (networkManager_)
     {
-        networkManager_->sendToClient(player1Id_, packet);
-        networkManager_->sendToClient(player2Id_, packet);
+        networkManager_->releaseSpectators(spectators_.takeAll(), {});
     }
 
     // Deactivate game
-    matchmaker_->deregisterPlayer(matchmaker_->getPlayer1Name());
-    matchmaker_->deregisterPlayer(matchmaker_->getPlayer2Name());
+    matchmaker_->deregisterPlayer(player1Name_);
+    matchmaker_->deregisterPlayer(player2Name_);
 
     active_ = false;
+
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    finishReplay();
 }
 
 void GameInstance::processPlayerInputs()
 {
+    TRACE_ZONE("GameInstance::processPlayerInputs");
     std::lock_guard<std::mutex> lock(inputMutex_);
-    for (const auto &input : pendingInputs_)
+    if (pendingInputs_.empty())
+        return;
+
+    // Inputs stamped for a later frame wait, everything else goes in arrival order
+    auto due = std::stable_partition(pendingInputs_.begin(), pendingInputs_.end(),
+                                     [this](const PlayerInput &input) { return input.frameNumber <= frameCounter_; });
+    if (due == pendingInputs_.begin())
+        return;
+
+    std::vector<ReplayInput> applied;
+    for (auto it = pendingInputs_.begin(); it != due; ++it)
     {
-        if (input.playerId == 1)
-        {
-            if (input.flags & InputFlags::UP || input.flags & InputFlags::ARROW_UP)
-            {
-                if (gameState_.player1.position.y > 1)
-                {
-                    gameState_.player1.position.y -= 1;
-                }
-            }
-            if (input.flags & InputFlags::DOWN || input.flags & InputFlags::ARROW_DOWN)
-            {
-                if (gameState_.player1.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
-                {
-                    gameState_.player1.position.y += 1;
-                }
-            }
-        }
-        else if (input.playerId == 2)
-        {
-            if (input.flags & InputFlags::UP || input.flags & InputFlags::ARROW_UP)
-            {
-                if (gameState_.player2.position.y > 1)
-                {
-                    gameState_.player2.position.y -= 1;
-                }
-            }
-            if (input.flags & InputFlags::DOWN || input.flags & InputFlags::ARROW_DOWN)
-            {
-                if (gameState_.player2.position.y < GameState::HEIGHT - Paddle::HEIGHT - 1)
-                {
-                    gameState_.player2.position.y += 1;
-                }
-            }
-        }
+        if (it->playerId != 1 && it->playerId != 2)
+            continue;
+
+        gameState_.movePaddle(it->playerId, it->flags & (InputFlags::UP | InputFlags::ARROW_UP),
+                              it->flags & (InputFlags::DOWN | InputFlags::ARROW_DOWN));
+        applied.push_back({it->playerId, it->flags});
     }
-    pendingInputs_.clear();
+    pendingInputs_.erase(pendingInputs_.begin(), due);
+
+    replay_.recordFrame(frameCounter_, applied);
 }
 
 void GameInstance::addPlayerInput(uint8_t playerId, uint8_t inputFlags)
 {
     std::lock_guard<std::mutex> lock(inputMutex_);
-    pendingInputs_.push_back({playerId, inputFlags});
+    pendingInputs_.push_back({playerId, inputFlags, 0});
     std::cout << "Game " << id_ << " - Received input - Player: " << (int)playerId << " Flags: " << (int)inputFlags
               << std::endl;
 }
 
+void GameInstance::addPlayerInputs(uint8_t playerId, const InputEvent *events, uint8_t count)
+{
+    if (playerId != 1 && playerId != 2)
+        return;
+
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    uint32_t &lastSequence = lastInputSequence_[playerId - 1];
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        const InputEvent &event = events[i];
+        // Redundant copy of something an earlier batch already delivered
+        if (event.sequence <= lastSequence)
+            continue;
+        lastSequence = event.sequence;
+
+        uint32_t frame = event.frame > frameCounter_ + MAX_INPUT_LEAD_TICKS ? 0 : event.frame;
+        pendingInputs_.push_back({playerId, event.flags, frame});
+        std::cout << "Game " << id_ << " - Received input - Player: " << (int)playerId
+                  << " Flags: " << (int)event.flags << " Frame: " << event.frame << "/" << frameCounter_ << std::endl;
+    }
+}
+
+void GameInstance::exportState(HandoffWriter &out)
+{
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    out.u32(id_);
+    out.str(player1Id_);
+    out.str(player2Id_);
+    out.str(player1Name_);
+    out.str(player2Name_);
+    out.u32(matchId_);
+    out.u8(active_);
+    out.u8(started_);
+
+    // Pending start as time left, steady clocks are not comparable across processes
+    int64_t startInMs = -1;
+    if (!started_ && startAt_ != Clock::time_point::max())
+    {
+        startInMs = std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(startAt_ - Clock::now()).count());
+    }
+    out.i64(startInMs);
+
+    out.u32(frameCounter_);
+    out.u32(lastInputSequence_[0]);
+    out.u32(lastInputSequence_[1]);
+    out.raw(&gameState_, sizeof(gameState_));
+    spectators_.exportState(out);
+
+    // Everything recorded so far goes to disk before the new process opens the file
+    replay_.flush();
+    out.str(replay_.isOpen() ? replay_.getPath() : "");
+    out.u32(replay_.getLastFrame());
+}
+
+void GameInstance::importState(HandoffReader &in)
+{
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    active_ = in.u8() != 0;
+    started_ = in.u8() != 0;
+    int64_t startInMs = in.i64();
+    startAt_ = startInMs >= 0 ? Clock::now() + std::chrono::milliseconds(startInMs) : Clock::time_point::max();
+    frameCounter_ = in.u32();
+    lastInputSequence_[0] = in.u32();
+    lastInputSequence_[1] = in.u32();
+    in.raw(&gameState_, sizeof(gameState_));
+    spectators_.importState(in);
+
+    std::string replayPath = in.str();
+    uint32_t replayFrame = in.u32();
+    if (!replayPath.empty() && !replay_.resume(replayPath, replayFrame))
+    {
+        std::cerr << "Failed to reopen replay file " << replayPath << std::endl;
+    }
+
+    nextTick_ = Clock::now();
+    forceSnapshot_ = true;
+    lastSentFrame_[0] = lastSentFrame_[1] = frameCounter_;
+}
+
+void GameInstance::releaseReplay()
+{
+    std::lock_guard<std::mutex> lock(inputMutex_);
+    replay_.release();
+}
+
 void GameInstance::broadcastState(NetworkManager *networkManager)
 {
+    TRACE_ZONE("GameInstance::broadcastState");
     if (!networkManager)
         return;
 
@@ -214,6 +493,7 @@ void GameInstance::broadcastState(NetworkManager *networkManager)
 
     networkManager->sendToClient(player1Id_, packet);
     networkManager->sendToClient(player2Id_, packet);
+    spectators_.fanOut(networkManager, packet, frameCounter_, true);
 }
 
 } // namespace pong
\ No newline at end of file
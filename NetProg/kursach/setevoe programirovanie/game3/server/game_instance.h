@@ -3,8 +3,13 @@
 #pragma once
 #include "../common/game_state.h"
 #include "../common/network.h"
+#include "../common/replay.h"
+#include "handoff.h"
 #include "matchmaker.h"
 #include "network.h"
+#include "spectators.h"
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <vector>
 
@@ -14,21 +19,58 @@ namespace pong
 class NetworkManager;
 class Matchmaker;
 
+// Every game runs at SERVER_TICK_RATE, clients estimate the server's frame from it
+constexpr std::chrono::microseconds TICK_INTERVAL(1000000 / SERVER_TICK_RATE);
+constexpr uint32_t MAX_CATCHUP_TICKS = 5;
+constexpr uint32_t MAX_SEND_INTERVAL_TICKS = 4;
+constexpr int IDLE_SNAPSHOT_INTERVAL_MS = 1000;
+constexpr int LINK_REFRESH_INTERVAL_MS = 1000;
+constexpr int MATCH_START_DELAY_MS = 5000;
+// Stamped frames further ahead than this are not trusted and applied right away
+constexpr uint32_t MAX_INPUT_LEAD_TICKS = 30;
+
 class GameInstance
 {
   public:
-    GameInstance(uint32_t id, const std::string &player1, const std::string &player2);
+    using Clock = std::chrono::steady_clock;
+
+    // Players by client ID and by username. `matchId` is the coordinator's, results are reported under it.
+    GameInstance(uint32_t id, const std::string &player1, const std::string &player2, const std::string &player1Name,
+                 const std::string &player2Name, GameVariant variant = GameVariant::CLASSIC, uint32_t matchId = 0);
+    ~GameInstance();
 
+    // Runs every tick that is due at `now` and sends snapshots at each player's own rate
+    void process(Clock::time_point now);
+    Clock::time_point nextDeadline() const;
     void update();
     void addPlayerInput(uint8_t playerId, uint8_t inputFlags);
+    // Each new event is applied on the frame it is stamped with, or on the next tick if that has passed
+    void addPlayerInputs(uint8_t playerId, const InputEvent *events, uint8_t count);
     const GameState &getGameState() const;
     bool isActive() const;
     void stopGame();
     void startGame(); // New method
+    // startGame() runs from process() once `at` has passed
+    void scheduleStart(Clock::time_point at);
     uint32_t getId() const;
     bool hasPlayer(const std::string &clientId) const;
     std::vector<std::string> getAllPlayers() const;
+    // A player left a running match: the other one wins it
+    void forfeit(const std::string &clientId);
     void broadcastState(NetworkManager *networkManager);
+    // Players plus every spectator regardless of tier, for events that must not be skipped
+    void broadcast(const std::vector<uint8_t> &packet);
+
+    void addSpectator(const std::string &clientId, const sockaddr_in &address);
+    bool removeSpectator(const std::string &clientId);
+    std::vector<std::string> takeSpectators();
+    size_t getSpectatorCount();
+
+    // Hot restart
+    void exportState(HandoffWriter &out);
+    void importState(HandoffReader &in);
+    // After a successful handoff: the new process carries on with the replay, so it is left unfinished
+    void releaseReplay();
     void setNetworkManager(NetworkManager *networkManager)
     {
         networkManager_ = networkManager;
@@ -37,22 +79,50 @@ class GameInstance
     {
         matchmaker_ = matchmaker;
     }
+    // Empty directory disables replay recording
+    void setReplayDirectory(const std::string &directory)
+    {
+        replayDirectory_ = directory;
+    }
 
   private:
     void processPlayerInputs();
     void handleGoalScored();
     void handleVictory();
+    void sendSnapshots(Clock::time_point now);
+    void refreshSendRates();
+    void startReplay(uint32_t seed);
+    void finishReplay();
 
     uint32_t id_;
     GameState gameState_;
-    std::vector<PlayerInput> pendingInputs_;
+    std::vector<PlayerInput> pendingInputs_; // frameNumber is the tick to apply on
     std::mutex inputMutex_;
+    uint32_t lastInputSequence_[2];
     bool active_;
     std::string player1Id_;
     std::string player2Id_;
+    std::string player1Name_;
+    std::string player2Name_;
+    uint32_t matchId_;
     NetworkManager *networkManager_;
     Matchmaker *matchmaker_;
     uint32_t frameCounter_;
+
+    // Pacing. Nothing is simulated until startGame(); until then only an idle snapshot goes out.
+    bool started_;
+    Clock::time_point startAt_;
+    Clock::time_point nextTick_;
+    Clock::time_point nextIdleSnapshot_;
+    Clock::time_point nextLinkRefresh_;
+    std::atomic<bool> forceSnapshot_; // Also set by addSpectator on the receive thread
+    uint32_t sendIntervalTicks_[2]; // Per player, adapted to link quality
+    uint32_t lastSentFrame_[2];
+
+    SpectatorGroup spectators_;
+
+    std::string replayDirectory_;
+    ReplayWriter replay_;
 };
 
 } // namespace pong
\ No newline at end of file
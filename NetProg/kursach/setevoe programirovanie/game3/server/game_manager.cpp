@@ -1,5 +1,6 @@
 // server/game_manager.cpp
 #include "game_manager.h"
+#include <algorithm>
 
 namespace pong
 {
@@ -29,30 +30,44 @@ void GameManager::removeGame(uint32_t gameId)
     games_.erase(gameId);
 }
 
-uint32_t GameManager::createGame(const std::string &player1, const std::string &player2, bool start = true)
+uint32_t GameManager::createGame(const std::string &player1, const std::string &player2, const std::string &player1Name,
+                                 const std::string &player2Name, bool start, GameVariant variant, uint32_t matchId)
 {
     std::lock_guard<std::mutex> lock(gamesMutex_);
     uint32_t gameId = nextGameId_++;
-    games_[gameId] = std::make_unique<GameInstance>(gameId, player1, player2);
+    games_[gameId] =
+        std::make_unique<GameInstance>(gameId, player1, player2, player1Name, player2Name, variant, matchId);
     games_[gameId].get()->setMatchmaker(matchmaker);
     games_[gameId].get()->setNetworkManager(networkManager);
+    games_[gameId].get()->setReplayDirectory(replayDirectory);
     if (start)
         games_[gameId].get()->startGame();
     return gameId;
 }
 
-void GameManager::updateAllGames()
+void GameManager::updateAllGames(std::chrono::steady_clock::time_point now)
 {
     std::lock_guard<std::mutex> lock(gamesMutex_);
     for (auto &[id, game] : games_)
     {
         if (game->isActive())
         {
-            game->update();
+            game->process(now);
         }
     }
 }
 
+std::chrono::steady_clock::time_point GameManager::nextDeadline()
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    for (const auto &[id, game] : games_)
+    {
+        deadline = std::min(deadline, game->nextDeadline());
+    }
+    return deadline;
+}
+
 void GameManager::cleanupInactiveGames()
 {
     std::lock_guard<std::mutex> lock(gamesMutex_);
@@ -82,4 +97,93 @@ uint32_t GameManager::findGameIdForClient(const std::string &clientId)
     return 0;
 }
 
-} // namespace pong
\ No newline at end of file
+uint32_t GameManager::findSpectatableGame(uint32_t gameId)
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    if (gameId != 0)
+    {
+        auto it = games_.find(gameId);
+        return (it != games_.end() && it->second->isActive()) ? gameId : 0;
+    }
+
+    for (const auto &[id, game] : games_)
+    {
+        if (game->isActive())
+        {
+            return id;
+        }
+    }
+    return 0;
+}
+
+size_t GameManager::getActiveGameCount()
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    size_t count = 0;
+    for (const auto &[id, game] : games_)
+    {
+        if (game->isActive())
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+void GameManager::exportState(HandoffWriter &out)
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    out.u32(nextGameId_);
+
+    // Finished games are only waiting for their players to leave
+    std::vector<GameInstance *> active;
+    for (const auto &[id, game] : games_)
+    {
+        if (game->isActive())
+        {
+            active.push_back(game.get());
+        }
+    }
+
+    out.u32(active.size());
+    for (GameInstance *game : active)
+    {
+        game->exportState(out);
+    }
+}
+
+void GameManager::releaseReplays()
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    for (const auto &[id, game] : games_)
+    {
+        game->releaseReplay();
+    }
+}
+
+void GameManager::importState(HandoffReader &in)
+{
+    std::lock_guard<std::mutex> lock(gamesMutex_);
+    nextGameId_ = in.u32();
+
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count && in.ok(); ++i)
+    {
+        uint32_t gameId = in.u32();
+        std::string player1 = in.str();
+        std::string player2 = in.str();
+        std::string player1Name = in.str();
+        std::string player2Name = in.str();
+        uint32_t matchId = in.u32();
+
+        auto game = std::make_unique<GameInstance>(gameId, player1, player2, player1Name, player2Name,
+                                                   GameVariant::CLASSIC, matchId);
+        game->setMatchmaker(matchmaker);
+        game->setNetworkManager(networkManager);
+        game->setReplayDirectory(replayDirectory);
+        game->importState(in);
+        games_[gameId] = std::move(game);
+    }
+}
+
+} // namespace pong
@@ -1,6 +1,7 @@
 // server/game_manager.h
 #pragma once
 #include "game_instance.h"
+#include "handoff.h"
 #include "matchmaker.h"
 #include "network.h"
 #include <memory>
@@ -27,13 +28,29 @@ class GameManager
     {
         this->matchmaker = matchmaker;
     }
+    void setReplayDirectory(const std::string &directory)
+    {
+        replayDirectory = directory;
+    }
 
-    uint32_t createGame(const std::string &player1, const std::string &player2, bool start);
+    // Players by client ID and by username, in the same order. `matchId` is the coordinator's, 0 outside a cluster.
+    uint32_t createGame(const std::string &player1, const std::string &player2, const std::string &player1Name,
+                        const std::string &player2Name, bool start, GameVariant variant = GameVariant::CLASSIC,
+                        uint32_t matchId = 0);
     GameInstance *getGame(uint32_t gameId);
     void removeGame(uint32_t gameId);
-    void updateAllGames();
+    void updateAllGames(std::chrono::steady_clock::time_point now);
+    std::chrono::steady_clock::time_point nextDeadline();
     void cleanupInactiveGames();
     uint32_t findGameIdForClient(const std::string &clientId);
+    // The requested game if it is running, or any running game for 0
+    uint32_t findSpectatableGame(uint32_t gameId);
+    size_t getActiveGameCount();
+
+    // Hot restart
+    void exportState(HandoffWriter &out);
+    void importState(HandoffReader &in);
+    void releaseReplays();
 
   private:
     std::unordered_map<uint32_t, std::unique_ptr<GameInstance>> games_;
@@ -41,6 +58,7 @@ class GameManager
     std::mutex gamesMutex_;
     Matchmaker *matchmaker;
     NetworkManager *networkManager;
+    std::string replayDirectory;
 };
 
 } // namespace pong
\ No newline at end of file
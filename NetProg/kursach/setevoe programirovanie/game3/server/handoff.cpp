@@ -0,0 +1,227 @@
+// server/handoff.cpp
+#include "handoff.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pong
+{
+
+struct HandoffPreamble
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t stateSize;
+};
+
+static bool makeAddress(const std::string &path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Handoff socket path too long: " << path << std::endl;
+        return false;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+HandoffListener::HandoffListener() : listenFd(-1)
+{
+}
+
+HandoffListener::~HandoffListener()
+{
+    close();
+}
+
+bool HandoffListener::listen(const std::string &path)
+{
+    sockaddr_un addr;
+    if (!makeAddress(path, addr))
+        return false;
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+    {
+        perror("handoff socket");
+        return false;
+    }
+
+    // A stale path from a crashed server would make bind fail
+    unlink(path.c_str());
+    if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listenFd, 1) < 0)
+    {
+        perror("handoff bind");
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    chmod(path.c_str(), 0600);
+
+    int flags = fcntl(listenFd, F_GETFL, 0);
+    fcntl(listenFd, F_SETFL, flags | O_NONBLOCK);
+
+    this->path = path;
+    return true;
+}
+
+int HandoffListener::poll()
+{
+    if (listenFd < 0)
+        return -1;
+
+    int connectionFd = accept(listenFd, nullptr, nullptr);
+    if (connectionFd < 0)
+        return -1;
+
+    // The transfer itself is blocking
+    int flags = fcntl(connectionFd, F_GETFL, 0);
+    fcntl(connectionFd, F_SETFL, flags & ~O_NONBLOCK);
+    return connectionFd;
+}
+
+void HandoffListener::close()
+{
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        listenFd = -1;
+        unlink(path.c_str());
+    }
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            if (sent < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool readAll(int fd, uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received <= 0)
+        {
+            if (received < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool sendHandoff(int connectionFd, int udpSocket, const std::vector<uint8_t> &state)
+{
+    HandoffPreamble preamble{HANDOFF_MAGIC, HANDOFF_VERSION, state.size()};
+
+    iovec iov{&preamble, sizeof(preamble)};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &udpSocket, sizeof(int));
+
+    if (sendmsg(connectionFd, &message, MSG_NOSIGNAL) != sizeof(preamble))
+    {
+        perror("handoff sendmsg");
+        return false;
+    }
+
+    if (!writeAll(connectionFd, state.data(), state.size()))
+    {
+        perror("handoff send");
+        return false;
+    }
+
+    // Wait for the new process to confirm it has everything before we let go
+    uint8_t ack = 0;
+    return readAll(connectionFd, &ack, sizeof(ack)) && ack == 1;
+}
+
+bool receiveHandoff(int &udpSocket, std::vector<uint8_t> &state, const std::string &path)
+{
+    sockaddr_un addr;
+    if (!makeAddress(path, addr))
+        return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("handoff socket");
+        return false;
+    }
+
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("handoff connect (is a server running?)");
+        close(fd);
+        return false;
+    }
+
+    HandoffPreamble preamble{};
+    iovec iov{&preamble, sizeof(preamble)};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received = recvmsg(fd, &message, MSG_WAITALL);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (received != sizeof(preamble) || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        preamble.magic != HANDOFF_MAGIC || preamble.version != HANDOFF_VERSION)
+    {
+        std::cerr << "Invalid handoff preamble" << std::endl;
+        close(fd);
+        return false;
+    }
+    memcpy(&udpSocket, CMSG_DATA(cmsg), sizeof(int));
+
+    state.resize(preamble.stateSize);
+    if (!readAll(fd, state.data(), state.size()))
+    {
+        std::cerr << "Handoff state truncated" << std::endl;
+        close(udpSocket);
+        close(fd);
+        return false;
+    }
+
+    uint8_t ack = 1;
+    writeAll(fd, &ack, sizeof(ack));
+    close(fd);
+    return true;
+}
+
+} // namespace pong
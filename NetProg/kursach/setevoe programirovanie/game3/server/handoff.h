@@ -0,0 +1,143 @@
+// server/handoff.h
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace pong
+{
+
+// Hot restart: a new `pong_server --takeover` connects to the running server's control socket,
+// receives the bound UDP socket over SCM_RIGHTS followed by the serialized clients, players and games,
+// and carries on from there. The old process stops reading before it sends anything and exits after.
+// Replays of the running games continue in the new process. The chat relay is not handed off: the old
+// process closes its rooms and listener, and the new one opens a fresh listener if it was given --chat-relay.
+constexpr const char *HANDOFF_SOCKET_PATH = "/tmp/pong_server.handoff";
+constexpr uint32_t HANDOFF_MAGIC = 0x504F4E47; // "PONG"
+constexpr uint32_t HANDOFF_VERSION = 6;
+
+class HandoffWriter
+{
+  public:
+    void u8(uint8_t value)
+    {
+        raw(&value, sizeof(value));
+    }
+    void u16(uint16_t value)
+    {
+        raw(&value, sizeof(value));
+    }
+    void u32(uint32_t value)
+    {
+        raw(&value, sizeof(value));
+    }
+    void i64(int64_t value)
+    {
+        raw(&value, sizeof(value));
+    }
+    void str(const std::string &value)
+    {
+        u32(value.size());
+        raw(value.data(), value.size());
+    }
+    void raw(const void *src, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(src);
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    std::vector<uint8_t> data;
+};
+
+// Reads fail soft: past the end everything reads as zero and ok() turns false
+class HandoffReader
+{
+  public:
+    explicit HandoffReader(const std::vector<uint8_t> &data) : data(data), offset(0), valid(true)
+    {
+    }
+
+    uint8_t u8()
+    {
+        uint8_t value = 0;
+        raw(&value, sizeof(value));
+        return value;
+    }
+    uint16_t u16()
+    {
+        uint16_t value = 0;
+        raw(&value, sizeof(value));
+        return value;
+    }
+    uint32_t u32()
+    {
+        uint32_t value = 0;
+        raw(&value, sizeof(value));
+        return value;
+    }
+    int64_t i64()
+    {
+        int64_t value = 0;
+        raw(&value, sizeof(value));
+        return value;
+    }
+    std::string str()
+    {
+        uint32_t size = u32();
+        if (!valid || offset + size > data.size())
+        {
+            valid = false;
+            return "";
+        }
+        std::string value(reinterpret_cast<const char *>(data.data() + offset), size);
+        offset += size;
+        return value;
+    }
+    void raw(void *dst, size_t size)
+    {
+        if (!valid || offset + size > data.size())
+        {
+            valid = false;
+            memset(dst, 0, size);
+            return;
+        }
+        memcpy(dst, data.data() + offset, size);
+        offset += size;
+    }
+
+    bool ok() const
+    {
+        return valid;
+    }
+
+  private:
+    const std::vector<uint8_t> &data;
+    size_t offset;
+    bool valid;
+};
+
+// Old process side: a non-blocking listener polled from the main loop
+class HandoffListener
+{
+  public:
+    HandoffListener();
+    ~HandoffListener();
+
+    bool listen(const std::string &path = HANDOFF_SOCKET_PATH);
+    // Returns a connected peer asking for a takeover, or -1
+    int poll();
+    void close();
+
+  private:
+    int listenFd;
+    std::string path;
+};
+
+// Sends the UDP socket and the serialized state over an accepted control connection
+bool sendHandoff(int connectionFd, int udpSocket, const std::vector<uint8_t> &state);
+
+// New process side: connects to the running server and receives its socket and state
+bool receiveHandoff(int &udpSocket, std::vector<uint8_t> &state, const std::string &path = HANDOFF_SOCKET_PATH);
+
+} // namespace pong
@@ -0,0 +1,427 @@
+// server/leaderboard.cpp
+#include "leaderboard.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pong
+{
+
+static constexpr uint32_t LEADERBOARD_MAGIC = 0x44524C50; // "PLRD"
+static constexpr uint32_t LEADERBOARD_VERSION = 1;
+static constexpr uint32_t INITIAL_CAPACITY = 1024;
+
+Leaderboard::Leaderboard()
+    : fd(-1), mapping(MAP_FAILED), mappingSize(0), header(nullptr), records(nullptr), buckets(RATING_BUCKETS),
+      fenwick(RATING_BUCKETS + 1, 0)
+{
+}
+
+Leaderboard::~Leaderboard()
+{
+    close();
+}
+
+bool Leaderboard::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (mapping != MAP_FAILED)
+    {
+        munmap(mapping, mappingSize);
+        mapping = MAP_FAILED;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    bool ok = false;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0)
+    {
+        perror("leaderboard open");
+    }
+    else if (info.st_size == 0)
+    {
+        ok = map(fd, INITIAL_CAPACITY);
+        if (ok)
+        {
+            header->magic = LEADERBOARD_MAGIC;
+            header->version = LEADERBOARD_VERSION;
+            header->count = 0;
+            header->capacity = INITIAL_CAPACITY;
+        }
+    }
+    else
+    {
+        FileHeader stored{};
+        bool valid = static_cast<size_t>(info.st_size) >= sizeof(FileHeader) &&
+                     pread(fd, &stored, sizeof(stored), 0) == sizeof(stored) && stored.magic == LEADERBOARD_MAGIC &&
+                     stored.version == LEADERBOARD_VERSION && stored.count <= stored.capacity &&
+                     static_cast<size_t>(info.st_size) >= sizeof(FileHeader) + stored.capacity * sizeof(Record);
+        if (!valid)
+        {
+            std::cerr << "Leaderboard file " << path << " is not a ratings table, leaving it alone" << std::endl;
+        }
+        else
+        {
+            ok = map(fd, stored.capacity);
+        }
+    }
+
+    if (!ok)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+        std::cerr << "Ratings are kept in memory only" << std::endl;
+        mapAnonymous();
+    }
+
+    rebuildIndex();
+    return ok;
+}
+
+void Leaderboard::openInMemory()
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    mapAnonymous();
+    rebuildIndex();
+}
+
+void Leaderboard::mapAnonymous()
+{
+    if (map(-1, INITIAL_CAPACITY))
+    {
+        header->magic = LEADERBOARD_MAGIC;
+        header->version = LEADERBOARD_VERSION;
+        header->count = 0;
+        header->capacity = INITIAL_CAPACITY;
+    }
+}
+
+void Leaderboard::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (mapping != MAP_FAILED)
+    {
+        munmap(mapping, mappingSize);
+        mapping = MAP_FAILED;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    header = nullptr;
+    records = nullptr;
+    mappingSize = 0;
+    indexByName.clear();
+    for (auto &bucket : buckets)
+    {
+        bucket.clear();
+    }
+    std::fill(fenwick.begin(), fenwick.end(), 0);
+}
+
+bool Leaderboard::map(int fd, uint32_t capacity)
+{
+    size_t size = sizeof(FileHeader) + capacity * sizeof(Record);
+    if (fd >= 0)
+    {
+        struct stat info;
+        if (fstat(fd, &info) < 0 || (static_cast<size_t>(info.st_size) < size && ftruncate(fd, size) < 0))
+        {
+            perror("leaderboard resize");
+            return false;
+        }
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    else
+    {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if (mapping == MAP_FAILED)
+    {
+        perror("leaderboard mmap");
+        header = nullptr;
+        records = nullptr;
+        mappingSize = 0;
+        return false;
+    }
+
+    mappingSize = size;
+    header = static_cast<FileHeader *>(mapping);
+    records = reinterpret_cast<Record *>(static_cast<uint8_t *>(mapping) + sizeof(FileHeader));
+    return true;
+}
+
+bool Leaderboard::grow()
+{
+    uint32_t capacity = header->capacity * 2;
+    size_t size = sizeof(FileHeader) + capacity * sizeof(Record);
+    if (fd >= 0 && ftruncate(fd, size) < 0)
+    {
+        perror("leaderboard grow");
+        return false;
+    }
+
+    void *grown = mremap(mapping, mappingSize, size, MREMAP_MAYMOVE);
+    if (grown == MAP_FAILED)
+    {
+        perror("leaderboard mremap");
+        return false;
+    }
+
+    mapping = grown;
+    mappingSize = size;
+    header = static_cast<FileHeader *>(mapping);
+    records = reinterpret_cast<Record *>(static_cast<uint8_t *>(mapping) + sizeof(FileHeader));
+    header->capacity = capacity;
+    return true;
+}
+
+void Leaderboard::rebuildIndex()
+{
+    indexByName.clear();
+    for (auto &bucket : buckets)
+    {
+        bucket.clear();
+    }
+    std::fill(fenwick.begin(), fenwick.end(), 0);
+    if (!header)
+        return;
+
+    for (uint32_t index = 0; index < header->count; ++index)
+    {
+        records[index].username[sizeof(records[index].username) - 1] = '\0';
+        indexByName[records[index].username] = index;
+        buckets[bucketOf(records[index].rating)].push_back(index);
+    }
+
+    for (auto &bucket : buckets)
+    {
+        std::sort(bucket.begin(), bucket.end(), [this](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+    }
+
+    // Linear Fenwick build: every node passes its total up to its parent
+    for (int node = 1; node <= RATING_BUCKETS; ++node)
+    {
+        fenwick[node] += buckets[RATING_BUCKETS - node].size();
+        int parent = node + (node & -node);
+        if (parent <= RATING_BUCKETS)
+        {
+            fenwick[parent] += fenwick[node];
+        }
+    }
+}
+
+size_t Leaderboard::importCsv(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string line;
+    size_t imported = 0;
+    while (std::getline(file, line))
+    {
+        std::istringstream ss(line);
+        std::string name;
+        int mmr;
+        if (std::getline(ss, name, ',') && ss >> mmr && !contains(name))
+        {
+            setRating(name, mmr);
+            ++imported;
+        }
+    }
+    return imported;
+}
+
+bool Leaderboard::contains(const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return indexByName.count(username) != 0;
+}
+
+int Leaderboard::getRating(const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = indexByName.find(username);
+    return it != indexByName.end() ? records[it->second].rating : DEFAULT_RATING;
+}
+
+void Leaderboard::setRating(const std::string &username, int rating)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!header)
+        return;
+
+    auto it = indexByName.find(username);
+    if (it != indexByName.end())
+    {
+        removeFromBucket(it->second);
+        records[it->second].rating = rating;
+        insertIntoBucket(it->second);
+        return;
+    }
+
+    if (header->count == header->capacity && !grow())
+        return;
+
+    // The record is complete before the count covers it, a crash in between loses only this player
+    uint32_t index = header->count;
+    memset(&records[index], 0, sizeof(Record));
+    strncpy(records[index].username, username.c_str(), sizeof(records[index].username) - 1);
+    records[index].rating = rating;
+    header->count = index + 1;
+
+    indexByName[records[index].username] = index;
+    insertIntoBucket(index);
+}
+
+uint32_t Leaderboard::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return header ? header->count : 0;
+}
+
+uint32_t Leaderboard::getRank(const std::string &username)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = indexByName.find(username);
+    return it != indexByName.end() ? entryAt(positionOf(it->second)).rank : 0;
+}
+
+std::vector<LeaderboardEntry> Leaderboard::top(uint32_t offset, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<LeaderboardEntry> entries;
+    uint32_t total = header ? header->count : 0;
+    for (uint32_t position = offset; position < total && entries.size() < count; ++position)
+    {
+        entries.push_back(entryAt(position));
+    }
+    return entries;
+}
+
+std::vector<LeaderboardEntry> Leaderboard::around(const std::string &username, uint32_t above, uint32_t below)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<LeaderboardEntry> entries;
+    auto it = indexByName.find(username);
+    if (it == indexByName.end())
+        return entries;
+
+    uint32_t position = positionOf(it->second);
+    uint32_t first = position > above ? position - above : 0;
+    uint32_t last = std::min(position + below, header->count - 1);
+    for (uint32_t i = first; i <= last; ++i)
+    {
+        entries.push_back(entryAt(i));
+    }
+    return entries;
+}
+
+bool Leaderboard::ranksBefore(uint32_t a, uint32_t b) const
+{
+    return records[a].rating > records[b].rating || (records[a].rating == records[b].rating && a < b);
+}
+
+int Leaderboard::bucketOf(int rating)
+{
+    return std::clamp(rating, 0, RATING_BUCKETS - 1);
+}
+
+void Leaderboard::fenwickAdd(int bucket, int delta)
+{
+    for (int node = RATING_BUCKETS - bucket; node <= RATING_BUCKETS; node += node & -node)
+    {
+        fenwick[node] += delta;
+    }
+}
+
+uint32_t Leaderboard::countAtOrAbove(int bucket) const
+{
+    uint32_t count = 0;
+    for (int node = RATING_BUCKETS - bucket; node > 0; node -= node & -node)
+    {
+        count += fenwick[node];
+    }
+    return count;
+}
+
+uint32_t Leaderboard::positionOf(uint32_t index) const
+{
+    int bucket = bucketOf(records[index].rating);
+    const std::vector<uint32_t> &members = buckets[bucket];
+    uint32_t above = bucket + 1 < RATING_BUCKETS ? countAtOrAbove(bucket + 1) : 0;
+    auto at = std::lower_bound(members.begin(), members.end(), index,
+                               [this](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+    return above + (at - members.begin());
+}
+
+uint32_t Leaderboard::indexAt(uint32_t position) const
+{
+    // Descend the tree for the first node whose prefix passes `position`
+    int node = 0;
+    uint32_t remaining = position;
+    for (int step = RATING_BUCKETS; step > 0; step >>= 1)
+    {
+        if (node + step <= RATING_BUCKETS && fenwick[node + step] <= remaining)
+        {
+            node += step;
+            remaining -= fenwick[node];
+        }
+    }
+    return buckets[RATING_BUCKETS - 1 - node][remaining];
+}
+
+void Leaderboard::insertIntoBucket(uint32_t index)
+{
+    std::vector<uint32_t> &members = buckets[bucketOf(records[index].rating)];
+    auto at = std::lower_bound(members.begin(), members.end(), index,
+                               [this](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+    members.insert(at, index);
+    fenwickAdd(bucketOf(records[index].rating), 1);
+}
+
+void Leaderboard::removeFromBucket(uint32_t index)
+{
+    std::vector<uint32_t> &members = buckets[bucketOf(records[index].rating)];
+    auto at = std::lower_bound(members.begin(), members.end(), index,
+                               [this](uint32_t a, uint32_t b) { return ranksBefore(a, b); });
+    members.erase(at);
+    fenwickAdd(bucketOf(records[index].rating), -1);
+}
+
+LeaderboardEntry Leaderboard::entryAt(uint32_t position) const
+{
+    uint32_t index = indexAt(position);
+    int bucket = bucketOf(records[index].rating);
+    const std::vector<uint32_t> &members = buckets[bucket];
+
+    // Ties share the rank of the first of them
+    uint32_t above = bucket + 1 < RATING_BUCKETS ? countAtOrAbove(bucket + 1) : 0;
+    auto firstTie = std::partition_point(members.begin(), members.end(), [this, index](uint32_t other) {
+        return records[other].rating > records[index].rating;
+    });
+
+    LeaderboardEntry entry{};
+    memcpy(entry.username, records[index].username, sizeof(entry.username));
+    entry.rating = records[index].rating;
+    entry.rank = above + (firstTie - members.begin()) + 1;
+    return entry;
+}
+
+} // namespace pong
@@ -0,0 +1,95 @@
+// server/leaderboard.h
+#pragma once
+#include "../common/network.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pong
+{
+
+constexpr int DEFAULT_RATING = 1000;
+constexpr int RATING_BUCKETS = 4096; // One per rating point, ratings outside share the edge buckets
+
+// Ratings in a memory-mapped file: a header and a flat array of fixed-size records, written in place,
+// so startup is one mmap and nothing is parsed. On top of that, in memory only, a Fenwick tree counts
+// players per rating bucket, which gives rank and the player at any position in O(log RATING_BUCKETS).
+// Order is by rating, highest first; equal ratings share a rank and are listed oldest player first.
+// Thread safe.
+class Leaderboard
+{
+  public:
+    Leaderboard();
+    ~Leaderboard();
+
+    // Maps the file, creating it if needed, and rebuilds the index from it. Without a usable file the
+    // table lives in anonymous memory and ratings last until exit.
+    bool open(const std::string &path);
+    // An empty table in anonymous memory, for a process whose ratings are kept elsewhere
+    void openInMemory();
+    void close();
+
+    // One-time migration from the old "username,rating" lines, skips names already present
+    size_t importCsv(const std::string &path);
+
+    bool contains(const std::string &username);
+    // DEFAULT_RATING for an unknown player, who is not added
+    int getRating(const std::string &username);
+    void setRating(const std::string &username, int rating);
+
+    uint32_t size();
+    // 1 for the best, 0 for an unknown player
+    uint32_t getRank(const std::string &username);
+    // `count` players from position `offset` (0 is the best)
+    std::vector<LeaderboardEntry> top(uint32_t offset, uint32_t count);
+    // The player with up to `above` better and `below` worse players, empty for an unknown player
+    std::vector<LeaderboardEntry> around(const std::string &username, uint32_t above, uint32_t below);
+
+  private:
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t capacity;
+    };
+
+    struct Record
+    {
+        char username[32];
+        int32_t rating;
+    };
+
+    bool map(int fd, uint32_t capacity);
+    void mapAnonymous();
+    bool grow();
+    void rebuildIndex();
+
+    // Bucket order: better rating first, then the older record
+    bool ranksBefore(uint32_t a, uint32_t b) const;
+    static int bucketOf(int rating);
+    // Fenwick tree over buckets from the highest rating down, so a prefix is "this rating or better"
+    void fenwickAdd(int bucket, int delta);
+    uint32_t countAtOrAbove(int bucket) const;
+    uint32_t positionOf(uint32_t index) const;
+    uint32_t indexAt(uint32_t position) const;
+
+    void insertIntoBucket(uint32_t index);
+    void removeFromBucket(uint32_t index);
+    LeaderboardEntry entryAt(uint32_t position) const;
+
+    std::mutex mutex;
+    int fd;
+    void *mapping;
+    size_t mappingSize;
+    FileHeader *header;
+    Record *records;
+
+    std::unordered_map<std::string, uint32_t> indexByName;
+    std::vector<std::vector<uint32_t>> buckets; // Record indices, best rating first, then oldest first
+    std::vector<uint32_t> fenwick;
+};
+
+} // namespace pong
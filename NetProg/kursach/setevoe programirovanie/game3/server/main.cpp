@@ -1,31 +1,146 @@
 // server/main.cpp
+#include "chat_relay.h"
+#include "cluster.h"
+#include "handoff.h"
 #include "matchmaker.h"
 #include "network.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <signal.h>
 #include <thread>
+#include <unistd.h>
 
 volatile bool running = true;
+volatile bool drainRequested = false;
+volatile sig_atomic_t traceToggleRequested = false;
 
-// Signal handler
+// Signal handler: first signal drains, second stops now, third exits immediately
 void signalHandler(int signal)
 {
-    std::cout << "Received interrupt / termination signal. Exiting..." << std::endl;
     if (!running)
     {
         std::exit(1);
     }
+    if (!drainRequested)
+    {
+        std::cout << "Received interrupt / termination signal. Draining, signal again to exit now..." << std::endl;
+        drainRequested = true;
+        return;
+    }
+    std::cout << "Received interrupt / termination signal. Exiting..." << std::endl;
     running = false;
 }
 
-int main()
+// Tracing is switched and written out by the main loop, not in the handler
+void traceSignalHandler(int)
+{
+    traceToggleRequested = true;
+}
+
+static void toggleTrace()
+{
+    static int session = 0;
+    if (!pong::Tracer::isEnabled())
+    {
+        pong::Tracer::start();
+        std::cout << "Tracing started, signal again to stop" << std::endl;
+        return;
+    }
+
+    std::string path = "trace-" + std::to_string(getpid()) + "-" + std::to_string(++session) + ".json";
+    size_t events = pong::Tracer::stop(path);
+    std::cout << "Tracing stopped, " << events << " events written to " << path << std::endl;
+}
+
+// Hands the socket and all state to a new process. Returns false (and keeps serving) if it fails.
+static bool handOff(int connectionFd, pong::Matchmaker &matchmaker, pong::GameManager &gameManager,
+                    pong::NetworkManager &networkManager, pong::ChatRelay &chatRelay)
+{
+    std::cout << "Takeover requested, handing off..." << std::endl;
+    networkManager.stopReceiving();
+
+    pong::HandoffWriter state;
+    matchmaker.exportState(state);
+    gameManager.exportState(state);
+    networkManager.exportState(state);
+
+    // Chat rooms are not part of the handoff, players in one lose it. The new process needs the port free.
+    bool relayWasRunning = chatRelay.isRunning();
+    chatRelay.stop();
+
+    bool ok = pong::sendHandoff(connectionFd, networkManager.getSocket(), state.data);
+    close(connectionFd);
+
+    if (!ok)
+    {
+        std::cerr << "Handoff failed, resuming" << std::endl;
+        networkManager.resumeReceiving();
+        if (relayWasRunning && !chatRelay.start(pong::TCP_SERVER_PORT))
+        {
+            matchmaker.setChatRelay(nullptr);
+        }
+        return false;
+    }
+
+    gameManager.releaseReplays();
+    std::cout << "Handed off " << gameManager.getActiveGameCount() << " games (" << state.data.size() << " bytes)"
+              << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
 {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR1, traceSignalHandler);
+
+    bool takeover = false;
+    bool withChatRelay = false;
+    bool isCoordinator = false;
+    std::string coordinatorEndpoint;
+    std::vector<std::string> memberEndpoints;
+    uint16_t port = pong::UDP_SERVER_PORT;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--takeover") == 0)
+            takeover = true;
+        else if (strcmp(argv[i], "--chat-relay") == 0)
+            withChatRelay = true;
+        else if (strcmp(argv[i], "--coordinator") == 0)
+            isCoordinator = true;
+        else if (strcmp(argv[i], "--join") == 0 && i + 1 < argc)
+            coordinatorEndpoint = argv[++i];
+        else if (strcmp(argv[i], "--member") == 0 && i + 1 < argc)
+            memberEndpoints.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            port = static_cast<uint16_t>(atoi(argv[++i]));
+        else
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+    }
+
+    if (isCoordinator && !coordinatorEndpoint.empty())
+    {
+        std::cerr << "--coordinator and --join are exclusive." << std::endl;
+        return 1;
+    }
+
+    // Several servers on one host each need their own control socket
+    std::string handoffPath = pong::HANDOFF_SOCKET_PATH;
+    if (port != pong::UDP_SERVER_PORT)
+    {
+        handoffPath += "." + std::to_string(port);
+    }
 
     pong::Matchmaker matchmaker;
     pong::GameManager gameManager;
     pong::NetworkManager networkManager;
+    pong::ChatRelay chatRelay;
+    pong::ClusterCoordinator coordinator;
+    pong::ClusterMember clusterMember;
 
     networkManager.setGameManager(&gameManager);
     networkManager.setMatchmaker(&matchmaker);
@@ -35,23 +150,144 @@ int main()
 
     gameManager.setMatchmaker(&matchmaker);
     gameManager.setNetworkManager(&networkManager);
+    gameManager.setReplayDirectory("replays");
 
-    if (!networkManager.startServer())
+    if (isCoordinator)
     {
-        std::cerr << "Failed to start server." << std::endl;
-        return 1;
+        for (const std::string &endpoint : memberEndpoints)
+        {
+            if (!coordinator.allowMember(endpoint))
+                return 1;
+        }
+        if (!coordinator.hasMembers())
+        {
+            std::cerr << "--coordinator needs the game servers it may use, --member <address>:<port> each"
+                      << std::endl;
+            return 1;
+        }
+        coordinator.setNetworkManager(&networkManager);
+        coordinator.setMatchmaker(&matchmaker);
+        matchmaker.setClusterCoordinator(&coordinator);
+        networkManager.setClusterCoordinator(&coordinator);
+        std::cout << "Coordinating a cluster of " << memberEndpoints.size()
+                  << " game servers, they join with --join <address>:" << port << std::endl;
+    }
+    else if (!coordinatorEndpoint.empty())
+    {
+        if (!clusterMember.setCoordinator(coordinatorEndpoint))
+            return 1;
+        clusterMember.setNetworkManager(&networkManager);
+        clusterMember.setMatchmaker(&matchmaker);
+        clusterMember.setGameManager(&gameManager);
+        matchmaker.setClusterMember(&clusterMember);
+        networkManager.setClusterMember(&clusterMember);
+        std::cout << "Game server for coordinator " << coordinatorEndpoint << std::endl;
+    }
+
+    if (takeover)
+    {
+        int socket = -1;
+        std::vector<uint8_t> data;
+        if (!pong::receiveHandoff(socket, data, handoffPath))
+        {
+            std::cerr << "Takeover failed." << std::endl;
+            return 1;
+        }
+
+        pong::HandoffReader state(data);
+        matchmaker.importState(state);
+        gameManager.importState(state);
+        networkManager.importState(state);
+        if (!state.ok())
+        {
+            std::cerr << "Takeover state truncated, continuing with what was read." << std::endl;
+        }
+
+        networkManager.adoptSocket(socket);
+        std::cout << "Took over " << gameManager.getActiveGameCount() << " games" << std::endl;
+    }
+    else
+    {
+        matchmaker.loadMMR();
+        if (!networkManager.startServer(port))
+        {
+            std::cerr << "Failed to start server." << std::endl;
+            return 1;
+        }
+    }
+
+    if (withChatRelay)
+    {
+        if (chatRelay.start(pong::TCP_SERVER_PORT))
+        {
+            matchmaker.setChatRelay(&chatRelay);
+        }
+        else
+        {
+            std::cerr << "Chat relay not started, players chat directly." << std::endl;
+        }
     }
 
+    pong::HandoffListener handoffListener;
+    handoffListener.listen(handoffPath);
+
+    bool handedOff = false;
     while (running)
     {
-        matchmaker.process();
-        networkManager.process();
-        // Sleep to avoid maxing out CPU
-        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        int takeoverFd = handoffListener.poll();
+        if (takeoverFd >= 0)
+        {
+            handoffListener.close();
+            if (handOff(takeoverFd, matchmaker, gameManager, networkManager, chatRelay))
+            {
+                handedOff = true;
+                break;
+            }
+            handoffListener.listen(handoffPath);
+        }
+
+        if (drainRequested)
+        {
+            networkManager.startDrain();
+            if (gameManager.getActiveGameCount() == 0)
+            {
+                std::cout << "All games finished." << std::endl;
+                break;
+            }
+        }
+
+        if (traceToggleRequested)
+        {
+            traceToggleRequested = false;
+            toggleTrace();
+        }
+
+        {
+            TRACE_ZONE("Matchmaker::process");
+            matchmaker.process();
+        }
+        if (isCoordinator)
+        {
+            coordinator.process();
+        }
+        else if (!coordinatorEndpoint.empty())
+        {
+            clusterMember.process();
+        }
+        {
+            TRACE_ZONE("NetworkManager::process");
+            networkManager.process();
+        }
+
+        // Sleep until a game tick or keepalive is due, but keep polling the matchmaker at least every 16 ms
+        auto wakeup = std::min(networkManager.nextDeadline(),
+                               std::chrono::steady_clock::now() + std::chrono::milliseconds(16));
+        std::this_thread::sleep_until(wakeup);
     }
 
+    chatRelay.stop();
     networkManager.shutdown();
 
-    std::cout << "Server shutdown complete." << std::endl;
+    std::cout << (handedOff ? "Server handed off." : "Server shutdown complete.") << std::endl;
     return 0;
-}
\ No newline at end of file
+}
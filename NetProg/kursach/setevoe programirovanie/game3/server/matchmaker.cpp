@@ -1,14 +1,16 @@
 // server/matchmaker.cpp
 #include "matchmaker.h"
+#include "chat_relay.h"
+#include "cluster.h"
 #include "network.h"
 #include <iostream>
+#include <random>
 
 namespace pong
 {
 
-Matchmaker::Matchmaker() : networkManager(nullptr), gameManager(nullptr), currentPlayer1(""), currentPlayer2("")
+Matchmaker::Matchmaker() : networkManager(nullptr), gameManager(nullptr)
 {
-    loadMMR();
 }
 
 Matchmaker::~Matchmaker()
@@ -17,46 +19,45 @@ Matchmaker::~Matchmaker()
 
 void Matchmaker::loadMMR()
 {
-    std::ifstream file(mmrFile);
-    std::string line;
-    while (std::getline(file, line))
+    // Results go to the coordinator, this table only has to exist
+    if (clusterMember)
+    {
+        leaderboard.openInMemory();
+        return;
+    }
+
+    bool persistent = leaderboard.open(ratingsFile);
+    if (persistent && leaderboard.size() == 0)
     {
-        std::istringstream ss(line);
-        std::string name;
-        int mmr;
-        if (std::getline(ss, name, ',') && ss >> mmr)
+        size_t imported = leaderboard.importCsv(legacyRatingsFile);
+        if (imported > 0)
         {
-            std::cout << "Loaded mmr of player " << name << ": " << mmr << std::endl;
-            mmrMap[name] = mmr;
+            std::cout << "Imported " << imported << " ratings from " << legacyRatingsFile << std::endl;
         }
     }
+    std::cout << "Loaded " << leaderboard.size() << " ratings" << std::endl;
 }
 
-void Matchmaker::saveMMR()
+void Matchmaker::updateMMR(const std::string &winner, const std::string &loser, uint32_t matchId)
 {
-    std::ofstream file(mmrFile, std::ios_base::openmode::_S_ate);
-    for (const auto &[user, mmr] : mmrMap)
+    if (clusterMember)
     {
-        file << user << "," << mmr << "\n";
+        clusterMember->reportResult(matchId, winner, loser);
+        return;
     }
-}
 
-void Matchmaker::updateMMR(const std::string &winner, const std::string &loser)
-{
     int K = 32;
-    int Ra = mmrMap[winner];
-    int Rb = mmrMap[loser];
+    int Ra = leaderboard.getRating(winner);
+    int Rb = leaderboard.getRating(loser);
 
     float Ea = 1.0f / (1.0f + pow(10.0f, (Rb - Ra) / 400.0f));
     float Eb = 1.0f / (1.0f + pow(10.0f, (Ra - Rb) / 400.0f));
 
-    mmrMap[winner] = std::round(Ra + K * (1 - Ea));
-    mmrMap[loser] = std::round(Rb + K * (0 - Eb));
+    leaderboard.setRating(winner, std::round(Ra + K * (1 - Ea)));
+    leaderboard.setRating(loser, std::round(Rb + K * (0 - Eb)));
 
-    std::cout << "New mmr of " << winner << "(" << Ra << ") is " << mmrMap[winner] << std::endl;
-    std::cout << "New mmr of " << loser << "(" << Rb << ") is " << mmrMap[loser] << std::endl;
-
-    saveMMR();
+    std::cout << "New mmr of " << winner << "(" << Ra << ") is " << leaderboard.getRating(winner) << std::endl;
+    std::cout << "New mmr of " << loser << "(" << Rb << ") is " << leaderboard.getRating(loser) << std::endl;
 }
 
 uint8_t Matchmaker::registerPlayer(const PlayerInfo &player)
@@ -71,9 +72,9 @@ uint8_t Matchmaker::registerPlayer(const PlayerInfo &player)
         return 0;
     }
 
-    if (mmrMap.find(player.username) == mmrMap.end())
+    if (!leaderboard.contains(player.username))
     {
-        mmrMap[player.username] = 1000;
+        leaderboard.setRating(player.username, DEFAULT_RATING);
     }
 
     activePlayersByUsername[player.username] = player;
@@ -89,15 +90,9 @@ void Matchmaker::process()
     PlayerInfo player1, player2;
     if (findMatch(player1, player2))
     {
-        std::cout << "Match found: " << player1.username << "(" << mmrMap[player1.username] << ") vs "
-                  << player2.username << "(" << mmrMap[player2.username] << ")" << std::endl;
-
-        // Store current players
-        {
-            std::lock_guard<std::mutex> lock(playersMutex);
-            currentPlayer1 = player1.username;
-            currentPlayer2 = player2.username;
-        }
+        std::cout << "Match found: " << player1.username << "(" << leaderboard.getRating(player1.username)
+                  << ") vs " << player2.username << "(" << leaderboard.getRating(player2.username) << "), "
+                  << variantName(player1.variant) << std::endl;
 
         notifyPlayersAboutMatch(player1, player2);
     }
@@ -117,35 +112,67 @@ bool Matchmaker::findMatch(PlayerInfo &player1, PlayerInfo &player2)
         waitingPlayers.pop();
     }
 
+    // Games are relayed through the server, so a pair's latency is the sum of both RTTs.
+    // Unmeasured clients count as zero so they are never held back.
+    std::vector<float> rtts;
+    for (const auto &p : queue)
+    {
+        float rtt = networkManager ? networkManager->getClientRtt(p.clientId) : -1.0f;
+        rtts.push_back(rtt > 0 ? rtt : 0.0f);
+    }
+
+    // Every player's tolerances widen one step per interval of their own wait: MMR by 100, the relay RTT
+    // budget by 50. Past the last step RTT no longer counts. A pair needs both players' tolerances.
     const int maxDeltaStart = 50;
-    const int maxDeltaLimit = 450;
+    const int maxDeltaStep = 100;
+    const int maxSteps = 4; // 450 at most
+    const float relayRttStart = 100.0f;
+    const float relayRttStep = 50.0f;
+    const auto stepInterval = std::chrono::milliseconds(1500);
+
+    auto now = std::chrono::steady_clock::now();
+    std::vector<int> steps;
+    for (const auto &p : queue)
+    {
+        steps.push_back(std::min<int>((now - p.queuedAt) / stepInterval, maxSteps));
+    }
 
-    for (int delta = maxDeltaStart; delta <= maxDeltaLimit; delta += 100)
+    for (size_t i = 0; i < queue.size(); ++i)
     {
-        for (size_t i = 0; i < queue.size(); ++i)
+        int mmr1 = leaderboard.getRating(queue[i].username);
+        size_t best = queue.size();
+        for (size_t j = i + 1; j < queue.size(); ++j)
         {
-            int mmr1 = mmrMap[queue[i].username];
-            for (size_t j = i + 1; j < queue.size(); ++j)
+            if (queue[i].peerMatch != queue[j].peerMatch || queue[i].variant != queue[j].variant)
+                continue;
+
+            int step = std::min(steps[i], steps[j]);
+            int delta = maxDeltaStart + step * maxDeltaStep;
+            float relayRttBudget = relayRttStart + step * relayRttStep;
+            int mmr2 = leaderboard.getRating(queue[j].username);
+            float relayRtt = rtts[i] + rtts[j];
+            if (std::abs(mmr1 - mmr2) <= delta && (step == maxSteps || relayRtt <= relayRttBudget) &&
+                (best == queue.size() || relayRtt < rtts[i] + rtts[best]))
             {
-                int mmr2 = mmrMap[queue[j].username];
-                if (std::abs(mmr1 - mmr2) <= delta)
-                {
-                    player1 = queue[i];
-                    player2 = queue[j];
-
-                    // Remove both from queue
-                    queue.erase(queue.begin() + j);
-                    queue.erase(queue.begin() + i);
-
-                    // Push remaining back into waiting queue
-                    for (const auto &p : queue)
-                        waitingPlayers.push(p);
-
-                    return true;
-                }
+                best = j;
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+        if (best != queue.size())
+        {
+            player1 = queue[i];
+            player2 = queue[best];
+
+            // Remove both from queue
+            queue.erase(queue.begin() + best);
+            queue.erase(queue.begin() + i);
+
+            // Push remaining back into waiting queue
+            for (const auto &p : queue)
+                waitingPlayers.push(p);
+
+            return true;
+        }
     }
 
     // Put all players back if no match
@@ -163,43 +190,120 @@ void Matchmaker::notifyPlayersAboutMatch(const PlayerInfo &player1, const Player
         return;
     }
 
-    uint32_t gameId =
-        gameManager->createGame(player1.clientId, player2.clientId, false); // not starting the game to desync it a bit
+    // In a cluster rated matches are played on a game server, unless none of them has room
+    if (!player1.peerMatch && coordinator && coordinator->assign(player1, player2))
+    {
+        return;
+    }
 
-    // Create and send match notification for player 1
-    std::vector<uint8_t> packet1 = createMatchNotificationPacket(player1, player2);
-    networkManager->sendToClient(player1.address, player1.udpPort, packet1);
+    hostMatch(player1, player2);
+}
 
-    // Create and send match notification for player 2
-    std::vector<uint8_t> packet2 = createMatchNotificationPacket(player2, player1);
-    networkManager->sendToClient(player2.address, player2.udpPort, packet2);
+void Matchmaker::hostMatch(const PlayerInfo &player1, const PlayerInfo &player2)
+{
+    // Peers simulate the match themselves from a shared seed, there is no game here to create
+    uint32_t gameId = 0;
+    uint32_t seed = 0;
+    if (player1.peerMatch)
+    {
+        seed = rand();
+    }
+    else
+    {
+        // not starting the game to desync it a bit
+        gameId = gameManager->createGame(player1.clientId, player2.clientId, player1.username, player2.username, false,
+                                         player1.variant);
+    }
 
-    std::cout << "Sent match notifications to both players" << std::endl;
+    sendMatchNotifications(player1, player2, seed, "", 0);
 
     if (GameInstance *game = gameManager->getGame(gameId))
     {
-        std::thread([gameId, this] {
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+        game->scheduleStart(std::chrono::steady_clock::now() + std::chrono::milliseconds(MATCH_START_DELAY_MS));
+    }
+}
+
+void Matchmaker::handOverMatch(const PlayerInfo &player1, const PlayerInfo &player2, const std::string &serverAddress,
+                               uint16_t serverPort)
+{
+    sendMatchNotifications(player1, player2, 0, serverAddress, serverPort);
+
+    // Keepalives and timeouts are the game server's business from here on
+    for (const PlayerInfo *player : {&player1, &player2})
+    {
+        deregisterPlayer(player->username);
+        networkManager->releaseClient(player->clientId);
+    }
+}
 
-            // Re-acquire the game pointer after delay
-            if (GameInstance *gameAfterDelay = gameManager->getGame(gameId))
+bool Matchmaker::adoptMatch(const PlayerInfo &player1, const PlayerInfo &player2, uint32_t matchId)
+{
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for (const PlayerInfo *player : {&player1, &player2})
+        {
+            if (activePlayersByUsername.count(player->username) || activePlayersByClientId.count(player->clientId))
             {
-                gameAfterDelay->startGame();
+                std::cerr << "Player already registered: " << player->username << std::endl;
+                return false;
             }
-        }).detach();
+        }
+        for (const PlayerInfo *player : {&player1, &player2})
+        {
+            activePlayersByUsername[player->username] = *player;
+            activePlayersByClientId[player->clientId] = *player;
+        }
     }
+
+    networkManager->addPlayerClient(player1.clientId, player1.address, player1.udpPort, 1);
+    networkManager->addPlayerClient(player2.clientId, player2.address, player2.udpPort, 2);
+
+    uint32_t gameId = gameManager->createGame(player1.clientId, player2.clientId, player1.username, player2.username,
+                                              false, player1.variant, matchId);
+    if (GameInstance *game = gameManager->getGame(gameId))
+    {
+        game->scheduleStart(std::chrono::steady_clock::now() + std::chrono::milliseconds(MATCH_START_DELAY_MS));
+    }
+
+    std::cout << "Hosting " << player1.username << " vs " << player2.username << " as game " << gameId << ", "
+              << variantName(player1.variant) << std::endl;
+    return true;
 }
 
-std::string Matchmaker::getPlayer1Name()
+void Matchmaker::sendMatchNotifications(const PlayerInfo &player1, const PlayerInfo &player2, uint32_t seed,
+                                        const std::string &gameServerAddress, uint16_t gameServerPort)
 {
-    std::lock_guard<std::mutex> lock(playersMutex);
-    return currentPlayer1;
+    // Tokens keep anyone who only knows the room number out of it
+    uint32_t chatRoom = 0;
+    uint32_t chatToken1 = 0;
+    uint32_t chatToken2 = 0;
+    if (chatRelay)
+    {
+        std::random_device random;
+        chatRoom = nextChatRoom++;
+        chatToken1 = random();
+        chatToken2 = random();
+        chatRelay->openRoom(chatRoom, player1.username, chatToken1, player2.username, chatToken2);
+    }
+
+    // Create and send match notification for player 1
+    std::vector<uint8_t> packet1 = createMatchNotificationPacket(player1, player2, seed, chatRoom, chatToken1,
+                                                                 gameServerAddress, gameServerPort);
+    networkManager->sendToClient(player1.address, player1.udpPort, packet1);
+
+    // Create and send match notification for player 2
+    std::vector<uint8_t> packet2 = createMatchNotificationPacket(player2, player1, seed, chatRoom, chatToken2,
+                                                                 gameServerAddress, gameServerPort);
+    networkManager->sendToClient(player2.address, player2.udpPort, packet2);
+
+    std::cout << "Sent match notifications to both players" << std::endl;
 }
 
-std::string Matchmaker::getPlayer2Name()
+std::string Matchmaker::getUsernameForClient(const std::string &clientId)
 {
-    std::lock_guard<std::mutex> lock(playersMutex);
-    return currentPlayer2;
+    std::lock_guard<std::mutex> lock(queueMutex);
+    auto it = activePlayersByClientId.find(clientId);
+    return (it != activePlayersByClientId.end()) ? it->second.username : clientId;
 }
 
 void Matchmaker::deregisterPlayer(const std::string &username)
@@ -222,17 +326,6 @@ void Matchmaker::deregisterPlayer(const std::string &username)
     activePlayersByUsername.erase(usernameIt); // Erase by iterator to avoid rehashing
     activePlayersByClientId.erase(clientId);   // Now safe to erase from the other map
 
-    // Check if this was one of the current players
-    std::lock_guard<std::mutex> plock(playersMutex);
-    if (username == currentPlayer1)
-    {
-        currentPlayer1.clear();
-    }
-    if (username == currentPlayer2)
-    {
-        currentPlayer2.clear();
-    }
-
     // Remove from waiting queue if present
     std::queue<PlayerInfo> tempQueue;
     while (!waitingPlayers.empty())
@@ -247,32 +340,11 @@ void Matchmaker::deregisterPlayer(const std::string &username)
     waitingPlayers = tempQueue;
 }
 
-void Matchmaker::handlePlayerDisconnect(const std::string &clientId, bool updateMMR)
+void Matchmaker::handlePlayerDisconnect(const std::string &clientId)
 {
     std::lock_guard<std::mutex> lock(queueMutex);
 
     auto it = activePlayersByClientId.find(clientId);
-    if (updateMMR && it != activePlayersByClientId.end())
-    {
-        std::string user = it->second.username;
-
-        std::cout << "Handling disconnect of " << user << "in Matchmaker" << std::endl;
-        std::string winner;
-        {
-            std::lock_guard<std::mutex> lock(playersMutex);
-            if (user == currentPlayer1)
-                winner = currentPlayer2;
-            else if (user == currentPlayer2)
-                winner = currentPlayer1;
-        }
-
-        if (!winner.empty())
-        {
-            this->updateMMR(winner, user);
-            std::cout << "MMR updated due to disconnect: " << winner << " beat " << user << std::endl;
-        }
-    }
-
     if (it != activePlayersByClientId.end())
     {
         const std::string &username = it->second.username;
@@ -293,17 +365,6 @@ void Matchmaker::handlePlayerDisconnect(const std::string &clientId, bool update
         {
             std::cout << "Didnt erase " << clientId << " from in memory db\n";
         }
-
-        // Check if this was one of the current players
-        std::lock_guard<std::mutex> plock(playersMutex);
-        if (username == currentPlayer1)
-        {
-            currentPlayer1.clear();
-        }
-        if (username == currentPlayer2)
-        {
-            currentPlayer2.clear();
-        }
     }
 
     // Remove from waiting queue if present
@@ -320,7 +381,92 @@ void Matchmaker::handlePlayerDisconnect(const std::string &clientId, bool update
     waitingPlayers = tempQueue;
 }
 
-std::vector<uint8_t> Matchmaker::createMatchNotificationPacket(const PlayerInfo &player, const PlayerInfo &opponent)
+std::vector<std::string> Matchmaker::takeWaitingPlayers()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    std::vector<std::string> clientIds;
+    while (!waitingPlayers.empty())
+    {
+        const PlayerInfo &player = waitingPlayers.front();
+        clientIds.push_back(player.clientId);
+        activePlayersByUsername.erase(player.username);
+        activePlayersByClientId.erase(player.clientId);
+        waitingPlayers.pop();
+    }
+    return clientIds;
+}
+
+static void writePlayer(HandoffWriter &out, const PlayerInfo &player)
+{
+    out.str(player.username);
+    out.str(player.clientId);
+    out.str(player.address);
+    out.u16(player.udpPort);
+    out.u16(player.tcpPort);
+    out.u32(player.mmr);
+    out.u8(player.peerMatch);
+    out.u8(static_cast<uint8_t>(player.variant));
+}
+
+static PlayerInfo readPlayer(HandoffReader &in)
+{
+    PlayerInfo player;
+    player.username = in.str();
+    player.clientId = in.str();
+    player.address = in.str();
+    player.udpPort = in.u16();
+    player.tcpPort = in.u16();
+    player.mmr = in.u32();
+    player.peerMatch = in.u8() != 0;
+    player.variant = static_cast<GameVariant>(in.u8());
+    return player;
+}
+
+void Matchmaker::exportState(HandoffWriter &out)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+
+    out.u32(activePlayersByClientId.size());
+    for (const auto &[clientId, player] : activePlayersByClientId)
+    {
+        writePlayer(out, player);
+    }
+
+    std::queue<PlayerInfo> queue = waitingPlayers;
+    out.u32(queue.size());
+    while (!queue.empty())
+    {
+        writePlayer(out, queue.front());
+        queue.pop();
+    }
+}
+
+void Matchmaker::importState(HandoffReader &in)
+{
+    // The old process kept rating matches after the file was first mapped here, index it again
+    loadMMR();
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+
+    uint32_t activeCount = in.u32();
+    for (uint32_t i = 0; i < activeCount && in.ok(); ++i)
+    {
+        PlayerInfo player = readPlayer(in);
+        activePlayersByUsername[player.username] = player;
+        activePlayersByClientId[player.clientId] = player;
+    }
+
+    uint32_t waitingCount = in.u32();
+    for (uint32_t i = 0; i < waitingCount && in.ok(); ++i)
+    {
+        waitingPlayers.push(readPlayer(in));
+    }
+}
+
+std::vector<uint8_t> Matchmaker::createMatchNotificationPacket(const PlayerInfo &player, const PlayerInfo &opponent,
+                                                                uint32_t seed, uint32_t chatRoom, uint32_t chatToken,
+                                                                const std::string &gameServerAddress,
+                                                                uint16_t gameServerPort)
 {
     // Create response structure
     ConnectResponse response;
@@ -331,10 +477,17 @@ std::vector<uint8_t> Matchmaker::createMatchNotificationPacket(const PlayerInfo
 
     response.hostUdpPort = opponent.udpPort;
     response.hostTcpPort = opponent.tcpPort;
-    response.mmr = mmrMap[opponent.username];
+    response.mmr = leaderboard.getRating(opponent.username);
 
     // Arbitrary player order determination
     response.isPlayer1 = (player.username < opponent.username);
+    response.peerMatch = player.peerMatch && opponent.peerMatch;
+    response.seed = seed;
+    response.variant = static_cast<uint8_t>(player.variant);
+    response.chatRoom = chatRoom;
+    response.chatToken = chatToken;
+    strncpy(response.gameServerAddress, gameServerAddress.c_str(), sizeof(response.gameServerAddress) - 1);
+    response.gameServerPort = gameServerPort;
 
     response.success = true;
 
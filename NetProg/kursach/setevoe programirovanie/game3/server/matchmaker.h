@@ -3,6 +3,9 @@
 #include "../common/network.h"
 #include "game_instance.h"
 #include "game_manager.h"
+#include "handoff.h"
+#include "leaderboard.h"
+#include <chrono>
 #include <fstream>
 #include <map>
 #include <mutex>
@@ -18,6 +21,9 @@ namespace pong
 class NetworkManager;
 class GameInstance;
 class GameManager;
+class ChatRelay;
+class ClusterCoordinator;
+class ClusterMember;
 
 struct PlayerInfo
 {
@@ -27,6 +33,10 @@ struct PlayerInfo
     uint16_t udpPort;
     uint16_t tcpPort; // For direct player-to-player chat
     uint32_t mmr;
+    bool peerMatch = false; // Wants a peer-to-peer match, the server only pairs and introduces
+    GameVariant variant = GameVariant::CLASSIC;
+    // Match tolerances widen with time in queue. A handoff restarts the wait.
+    std::chrono::steady_clock::time_point queuedAt = std::chrono::steady_clock::now();
 };
 
 class Matchmaker
@@ -46,6 +56,23 @@ class Matchmaker
         this->gameManager = manager;
     }
 
+    // With a relay, match chat goes through the server instead of player to player
+    void setChatRelay(ChatRelay *relay)
+    {
+        this->chatRelay = relay;
+    }
+
+    // Cluster mode: a coordinator sends rated matches to game servers, a game server reports results
+    // instead of rating them
+    void setClusterCoordinator(ClusterCoordinator *coordinator)
+    {
+        this->coordinator = coordinator;
+    }
+    void setClusterMember(ClusterMember *member)
+    {
+        this->clusterMember = member;
+    }
+
     // Player management
     uint8_t registerPlayer(const PlayerInfo &player);
     void deregisterPlayer(const std::string &username);
@@ -55,39 +82,61 @@ class Matchmaker
 
     // Match notification
     void notifyPlayersAboutMatch(const PlayerInfo &player1, const PlayerInfo &player2);
-
-    std::string getPlayer1Name();
-    std::string getPlayer2Name();
-
-    void handlePlayerDisconnect(const std::string &clientId, bool updateMMR);
-
-    std::unordered_map<std::string, int> mmrMap; // username/mmr
-    const std::string mmrFile = "ratings.csv";
+    // Creates the game here and tells both players
+    void hostMatch(const PlayerInfo &player1, const PlayerInfo &player2);
+    // Coordinator: tells both players to play on another server and forgets them
+    void handOverMatch(const PlayerInfo &player1, const PlayerInfo &player2, const std::string &serverAddress,
+                       uint16_t serverPort);
+    // Game server: hosts a match the coordinator paired, player1 is the one told isPlayer1
+    bool adoptMatch(const PlayerInfo &player1, const PlayerInfo &player2, uint32_t matchId);
+
+    std::string getUsernameForClient(const std::string &clientId);
+
+    // Forgets the player. A match it leaves is rated by its GameInstance, not here.
+    void handlePlayerDisconnect(const std::string &clientId);
+
+    // Drain: empties the queue and returns the client IDs that were waiting
+    std::vector<std::string> takeWaitingPlayers();
+
+    // Hot restart. Ratings are not part of it, the new process maps ratingsFile itself.
+    void exportState(HandoffWriter &out);
+    void importState(HandoffReader &in);
+
+    Leaderboard leaderboard;
+    const std::string ratingsFile = "ratings.db";
+    const std::string legacyRatingsFile = "ratings.csv"; // Imported once if ratingsFile is new
+    // Not from the constructor, a game server in a cluster leaves the file to its coordinator
     void loadMMR();
-    void saveMMR();
-    void updateMMR(const std::string &winner, const std::string &loser);
+    // `matchId` is the coordinator's, a game server in a cluster reports the result under it
+    void updateMMR(const std::string &winner, const std::string &loser, uint32_t matchId = 0);
 
   private:
     // Find a match among waiting players
     bool findMatch(PlayerInfo &player1, PlayerInfo &player2);
 
+    // Opens a chat room if there is a relay and sends both players their match notification
+    void sendMatchNotifications(const PlayerInfo &player1, const PlayerInfo &player2, uint32_t seed,
+                                const std::string &gameServerAddress, uint16_t gameServerPort);
+
     // Create match notification packet
-    std::vector<uint8_t> createMatchNotificationPacket(const PlayerInfo &player, const PlayerInfo &opponent);
+    std::vector<uint8_t> createMatchNotificationPacket(const PlayerInfo &player, const PlayerInfo &opponent,
+                                                       uint32_t seed, uint32_t chatRoom, uint32_t chatToken,
+                                                       const std::string &gameServerAddress, uint16_t gameServerPort);
 
     // Queue and matching data
     std::mutex queueMutex;
-    std::mutex playersMutex;
     std::queue<PlayerInfo> waitingPlayers;
 
     std::unordered_map<std::string, PlayerInfo> activePlayersByUsername;
     std::unordered_map<std::string, PlayerInfo> activePlayersByClientId;
 
-    std::string currentPlayer1;
-    std::string currentPlayer2;
-
     // Reference to the network manager for sending packets
     NetworkManager *networkManager;
     GameManager *gameManager;
+    ChatRelay *chatRelay = nullptr;
+    uint32_t nextChatRoom = 1;
+    ClusterCoordinator *coordinator = nullptr;
+    ClusterMember *clusterMember = nullptr;
 };
 
 } // namespace pong
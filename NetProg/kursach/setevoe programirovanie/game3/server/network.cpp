@@ -1,8 +1,13 @@
 // server/network.cpp
 #include "network.h"
+#include "cluster.h"
 #include "matchmaker.h"
+#include "trace.h"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -11,9 +16,22 @@
 namespace pong
 {
 
-NetworkManager::NetworkManager() : udpSocket(-1), running(false), matchmaker(nullptr), gameManager(nullptr)
+static uint32_t currentTimeSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint64_t steadyTimeUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+NetworkManager::NetworkManager()
+    : udpSocket(-1), running(false), draining(false), matchmaker(nullptr), gameManager(nullptr)
 {
-    lastUpdate = std::chrono::steady_clock::now();
     lastCleanupTime = std::chrono::steady_clock::now();
 }
 
@@ -42,6 +60,11 @@ bool NetworkManager::startServer(uint16_t port)
         return false;
     }
 
+    // Spectator fan-out and keepalive replies come in bursts, give the kernel room to queue them
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(udpSocket, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(udpSocket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
     // Bind to port
     sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
@@ -68,6 +91,92 @@ bool NetworkManager::startServer(uint16_t port)
     return true;
 }
 
+bool NetworkManager::adoptSocket(int socket)
+{
+    udpSocket = socket;
+
+    int flags = fcntl(udpSocket, F_GETFL, 0);
+    fcntl(udpSocket, F_SETFL, flags | O_NONBLOCK);
+
+    running = true;
+    receiveThread = std::thread(&NetworkManager::receiveLoop, this);
+
+    std::cout << "UDP Server took over inherited socket" << std::endl;
+    return true;
+}
+
+void NetworkManager::stopReceiving()
+{
+    running = false;
+    if (receiveThread.joinable())
+    {
+        receiveThread.join();
+    }
+}
+
+void NetworkManager::resumeReceiving()
+{
+    if (udpSocket < 0 || receiveThread.joinable())
+        return;
+
+    running = true;
+    receiveThread = std::thread(&NetworkManager::receiveLoop, this);
+}
+
+void NetworkManager::startDrain()
+{
+    if (draining.exchange(true))
+        return;
+
+    std::cout << "Draining: no new players, waiting for running games to finish" << std::endl;
+
+    std::vector<uint8_t> packet = createPacket(MessageType::DISCONNECT_EVENT, 0, nullptr, 0);
+    for (const std::string &clientId : matchmaker->takeWaitingPlayers())
+    {
+        sendToClient(clientId, packet);
+        removeClient(clientId);
+    }
+}
+
+void NetworkManager::exportState(HandoffWriter &out)
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    out.u32(clients.size());
+    for (const ConnectedClient &client : clients)
+    {
+        out.str(client.clientId);
+        out.u8(client.playerId);
+        out.str(client.address);
+        out.u16(client.port);
+        out.u32(client.spectatingGameId);
+    }
+}
+
+void NetworkManager::importState(HandoffReader &in)
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count && in.ok(); ++i)
+    {
+        // Link stats start over, the handoff gap should not count as idle time
+        ConnectedClient client;
+        client.clientId = in.str();
+        client.playerId = in.u8();
+        client.address = in.str();
+        client.port = in.u16();
+        client.spectatingGameId = in.u32();
+        client.lastActivityTime = currentTimeSeconds();
+        client.pingSequence = 0;
+        client.pongSequence = 0;
+        client.rttMs = -1.0f;
+        client.rttJitterMs = 0.0f;
+        client.lossRate = 0.0f;
+
+        clients.push_back(client);
+        clientIdToIndex[client.clientId] = clients.size() - 1;
+    }
+}
+
 void NetworkManager::shutdown()
 {
     running = false;
@@ -90,24 +199,43 @@ void NetworkManager::receiveLoop()
     std::vector<uint8_t> buffer(bufferSize);
     sockaddr_in senderAddr{};
     socklen_t senderLen = sizeof(senderAddr);
+    auto lastEviction = std::chrono::steady_clock::now();
 
     while (running)
     {
+        // Disconnects tear down games, which only this thread may do. Checked per packet so a busy socket
+        // does not postpone it.
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastEviction >= std::chrono::milliseconds(PING_INTERVAL_MS))
+        {
+            evictIdleClients();
+            lastEviction = now;
+        }
+
         // Receive data
         senderLen = sizeof(senderAddr);
         ssize_t bytesReceived = recvfrom(udpSocket, buffer.data(), bufferSize, 0, (sockaddr *)&senderAddr, &senderLen);
 
         if (bytesReceived > 0)
         {
-            // Process valid packets
+            // Junk and floods stop here, before the copy and without a log line each
+            if (admission.admit(buffer.data(), bytesReceived, senderAddr) == Admission::DROP)
+            {
+                continue;
+            }
+
+            // Process valid packets, and keep draining while there are more queued
+            TRACE_ZONE("NetworkManager::handlePacket");
             std::vector<uint8_t> packetData(buffer.begin(), buffer.begin() + bytesReceived);
             handlePacket(packetData, senderAddr);
+            continue;
         }
         else if (bytesReceived < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
         {
             // Only log actual errors, not would-block conditions
             perror("Error receiving data");
         }
+        admission.report();
 
         // Small sleep to prevent CPU hogging in the loop
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -127,6 +255,16 @@ void NetworkManager::handlePacket(const std::vector<uint8_t> &data, const sockad
     const NetworkHeader *header = reinterpret_cast<const NetworkHeader *>(data.data());
     std::string clientId = getClientIdentifier(sender);
 
+    // Any packet from a known client counts as a sign of life
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        auto it = clientIdToIndex.find(clientId);
+        if (it != clientIdToIndex.end())
+        {
+            clients[it->second].lastActivityTime = currentTimeSeconds();
+        }
+    }
+
     // Handle packet based on message type
     switch (header->type)
     {
@@ -138,6 +276,29 @@ void NetworkManager::handlePacket(const std::vector<uint8_t> &data, const sockad
         handlePlayerInput(data, clientId);
         break;
 
+    case MessageType::INPUT_BATCH:
+        handleInputBatch(data, clientId);
+        break;
+
+    case MessageType::PONG:
+        handlePong(data, clientId);
+        break;
+
+    case MessageType::SPECTATE_REQUEST:
+        handleSpectateRequest(data, sender);
+        break;
+
+    case MessageType::LEADERBOARD_REQUEST:
+        handleLeaderboardRequest(data, sender);
+        break;
+
+    case MessageType::SERVER_HELLO:
+    case MessageType::MATCH_ASSIGN:
+    case MessageType::MATCH_ASSIGNED:
+    case MessageType::MATCH_RESULT:
+        handleClusterMessage(data, sender);
+        break;
+
     default:
         std::cerr << "Received unhandled message type: " << static_cast<int>(header->type) << std::endl;
         break;
@@ -161,9 +322,30 @@ void NetworkManager::handleConnectRequest(const std::vector<uint8_t> &data, cons
     std::string clientAddr = inet_ntoa(sender.sin_addr);
     uint16_t clientPort = ntohs(sender.sin_port);
 
+    // Stateless handshake: nothing is kept for a request until it comes back with the cookie sent to its
+    // source address, so spoofed sources never get a player registered
+    if (!admission.checkConnectCookie(sender, request->cookie))
+    {
+        ConnectChallenge challenge{admission.connectCookie(sender)};
+        std::vector<uint8_t> packet = createPacket(MessageType::CONNECT_CHALLENGE, 0, &challenge, sizeof(challenge));
+        sendto(udpSocket, packet.data(), packet.size(), 0, (const sockaddr *)&sender, sizeof(sender));
+        return;
+    }
+
     std::cout << "Received connection request from " << request->username << " at " << clientAddr << ":" << clientPort
               << std::endl;
 
+    // A game server in a cluster only hosts what the coordinator pairs
+    if (draining || clusterMember)
+    {
+        // Declined, same as a duplicate login
+        ConnectResponse response;
+        memset(&response, 0, sizeof(response));
+        std::vector<uint8_t> packet = createPacket(MessageType::CONNECT_RESPONSE, 0, &response, sizeof(response));
+        sendToClient(clientAddr, request->udpPort, packet);
+        return;
+    }
+
     // Create player info for matchmaking
     PlayerInfo player;
     player.username = request->username;
@@ -172,6 +354,9 @@ void NetworkManager::handleConnectRequest(const std::vector<uint8_t> &data, cons
     player.udpPort = request->udpPort; // Client's listening port
     player.tcpPort = request->tcpPort; // For direct chat
     player.mmr = request->mmr;
+    player.peerMatch = request->peerMatch;
+    player.variant = request->variant < static_cast<uint8_t>(GameVariant::COUNT) ? static_cast<GameVariant>(request->variant)
+                                                                                  : GameVariant::CLASSIC;
 
     // Register player with matchmaker
     uint8_t playerId = 0;
@@ -191,9 +376,7 @@ void NetworkManager::handleConnectRequest(const std::vector<uint8_t> &data, cons
         if (it != clientIdToIndex.end())
         {
             // Update existing client
-            clients[it->second].lastActivityTime =
-                std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
-                    .count();
+            clients[it->second].lastActivityTime = currentTimeSeconds();
         }
         else
         {
@@ -203,9 +386,13 @@ void NetworkManager::handleConnectRequest(const std::vector<uint8_t> &data, cons
             newClient.playerId = playerId;
             newClient.address = clientAddr;
             newClient.port = request->udpPort; // Use client's listening port, not the source port
-            newClient.lastActivityTime =
-                std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
-                    .count();
+            newClient.lastActivityTime = currentTimeSeconds();
+            newClient.pingSequence = 0;
+            newClient.pongSequence = 0;
+            newClient.rttMs = -1.0f;
+            newClient.rttJitterMs = 0.0f;
+            newClient.lossRate = 0.0f;
+            newClient.spectatingGameId = 0;
 
             clients.push_back(newClient);
             clientIdToIndex[clientId] = clients.size() - 1;
@@ -244,23 +431,37 @@ void NetworkManager::handlePlayerInput(const std::vector<uint8_t> &data, const s
 
     // Find player ID from client ID
     uint8_t playerId = 0;
+    uint32_t spectatingGameId = 0;
     {
         std::lock_guard<std::mutex> lock(clientsMutex);
         auto it = clientIdToIndex.find(clientId);
         if (it != clientIdToIndex.end())
         {
             playerId = clients[it->second].playerId;
-            // Update last activity time
-            clients[it->second].lastActivityTime =
-                std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
-                    .count();
+            spectatingGameId = clients[it->second].spectatingGameId;
         }
     }
 
+    // Spectators only ever send QUIT
+    if (spectatingGameId != 0)
+    {
+        if (input->flags & InputFlags::QUIT)
+        {
+            handleClientDisconnect(clientId, false);
+        }
+        return;
+    }
+
     // Find which game this client is in
     uint32_t gameId = gameManager->findGameIdForClient(clientId);
     if (gameId == 0)
     {
+        // Peer match players have no game here, they only say when they are done
+        if (input->flags & InputFlags::QUIT)
+        {
+            handleClientDisconnect(clientId, false);
+            return;
+        }
         std::cerr << "Client not in any game: " << clientId << std::endl;
         return;
     }
@@ -282,6 +483,345 @@ void NetworkManager::handlePlayerInput(const std::vector<uint8_t> &data, const s
     }
 }
 
+void NetworkManager::handleInputBatch(const std::vector<uint8_t> &data, const std::string &clientId)
+{
+    const size_t headerSize = sizeof(NetworkHeader) + offsetof(InputBatch, events);
+    if (data.size() < headerSize)
+    {
+        std::cerr << "Input batch packet too small" << std::endl;
+        return;
+    }
+
+    InputBatch batch;
+    memcpy(&batch, data.data() + sizeof(NetworkHeader), offsetof(InputBatch, events));
+    if (batch.count > INPUT_BATCH_SIZE || data.size() < headerSize + batch.count * sizeof(InputEvent))
+    {
+        std::cerr << "Input batch truncated" << std::endl;
+        return;
+    }
+    memcpy(batch.events, data.data() + headerSize, batch.count * sizeof(InputEvent));
+
+    uint8_t playerId = 0;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        auto it = clientIdToIndex.find(clientId);
+        if (it == clientIdToIndex.end() || clients[it->second].spectatingGameId != 0)
+        {
+            return;
+        }
+        playerId = clients[it->second].playerId;
+    }
+
+    uint32_t gameId = gameManager->findGameIdForClient(clientId);
+    GameInstance *game = gameId != 0 ? gameManager->getGame(gameId) : nullptr;
+    if (!game)
+    {
+        std::cerr << "Client not in any game: " << clientId << std::endl;
+        return;
+    }
+
+    game->addPlayerInputs(playerId, batch.events, batch.count);
+}
+
+void NetworkManager::handlePong(const std::vector<uint8_t> &data, const std::string &clientId)
+{
+    if (data.size() < sizeof(NetworkHeader) + sizeof(PingData))
+    {
+        return;
+    }
+
+    const PingData *pong = reinterpret_cast<const PingData *>(data.data() + sizeof(NetworkHeader));
+    uint64_t now = steadyTimeUs();
+    if (pong->sendTimeUs > now)
+    {
+        return;
+    }
+    float sampleMs = (now - pong->sendTimeUs) / 1000.0f;
+
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto it = clientIdToIndex.find(clientId);
+    if (it == clientIdToIndex.end())
+    {
+        return;
+    }
+
+    // RFC 6298 smoothing: SRTT gain 1/8, RTTVAR gain 1/4
+    ConnectedClient &client = clients[it->second];
+    client.pongSequence = std::max(client.pongSequence, pong->sequence);
+    if (client.rttMs < 0)
+    {
+        client.rttMs = sampleMs;
+        client.rttJitterMs = sampleMs / 2.0f;
+    }
+    else
+    {
+        client.rttJitterMs = 0.75f * client.rttJitterMs + 0.25f * std::fabs(client.rttMs - sampleMs);
+        client.rttMs = 0.875f * client.rttMs + 0.125f * sampleMs;
+    }
+}
+
+float NetworkManager::getClientRtt(const std::string &clientId)
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto it = clientIdToIndex.find(clientId);
+    if (it == clientIdToIndex.end())
+    {
+        return -1.0f;
+    }
+    return clients[it->second].rttMs;
+}
+
+bool NetworkManager::getClientLinkStats(const std::string &clientId, LinkStats &stats)
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto it = clientIdToIndex.find(clientId);
+    if (it == clientIdToIndex.end())
+    {
+        return false;
+    }
+    const ConnectedClient &client = clients[it->second];
+    stats = {client.rttMs, client.rttJitterMs, client.lossRate};
+    return true;
+}
+
+void NetworkManager::getClientLinkStats(const std::vector<std::string> &clientIds, std::vector<LinkStats> &stats)
+{
+    stats.clear();
+    stats.reserve(clientIds.size());
+
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    for (const std::string &clientId : clientIds)
+    {
+        auto it = clientIdToIndex.find(clientId);
+        if (it == clientIdToIndex.end())
+        {
+            stats.push_back({-1.0f, 0.0f, 0.0f});
+            continue;
+        }
+        const ConnectedClient &client = clients[it->second];
+        stats.push_back({client.rttMs, client.rttJitterMs, client.lossRate});
+    }
+}
+
+void NetworkManager::sendKeepalives()
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+
+    PingData ping{};
+    ping.sendTimeUs = steadyTimeUs();
+    for (ConnectedClient &client : clients)
+    {
+        // The previous ping had a whole interval to come back
+        if (client.pingSequence > 0)
+        {
+            float lost = (client.pongSequence >= client.pingSequence) ? 0.0f : 1.0f;
+            client.lossRate = 0.875f * client.lossRate + 0.125f * lost;
+        }
+
+        ping.sequence = ++client.pingSequence;
+        std::vector<uint8_t> packet = createPacket(MessageType::PING, 0, &ping, sizeof(ping));
+        sendToClient(client.address, client.port, packet);
+    }
+}
+
+void NetworkManager::evictIdleClients()
+{
+    uint32_t now = currentTimeSeconds();
+
+    std::vector<std::string> idleClients;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for (const ConnectedClient &client : clients)
+        {
+            if (now > client.lastActivityTime && now - client.lastActivityTime > CLIENT_TIMEOUT_SECONDS)
+            {
+                idleClients.push_back(client.clientId);
+            }
+        }
+    }
+
+    std::vector<uint8_t> packet = createPacket(MessageType::DISCONNECT_EVENT, 0, nullptr, 0);
+    for (const std::string &clientId : idleClients)
+    {
+        {
+            // May already be gone as the opponent of a previously evicted client
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            if (clientIdToIndex.find(clientId) == clientIdToIndex.end())
+            {
+                continue;
+            }
+        }
+
+        std::cout << "Client " << clientId << " timed out" << std::endl;
+        sendToClient(clientId, packet);
+        handleClientDisconnect(clientId, true);
+    }
+}
+
+void NetworkManager::handleSpectateRequest(const std::vector<uint8_t> &data, const sockaddr_in &sender)
+{
+    if (data.size() < sizeof(NetworkHeader) + sizeof(SpectateRequest))
+    {
+        return;
+    }
+
+    const SpectateRequest *request = reinterpret_cast<const SpectateRequest *>(data.data() + sizeof(NetworkHeader));
+    std::string clientId = getClientIdentifier(sender);
+    std::string clientAddr = inet_ntoa(sender.sin_addr);
+
+    SpectateResponse response;
+    memset(&response, 0, sizeof(response));
+
+    uint32_t gameId = gameManager ? gameManager->findSpectatableGame(request->gameId) : 0;
+    GameInstance *game = gameId ? gameManager->getGame(gameId) : nullptr;
+
+    bool known = false;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        known = clientIdToIndex.find(clientId) != clientIdToIndex.end();
+    }
+
+    // Players cannot watch, and a spectator has to leave before switching games
+    if (game && !known)
+    {
+        ConnectedClient spectator;
+        spectator.clientId = clientId;
+        spectator.playerId = 0;
+        spectator.address = clientAddr;
+        spectator.port = request->udpPort;
+        spectator.lastActivityTime = currentTimeSeconds();
+        spectator.pingSequence = 0;
+        spectator.pongSequence = 0;
+        spectator.rttMs = -1.0f;
+        spectator.rttJitterMs = 0.0f;
+        spectator.lossRate = 0.0f;
+        spectator.spectatingGameId = gameId;
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.push_back(spectator);
+            clientIdToIndex[clientId] = clients.size() - 1;
+        }
+
+        sockaddr_in address = sender;
+        address.sin_port = htons(request->udpPort);
+        game->addSpectator(clientId, address);
+
+        std::vector<std::string> players = game->getAllPlayers();
+        std::string player1 = matchmaker ? matchmaker->getUsernameForClient(players[0]) : players[0];
+        std::string player2 = matchmaker ? matchmaker->getUsernameForClient(players[1]) : players[1];
+        strncpy(response.player1Name, player1.c_str(), sizeof(response.player1Name) - 1);
+        strncpy(response.player2Name, player2.c_str(), sizeof(response.player2Name) - 1);
+        response.success = true;
+        response.gameId = gameId;
+
+        std::cout << "Spectator " << clientId << " joined game " << gameId << " (" << game->getSpectatorCount()
+                  << " watching)" << std::endl;
+    }
+
+    std::vector<uint8_t> packet = createPacket(MessageType::SPECTATE_RESPONSE, 0, &response, sizeof(response));
+    sendToClient(clientAddr, request->udpPort, packet);
+}
+
+void NetworkManager::handleLeaderboardRequest(const std::vector<uint8_t> &data, const sockaddr_in &sender)
+{
+    if (data.size() < sizeof(NetworkHeader) + sizeof(LeaderboardRequest) || !matchmaker)
+    {
+        return;
+    }
+
+    LeaderboardRequest request;
+    memcpy(&request, data.data() + sizeof(NetworkHeader), sizeof(request));
+    request.username[sizeof(request.username) - 1] = '\0';
+    uint32_t count = std::min<uint32_t>(request.count, LEADERBOARD_PAGE_SIZE);
+
+    Leaderboard &leaderboard = matchmaker->leaderboard;
+    std::vector<LeaderboardEntry> entries;
+    LeaderboardResponse response;
+    memset(&response, 0, sizeof(response));
+
+    if (request.query == LeaderboardQuery::AROUND)
+    {
+        // The player's own row is one of the `count`, the neighbors split the rest with any odd one below
+        if (count > 0)
+        {
+            uint32_t above = (count - 1) / 2;
+            entries = leaderboard.around(request.username, above, count - 1 - above);
+        }
+        response.playerRank = leaderboard.getRank(request.username);
+    }
+    else
+    {
+        entries = leaderboard.top(request.offset, count);
+    }
+
+    response.totalPlayers = leaderboard.size();
+    response.count = std::min<size_t>(entries.size(), LEADERBOARD_PAGE_SIZE);
+    std::copy(entries.begin(), entries.begin() + response.count, response.entries);
+
+    std::vector<uint8_t> packet = createPacket(MessageType::LEADERBOARD_RESPONSE, 0, &response, sizeof(response));
+    sendToClient(inet_ntoa(sender.sin_addr), request.udpPort, packet);
+}
+
+void NetworkManager::handleClusterMessage(const std::vector<uint8_t> &data, const sockaddr_in &sender)
+{
+    // Admission has already matched the payload size to the type
+    const NetworkHeader *header = reinterpret_cast<const NetworkHeader *>(data.data());
+    const uint8_t *payload = data.data() + sizeof(NetworkHeader);
+
+    if (coordinator && header->type == MessageType::SERVER_HELLO)
+    {
+        ServerHello hello;
+        memcpy(&hello, payload, sizeof(hello));
+        coordinator->onServerHello(hello, sender);
+    }
+    else if (coordinator && header->type == MessageType::MATCH_ASSIGNED)
+    {
+        MatchAssigned assigned;
+        memcpy(&assigned, payload, sizeof(assigned));
+        coordinator->onMatchAssigned(assigned, sender);
+    }
+    else if (coordinator && header->type == MessageType::MATCH_RESULT)
+    {
+        MatchResult result;
+        memcpy(&result, payload, sizeof(result));
+        coordinator->onMatchResult(result, sender);
+    }
+    else if (clusterMember && header->type == MessageType::MATCH_ASSIGN)
+    {
+        MatchAssign assign;
+        memcpy(&assign, payload, sizeof(assign));
+        clusterMember->onMatchAssign(assign, sender);
+    }
+}
+
+void NetworkManager::addPlayerClient(const std::string &clientId, const std::string &address, uint16_t port,
+                                     uint8_t playerId)
+{
+    ConnectedClient client;
+    client.clientId = clientId;
+    client.playerId = playerId;
+    client.address = address;
+    client.port = port;
+    client.lastActivityTime = currentTimeSeconds();
+    client.pingSequence = 0;
+    client.pongSequence = 0;
+    client.rttMs = -1.0f;
+    client.rttJitterMs = 0.0f;
+    client.lossRate = 0.0f;
+    client.spectatingGameId = 0;
+
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    if (clientIdToIndex.find(clientId) != clientIdToIndex.end())
+        return;
+    clients.push_back(client);
+    clientIdToIndex[clientId] = clients.size() - 1;
+}
+
+void NetworkManager::releaseClient(const std::string &clientId)
+{
+    removeClient(clientId);
+}
+
 uint32_t NetworkManager::findGameIdForClient(const std::string &clientId)
 {
     if (gameManager)
@@ -293,6 +833,7 @@ uint32_t NetworkManager::findGameIdForClient(const std::string &clientId)
 
 void NetworkManager::handleClientDisconnect(const std::string &clientId, bool notifyOthers)
 {
+    uint32_t spectatingGameId = 0;
     {
         std::lock_guard<std::mutex> lock(clientsMutex);
         auto it = clientIdToIndex.find(clientId);
@@ -301,21 +842,32 @@ void NetworkManager::handleClientDisconnect(const std::string &clientId, bool no
             std::cout << "Cleint does not exist!\n";
             return;
         }
+        spectatingGameId = clients[it->second].spectatingGameId;
     }
 
-    if (notifyOthers)
-    { // primary disconnectee
-        matchmaker->handlePlayerDisconnect(clientId, true);
-    }
-    else
+    // Spectators only have to be dropped from their game's fan-out
+    if (spectatingGameId != 0)
     {
-        matchmaker->handlePlayerDisconnect(clientId, false);
+        if (GameInstance *watched = gameManager->getGame(spectatingGameId))
+        {
+            watched->removeSpectator(clientId);
+        }
+        removeClient(clientId);
+        return;
     }
 
+    matchmaker->handlePlayerDisconnect(clientId);
+
     // Get game info first before modifying any data structures
     uint32_t gameId = gameManager->findGameIdForClient(clientId);
     GameInstance *game = gameManager->getGame(gameId);
 
+    // The primary disconnectee loses a match still in play
+    if (notifyOthers && game)
+    {
+        game->forfeit(clientId);
+    }
+
     // Create disconnect packet once
     std::vector<uint8_t> packet = createPacket(MessageType::DISCONNECT_EVENT, 0, nullptr, 0);
 
@@ -340,31 +892,17 @@ void NetworkManager::handleClientDisconnect(const std::string &clientId, bool no
     }
 
     // Now remove the current client
-    {
-        std::lock_guard<std::mutex> lock(clientsMutex);
-        auto it = clientIdToIndex.find(clientId);
-        if (it == clientIdToIndex.end())
-            return;
-
-        const ConnectedClient &disconnected = clients[it->second];
-        std::cout << "Client " << clientId << " disconnected: " << disconnected.address << std::endl;
-
-        // Remove this client from list
-        clients.erase(clients.begin() + it->second);
-        clientIdToIndex.erase(it);
-
-        // Rebuild index
-        clientIdToIndex.clear();
-        for (size_t i = 0; i < clients.size(); ++i)
-        {
-            clientIdToIndex[clients[i].clientId] = i;
-        }
-    }
+    if (!removeClient(clientId))
+        return;
 
     // Handle game cleanup
     if (game)
     {
         game->stopGame();
+
+        // The match is over for its audience too
+        releaseSpectators(game->takeSpectators(), packet);
+
         gameManager->removeGame(gameId);
     }
 
@@ -376,18 +914,88 @@ void NetworkManager::handleClientDisconnect(const std::string &clientId, bool no
             handleClientDisconnect(otherClientId, false);
         }
 }
+bool NetworkManager::removeClient(const std::string &clientId)
+{
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto it = clientIdToIndex.find(clientId);
+    if (it == clientIdToIndex.end())
+        return false;
+
+    const ConnectedClient &disconnected = clients[it->second];
+    std::cout << "Client " << clientId << " disconnected: " << disconnected.address << std::endl;
+
+    eraseClient(it);
+    return true;
+}
+
+// The last client moves into the freed slot, so only its index entry changes
+void NetworkManager::eraseClient(std::unordered_map<std::string, size_t>::iterator it)
+{
+    size_t index = it->second;
+    clientIdToIndex.erase(it);
+    if (index + 1 != clients.size())
+    {
+        clients[index] = std::move(clients.back());
+        clientIdToIndex[clients[index].clientId] = index;
+    }
+    clients.pop_back();
+}
+
+void NetworkManager::releaseSpectators(const std::vector<std::string> &spectatorIds,
+                                       const std::vector<uint8_t> &farewell)
+{
+    if (spectatorIds.empty())
+        return;
+
+    std::vector<sockaddr_in> addresses;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for (const std::string &spectatorId : spectatorIds)
+        {
+            auto it = clientIdToIndex.find(spectatorId);
+            if (it == clientIdToIndex.end())
+                continue;
+
+            const ConnectedClient &spectator = clients[it->second];
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(spectator.port);
+            if (!farewell.empty() && inet_pton(AF_INET, spectator.address.c_str(), &address.sin_addr) > 0)
+            {
+                addresses.push_back(address);
+            }
+            eraseClient(it);
+        }
+    }
+
+    if (!addresses.empty())
+    {
+        sendToMany(farewell, addresses.data(), addresses.size());
+    }
+    std::cout << "Released " << spectatorIds.size() << " spectators" << std::endl;
+}
+
 void NetworkManager::process()
 {
     auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastUpdate);
 
-    if (elapsed.count() >= 16)
-    { // ~60fps
-        gameManager->updateAllGames();
-        lastUpdate = now;
+    // Each game paces itself
+    gameManager->updateAllGames(now);
+
+    if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastCleanupTime).count() >= PING_INTERVAL_MS)
+    {
+        TRACE_ZONE("NetworkManager::keepalives");
+        sendKeepalives();
+        lastCleanupTime = now;
     }
 }
 
+std::chrono::steady_clock::time_point NetworkManager::nextDeadline()
+{
+    auto keepalive = lastCleanupTime + std::chrono::milliseconds(PING_INTERVAL_MS);
+    return std::min(keepalive, gameManager->nextDeadline());
+}
+
 void NetworkManager::sendToClient(const std::string &clientId, const std::vector<uint8_t> &packet)
 {
     std::lock_guard<std::mutex> lock(clientsMutex);
@@ -416,7 +1024,11 @@ void NetworkManager::sendToClient(const std::string &address, uint16_t port, con
         return;
     }
 
-    ssize_t bytesSent = sendto(udpSocket, packet.data(), packet.size(), 0, (sockaddr *)&clientAddr, sizeof(clientAddr));
+    ssize_t bytesSent;
+    {
+        TRACE_ZONE("sendto");
+        bytesSent = sendto(udpSocket, packet.data(), packet.size(), 0, (sockaddr *)&clientAddr, sizeof(clientAddr));
+    }
 
     if (bytesSent < 0)
     {
@@ -430,16 +1042,49 @@ void NetworkManager::sendToClient(const std::string &address, uint16_t port, con
 
 void NetworkManager::broadcastToGame(const std::vector<uint8_t> &packet, uint32_t gameId)
 {
-    std::lock_guard<std::mutex> lock(clientsMutex);
-
     auto *game = gameManager->getGame(gameId);
     if (!game)
         return;
 
-    for (std::string id : game->getAllPlayers())
+    game->broadcast(packet);
+}
+
+size_t NetworkManager::sendToMany(const std::vector<uint8_t> &packet, const sockaddr_in *addresses, size_t count)
+{
+    constexpr size_t BATCH_SIZE = 256;
+    mmsghdr messages[BATCH_SIZE];
+    iovec iov{const_cast<uint8_t *>(packet.data()), packet.size()};
+
+    size_t sent = 0;
+    while (sent < count)
     {
-        sendToClient(id, packet);
+        size_t batch = std::min(BATCH_SIZE, count - sent);
+        for (size_t i = 0; i < batch; ++i)
+        {
+            memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_name = const_cast<sockaddr_in *>(&addresses[sent + i]);
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &iov;
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int result;
+        {
+            TRACE_ZONE("sendmmsg");
+            result = sendmmsg(udpSocket, messages, batch, 0);
+        }
+        if (result <= 0)
+        {
+            // Send buffer full, the rest of this snapshot is dropped rather than blocking the tick
+            if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("sendmmsg");
+            }
+            break;
+        }
+        sent += result;
     }
+    return sent;
 }
 
 std::string NetworkManager::getClientIdentifier(const sockaddr_in &addr)
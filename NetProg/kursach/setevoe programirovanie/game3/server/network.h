@@ -1,14 +1,18 @@
 // server/network.h
 #pragma once
 #include "../common/network.h"
+#include "admission.h"
 
 #include "game_instance.h"
 #include "game_manager.h"
+#include "handoff.h"
 #include "matchmaker.h"
 
+#include <atomic>
 #include <mutex>
 #include <netinet/in.h>
 #include <queue>
+#include <sys/socket.h>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -20,6 +24,8 @@ namespace pong
 class Matchmaker;
 class GameManager;
 class GameInstance;
+class ClusterCoordinator;
+class ClusterMember;
 
 struct ConnectedClient
 {
@@ -28,6 +34,19 @@ struct ConnectedClient
     std::string address;       // IP address
     uint16_t port;             // UDP port
     uint32_t lastActivityTime; // For timeout detection
+    uint32_t pingSequence;     // Last keepalive sequence sent
+    uint32_t pongSequence;     // Highest keepalive sequence echoed back
+    float rttMs;               // Smoothed round-trip time, negative until the first PONG
+    float rttJitterMs;         // Smoothed round-trip time variation
+    float lossRate;            // Smoothed fraction of unanswered keepalives
+    uint32_t spectatingGameId; // Non-zero for spectators (playerId 0)
+};
+
+struct LinkStats
+{
+    float rttMs; // Negative if unknown
+    float jitterMs;
+    float lossRate;
 };
 
 class NetworkManager
@@ -37,17 +56,41 @@ class NetworkManager
     ~NetworkManager();
 
     bool startServer(uint16_t port = UDP_SERVER_PORT);
+    // Takes over an already bound socket handed over by a previous server process
+    bool adoptSocket(int socket);
     void process();
+    // Earliest time process() has work to do
+    std::chrono::steady_clock::time_point nextDeadline();
     void shutdown();
     size_t getClientCount() const
     {
         return clients.size();
     }
 
+    // Drain: new players are turned away and the matchmaking queue is emptied,
+    // running games carry on until they end
+    void startDrain();
+    bool isDraining() const
+    {
+        return draining;
+    }
+
+    // Hot restart. The receive thread is stopped before export so nothing changes underneath it.
+    void stopReceiving();
+    void resumeReceiving();
+    int getSocket() const
+    {
+        return udpSocket;
+    }
+    void exportState(HandoffWriter &out);
+    void importState(HandoffReader &in);
+
     // Methods for sending data to clients
     void sendToClient(const std::string &clientId, const std::vector<uint8_t> &packet);
     void sendToClient(const std::string &address, uint16_t port, const std::vector<uint8_t> &packet);
     void broadcastToGame(const std::vector<uint8_t> &packet, uint32_t gameId);
+    // Sends one buffer to many addresses with batched sendmmsg calls, returns how many went out
+    size_t sendToMany(const std::vector<uint8_t> &packet, const sockaddr_in *addresses, size_t count);
 
     // Set the matchmaker reference
     void setMatchmaker(Matchmaker *matchmaker)
@@ -60,34 +103,72 @@ class NetworkManager
         this->gameManager = manager;
     }
 
+    // Cluster messages are passed on to whichever of the two this process is
+    void setClusterCoordinator(ClusterCoordinator *coordinator)
+    {
+        this->coordinator = coordinator;
+    }
+    void setClusterMember(ClusterMember *member)
+    {
+        this->clusterMember = member;
+    }
+
+    // Cluster mode: a player the coordinator sent here, without a connect of its own
+    void addPlayerClient(const std::string &clientId, const std::string &address, uint16_t port, uint8_t playerId);
+    // Forgets a client without telling it, it plays somewhere else now
+    void releaseClient(const std::string &clientId);
+    // Forgets the audience of a finished match under one lock, sending each one farewell first unless it is empty
+    void releaseSpectators(const std::vector<std::string> &spectatorIds, const std::vector<uint8_t> &farewell);
+
     uint32_t findGameIdForClient(const std::string &clientId);
 
+    // Smoothed RTT of a client in milliseconds, negative if not measured yet
+    float getClientRtt(const std::string &clientId);
+    bool getClientLinkStats(const std::string &clientId, LinkStats &stats);
+    // One lock for many clients, unknown clients report a negative RTT
+    void getClientLinkStats(const std::vector<std::string> &clientIds, std::vector<LinkStats> &stats);
+
   private:
     void receiveLoop();
     void handlePacket(const std::vector<uint8_t> &data, const sockaddr_in &sender);
     void handleConnectRequest(const std::vector<uint8_t> &data, const sockaddr_in &sender);
     void handleClientDisconnect(const std::string &clientId, bool notifyOthers);
+    bool removeClient(const std::string &clientId);
+    // clientsMutex held
+    void eraseClient(std::unordered_map<std::string, size_t>::iterator it);
     void handlePlayerInput(const std::vector<uint8_t> &data, const std::string &clientId);
+    void handleInputBatch(const std::vector<uint8_t> &data, const std::string &clientId);
+    void handlePong(const std::vector<uint8_t> &data, const std::string &clientId);
+    void handleSpectateRequest(const std::vector<uint8_t> &data, const sockaddr_in &sender);
+    void handleLeaderboardRequest(const std::vector<uint8_t> &data, const sockaddr_in &sender);
+    void handleClusterMessage(const std::vector<uint8_t> &data, const sockaddr_in &sender);
+
+    // Keepalive. Eviction runs on the receive thread, like every other disconnect.
+    void sendKeepalives();
+    void evictIdleClients();
 
     std::string getClientIdentifier(const sockaddr_in &addr);
 
     // Socket and thread management
     int udpSocket;
     std::thread receiveThread;
-    bool running;
+    std::atomic<bool> running;
+    std::atomic<bool> draining;
+    AdmissionControl admission; // Receive thread only
 
     // Client management
     std::mutex clientsMutex;
     std::vector<ConnectedClient> clients;
     std::unordered_map<std::string, size_t> clientIdToIndex;
 
-    std::chrono::steady_clock::time_point lastUpdate;
     std::chrono::steady_clock::time_point lastCleanupTime;
 
     // Reference to the matchmaker
     Matchmaker *matchmaker;
 
     GameManager *gameManager;
+    ClusterCoordinator *coordinator = nullptr;
+    ClusterMember *clusterMember = nullptr;
 };
 
 } // namespace pong
\ No newline at end of file
@@ -0,0 +1,167 @@
+// server/spectators.cpp
+#include "spectators.h"
+#include "network.h"
+#include <algorithm>
+
+namespace pong
+{
+
+SpectatorGroup::SpectatorGroup() : lastSentFrame{0, 0, 0}, tiersDirty(false)
+{
+}
+
+void SpectatorGroup::add(const std::string &clientId, const sockaddr_in &address)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Spectator &spectator : spectators)
+    {
+        if (spectator.clientId == clientId)
+        {
+            spectator.address = address;
+            tiersDirty = true;
+            return;
+        }
+    }
+    spectators.push_back({clientId, address, 0});
+    tiersDirty = true;
+}
+
+bool SpectatorGroup::remove(const std::string &clientId)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(spectators.begin(), spectators.end(),
+                           [&clientId](const Spectator &spectator) { return spectator.clientId == clientId; });
+    if (it == spectators.end())
+    {
+        return false;
+    }
+
+    // Order does not matter, swap with the last one
+    *it = std::move(spectators.back());
+    spectators.pop_back();
+    tiersDirty = true;
+    return true;
+}
+
+std::vector<std::string> SpectatorGroup::takeAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> ids;
+    ids.reserve(spectators.size());
+    for (const Spectator &spectator : spectators)
+    {
+        ids.push_back(spectator.clientId);
+    }
+    spectators.clear();
+    tiersDirty = true;
+    return ids;
+}
+
+size_t SpectatorGroup::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return spectators.size();
+}
+
+void SpectatorGroup::exportState(HandoffWriter &out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    out.u32(spectators.size());
+    for (const Spectator &spectator : spectators)
+    {
+        out.str(spectator.clientId);
+        out.raw(&spectator.address, sizeof(spectator.address));
+    }
+}
+
+void SpectatorGroup::importState(HandoffReader &in)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count && in.ok(); ++i)
+    {
+        Spectator spectator;
+        spectator.clientId = in.str();
+        in.raw(&spectator.address, sizeof(spectator.address));
+        spectator.tier = 0;
+        spectators.push_back(spectator);
+    }
+    tiersDirty = true;
+}
+
+static uint8_t tierForLink(const LinkStats &link)
+{
+    if (link.rttMs < 0)
+        return 0;
+    if (link.lossRate > 0.10f || link.rttMs > 300.0f)
+        return 2;
+    if (link.lossRate > 0.02f || link.jitterMs > 40.0f || link.rttMs > 150.0f)
+        return 1;
+    return 0;
+}
+
+void SpectatorGroup::refreshTiers(NetworkManager *networkManager)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (spectators.empty())
+    {
+        return;
+    }
+
+    std::vector<std::string> ids;
+    ids.reserve(spectators.size());
+    for (const Spectator &spectator : spectators)
+    {
+        ids.push_back(spectator.clientId);
+    }
+
+    std::vector<LinkStats> stats;
+    networkManager->getClientLinkStats(ids, stats);
+
+    for (size_t i = 0; i < spectators.size(); ++i)
+    {
+        uint8_t tier = tierForLink(stats[i]);
+        if (tier != spectators[i].tier)
+        {
+            spectators[i].tier = tier;
+            tiersDirty = true;
+        }
+    }
+}
+
+void SpectatorGroup::rebuildTiers()
+{
+    for (auto &addresses : tierAddresses)
+    {
+        addresses.clear();
+    }
+    for (const Spectator &spectator : spectators)
+    {
+        tierAddresses[spectator.tier].push_back(spectator.address);
+    }
+    tiersDirty = false;
+}
+
+void SpectatorGroup::fanOut(NetworkManager *networkManager, const std::vector<uint8_t> &packet, uint32_t frame,
+                            bool all)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tiersDirty)
+    {
+        rebuildTiers();
+    }
+
+    for (int tier = 0; tier < SPECTATOR_TIERS; ++tier)
+    {
+        std::vector<sockaddr_in> &addresses = tierAddresses[tier];
+        if (addresses.empty())
+            continue;
+        if (!all && frame - lastSentFrame[tier] < SPECTATOR_TIER_INTERVAL[tier])
+            continue;
+
+        networkManager->sendToMany(packet, addresses.data(), addresses.size());
+        lastSentFrame[tier] = frame;
+    }
+}
+
+} // namespace pong
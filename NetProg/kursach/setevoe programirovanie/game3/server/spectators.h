@@ -0,0 +1,57 @@
+// server/spectators.h
+#pragma once
+#include "handoff.h"
+#include <cstdint>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+namespace pong
+{
+
+class NetworkManager;
+
+// Delivery tiers: 0 gets every snapshot, slower viewers get every 4th / 12th
+constexpr int SPECTATOR_TIERS = 3;
+constexpr uint32_t SPECTATOR_TIER_INTERVAL[SPECTATOR_TIERS] = {1, 4, 12};
+
+// Spectators of one game. Addresses are resolved once on join and kept in flat per-tier
+// arrays, so a snapshot encoded once per tick goes out to every viewer with batched sends.
+class SpectatorGroup
+{
+  public:
+    SpectatorGroup();
+
+    void add(const std::string &clientId, const sockaddr_in &address);
+    bool remove(const std::string &clientId);
+    std::vector<std::string> takeAll();
+    size_t size();
+
+    void exportState(HandoffWriter &out);
+    void importState(HandoffReader &in);
+
+    // Re-tiers every viewer from its keepalive RTT/jitter/loss
+    void refreshTiers(NetworkManager *networkManager);
+
+    // Sends to the tiers whose interval has elapsed at `frame`, or to everyone if `all`
+    void fanOut(NetworkManager *networkManager, const std::vector<uint8_t> &packet, uint32_t frame, bool all);
+
+  private:
+    struct Spectator
+    {
+        std::string clientId;
+        sockaddr_in address;
+        uint8_t tier;
+    };
+
+    void rebuildTiers();
+
+    std::mutex mutex;
+    std::vector<Spectator> spectators;
+    std::vector<sockaddr_in> tierAddresses[SPECTATOR_TIERS];
+    uint32_t lastSentFrame[SPECTATOR_TIERS];
+    bool tiersDirty;
+};
+
+} // namespace pong
@@ -0,0 +1,120 @@
+// server/trace.cpp
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pong
+{
+
+std::atomic<bool> Tracer::enabled(false);
+
+namespace
+{
+
+// Written only by its own thread; head is published with release so the writer of the trace file
+// sees every event below it
+struct ThreadBuffer
+{
+    uint32_t threadId;
+    std::atomic<uint64_t> head{0};
+    uint64_t sessionBegin = 0; // Head when the current session started, set under registryMutex
+    TraceEvent events[TRACE_EVENTS_PER_THREAD];
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry; // Kept after the thread exits, it may still be written out
+thread_local ThreadBuffer *localBuffer = nullptr;
+
+ThreadBuffer *threadBuffer()
+{
+    if (!localBuffer)
+    {
+        // Once per thread, the first time it records anything
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->threadId = static_cast<uint32_t>(syscall(SYS_gettid));
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        localBuffer = buffer.get();
+        registry.push_back(std::move(buffer));
+    }
+    return localBuffer;
+}
+
+} // namespace
+
+void Tracer::start()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &buffer : registry)
+    {
+        buffer->sessionBegin = buffer->head.load(std::memory_order_acquire);
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+size_t Tracer::stop(const std::string &path)
+{
+    enabled.store(false, std::memory_order_relaxed);
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cerr << "Cannot write trace to " << path << std::endl;
+        return 0;
+    }
+
+    // A zone that was open when tracing stopped may still land in the ring while we read it,
+    // at worst it replaces the oldest event of its thread
+    size_t written = 0;
+    uint32_t processId = getpid();
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto &buffer : registry)
+    {
+        uint64_t end = buffer->head.load(std::memory_order_acquire);
+        uint64_t oldest = end > TRACE_EVENTS_PER_THREAD ? end - TRACE_EVENTS_PER_THREAD : 0;
+        uint64_t begin = std::max(buffer->sessionBegin, oldest);
+
+        for (uint64_t i = begin; i < end; ++i)
+        {
+            const TraceEvent &event = buffer->events[i % TRACE_EVENTS_PER_THREAD];
+            file << (written ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"ts\":"
+                 << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << ",\"pid\":" << processId
+                 << ",\"tid\":" << buffer->threadId << "}";
+            ++written;
+        }
+        buffer->sessionBegin = end;
+    }
+
+    file << "\n]}\n";
+    return written;
+}
+
+void Tracer::record(const char *name, uint64_t startNs, uint64_t endNs)
+{
+    if (!isEnabled())
+        return;
+
+    ThreadBuffer *buffer = threadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % TRACE_EVENTS_PER_THREAD] = {name, startNs, endNs - startNs};
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+uint64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace pong
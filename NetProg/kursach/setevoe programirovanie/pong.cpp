@@ -5,6 +5,7 @@
 #include <termios.h>
 #include <fcntl.h>
 #include <cmath>
+#include "pong_frame.h"
 
 // Game constants
 const int WIDTH = 200;
@@ -12,7 +13,9 @@ const int HEIGHT = 54;
 const int PADDLE_HEIGHT = 12;
 const float BASE_SPEED = 2.0f;
 const float SPEED_INCREASE = 0.2f;
-const int GAME_SPEED = 35000;
+const int GAME_SPEED = 35000; // Ball speeds are per step of this many microseconds
+const long FRAME_NS = 16666667; // 60 FPS
+const float STEP = FRAME_NS / 1000.0f / GAME_SPEED; // Part of a step covered by one frame
 const int INPUT_POLL_RATE = 50;
 
 // Game objects
@@ -30,21 +33,24 @@ struct Ball {
     int last_x, last_y;
 };
 
+// One frame's drawing, written out by the game loop
+ScreenBuffer screen;
+
 // Terminal control
 void clearScreen() {
-    std::cout << "\033[2J\033[H";
+    screen << "\033[2J\033[H";
 }
 
 void setCursor(int x, int y) {
-    std::cout << "\033[" << y << ";" << x << "H";
+    screen.moveTo(x, y);
 }
 
 void hideCursor() {
-    std::cout << "\033[?25l";
+    screen << "\033[?25l";
 }
 
 void showCursor() {
-    std::cout << "\033[?25h";
+    screen << "\033[?25h";
 }
 
 void enableRawMode() {
@@ -65,92 +71,91 @@ void disableRawMode() {
 // Drawing functions
 void drawArena() {
     // Set background color
-    std::cout << "\033[48;5;234m";
+    screen << "\033[48;5;234m";
     
     // Top and bottom borders
     for (int x = 0; x < WIDTH; x++) {
         setCursor(x + 1, 1);
-        std::cout << "\033[38;5;255m═";
+        screen << "\033[38;5;255m═";
         setCursor(x + 1, HEIGHT);
-        std::cout << "═";
+        screen << "═";
     }
     
     // Side borders and center line
     for (int y = 2; y < HEIGHT; y++) {
         setCursor(1, y);
-        std::cout << "\033[38;5;255m║";
+        screen << "\033[38;5;255m║";
         setCursor(WIDTH, y);
-        std::cout << "║";
+        screen << "║";
         setCursor(WIDTH/2 + 1, y);
-        std::cout << (y % 2 ? "\033[38;5;239m│" : " ");
+        screen << (y % 2 ? "\033[38;5;239m│" : " ");
     }
     
     // Corners
     setCursor(1, 1);
-    std::cout << "╔";
+    screen << "╔";
     setCursor(WIDTH, 1);
-    std::cout << "╗";
+    screen << "╗";
     setCursor(1, HEIGHT);
-    std::cout << "╚";
+    screen << "╚";
     setCursor(WIDTH, HEIGHT);
-    std::cout << "╝";
+    screen << "╝";
     
-    std::cout << "\033[0m";
+    screen << "\033[0m";
 }
 
 void drawPaddle(const Paddle& p, bool erase = false) {
     if (erase) {
         for (int i = 0; i < PADDLE_HEIGHT; i++) {
             setCursor(p.x + 1, p.y + i + 1);
-            std::cout << " ";
+            screen << " ";
         }
         return;
     }
     
-    std::cout << p.color;
+    screen << p.color;
     for (int i = 0; i < PADDLE_HEIGHT; i++) {
         setCursor(p.x + 1, p.y + i + 1);
         if (i == 0 || i == PADDLE_HEIGHT - 1) {
-            std::cout << "■";
+            screen << "■";
         } else {
-            std::cout << "█";
+            screen << "█";
         }
     }
-    std::cout << "\033[0m";
+    screen << "\033[0m";
 }
 
 void drawBall(const Ball& b, bool erase = false) {
     setCursor(b.last_x + 1, b.last_y + 1);
-    std::cout << " ";
+    screen << " ";
     
     if (!erase) {
         setCursor(static_cast<int>(b.x) + 1, static_cast<int>(b.y) + 1);
         float speed_factor = sqrt(b.dx*b.dx + b.dy*b.dy) / BASE_SPEED;
         if (speed_factor > 1.5f) {
-            std::cout << "\033[1;33;48;5;234m●\033[0m";
+            screen << "\033[1;33;48;5;234m●\033[0m";
         } else {
-            std::cout << "\033[1;93;48;5;234m◦\033[0m";
+            screen << "\033[1;93;48;5;234m◦\033[0m";
         }
     }
-    std::cout.flush();
 }
 
 void drawScore(const Paddle& p1, const Paddle& p2) {
     for (int x = WIDTH/2 - 10; x <= WIDTH/2 + 10; x++) {
         setCursor(x, HEIGHT + 2);
-        std::cout << "\033[48;5;236m ";
+        screen << "\033[48;5;236m ";
     }
     
     setCursor(WIDTH/2 - 8, HEIGHT + 2);
-    std::cout << p1.color << "PLAYER 1: " << p1.score << "\033[0m";
+    screen << p1.color << "PLAYER 1: " << p1.score << "\033[0m";
     
     setCursor(WIDTH/2 + 2, HEIGHT + 2);
-    std::cout << p2.color << "PLAYER 2: " << p2.score << "\033[0m";
+    screen << p2.color << "PLAYER 2: " << p2.score << "\033[0m";
 }
 
 void drawControls() {
     setCursor(2, HEIGHT + 4);
-    std::cout << "\033[38;5;245mCONTROLS: \033[1;37mP1 (W/S)   P2 (↑/↓)   \033[1;31mQUIT (Q)\033[0m";
+    screen << "\033[38;5;245mCONTROLS: \033[1;37mP1 (W/S)   P2 (↑/↓)   \033[1;31mQUIT (Q)\033[0m";
 }
 
 // Game logic
@@ -168,8 +173,8 @@ void updateBall(Ball& ball, Paddle& p1, Paddle& p2) {
     ball.last_x = static_cast<int>(ball.x);
     ball.last_y = static_cast<int>(ball.y);
     
-    ball.x += ball.dx;
-    ball.y += ball.dy;
+    ball.x += ball.dx * STEP;
+    ball.y += ball.dy * STEP;
     
     if (ball.y <= 1.2f) {
         ball.y = 1.2f;
@@ -212,12 +217,12 @@ void updateBall(Ball& ball, Paddle& p1, Paddle& p2) {
         
         for (int i = 0; i < 3; i++) {
             setCursor(WIDTH/2 - 3, HEIGHT/2);
-            std::cout << "\033[1;5;37;48;5;196m GOAL! \033[0m";
-            std::cout.flush();
+            screen << "\033[1;5;37;48;5;196m GOAL! \033[0m";
+            screen.flush();
             usleep(150000);
             setCursor(WIDTH/2 - 3, HEIGHT/2);
-            std::cout << "       ";
-            std::cout.flush();
+            screen << "       ";
+            screen.flush();
             usleep(150000);
         }
         
@@ -285,8 +290,10 @@ int main() {
     drawBall(ball);
     drawScore(p1, p2);
     drawControls();
+    screen.flush();
     
     // Game loop
+    FramePacer pacer(FRAME_NS);
     bool running = true;
     while (running) {
         // Handle input
@@ -303,22 +310,27 @@ int main() {
             drawScore(p1, p2);
             last_p1_score = p1.score;
             last_p2_score = p2.score;
+            screen.flush();
             usleep(300000);
+            pacer.restart();
         }
         
-        // Control game speed
-        usleep(GAME_SPEED);
+        // The frame is ready, show it when it is due
+        pacer.wait();
+        screen.flush();
     }
     
     // Clean up
     showCursor();
     disableRawMode();
     clearScreen();
+    screen.flush();
     
     // Game over message
     std::cout << "\n  \033[1;36mGAME OVER\033[0m\n\n";
     std::cout << "  \033[1;32mPlayer 1: " << p1.score << "\033[0m\n";
     std::cout << "  \033[1;34mPlayer 2: " << p2.score << "\033[0m\n\n";
+    std::cout << "  " << pacer.report() << "\n";
     
     return 0;
 }
\ No newline at end of file
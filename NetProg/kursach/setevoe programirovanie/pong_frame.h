@@ -0,0 +1,151 @@
+// pong_frame.h
+// Frame pacing and buffered drawing, shared by pong.cpp and game2/client/pong_game.cpp.
+// Header only, so both still build from their own sources.
+#ifndef PONG_FRAME_H
+#define PONG_FRAME_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+
+// Everything drawn during a frame is collected here and reaches the terminal in one write,
+// instead of one write per character through std::cout
+class ScreenBuffer {
+public:
+    ScreenBuffer() { data.reserve(16384); }
+
+    ScreenBuffer& operator<<(const char* text) { data += text; return *this; }
+    ScreenBuffer& operator<<(const std::string& text) { data += text; return *this; }
+    ScreenBuffer& operator<<(char c) { data += c; return *this; }
+    ScreenBuffer& operator<<(int value) { appendInt(value); return *this; }
+
+    void moveTo(int x, int y) {
+        data += "\033[";
+        appendInt(y);
+        data += ';';
+        appendInt(x);
+        data += 'H';
+    }
+
+    // Writes out everything collected so far. Raw mode puts stdin in O_NONBLOCK, and on a terminal that is
+    // the same open file as stdout, so a terminal that can't keep up gives EAGAIN: wait for it rather than
+    // drop the rest of the frame.
+    bool flush(int fd = STDOUT_FILENO) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t written = write(fd, data.data() + done, data.size() - done);
+            if (written > 0) {
+                done += written;
+            } else if (written < 0 && errno == EAGAIN) {
+                pollfd ready = {fd, POLLOUT, 0};
+                poll(&ready, 1, -1);
+            } else if (written < 0 && errno != EINTR) {
+                data.clear();
+                return false;
+            }
+        }
+        data.clear(); // Keeps the capacity, a frame allocates nothing once the buffer has grown
+        return true;
+    }
+
+    bool empty() const { return data.empty(); }
+
+private:
+    void appendInt(int value) {
+        char digits[12];
+        int length = snprintf(digits, sizeof(digits), "%d", value);
+        data.append(digits, length);
+    }
+
+    std::string data;
+};
+
+// Sleeps to absolute frame deadlines with clock_nanosleep(TIMER_ABSTIME). Each deadline is the previous one
+// plus the period, not "now" plus the period, so oversleeping or a slow frame is made up on the next one
+// instead of adding up. Also keeps a histogram of the time between frames for the report at exit.
+class FramePacer {
+public:
+    explicit FramePacer(long period_ns) : period(period_ns), histogram(HISTOGRAM_BINS + 1, 0) { restart(); }
+
+    // Starts over from now. For deliberate pauses (menus, the goal animation) so they are not counted
+    // as late frames and not caught up afterwards.
+    void restart() {
+        deadline = now() + period;
+        last_frame = 0;
+    }
+
+    // Sleeps until the next frame is due, right before it is shown
+    void wait() {
+        timespec until = {static_cast<time_t>(deadline / NS_PER_SECOND), static_cast<long>(deadline % NS_PER_SECOND)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR) {}
+
+        int64_t start = now();
+        if (last_frame != 0) record(start - last_frame);
+        last_frame = start;
+
+        deadline += period;
+        // More than a few frames behind: drop them instead of running them back to back
+        if (start - deadline > MAX_CATCH_UP * period) {
+            skipped += (start - deadline) / period;
+            deadline = start + period;
+        }
+    }
+
+    long frames() const { return count; }
+
+    // Frame time below which p percent of frames fell, in milliseconds
+    double percentileMs(double p) const {
+        if (count == 0) return 0;
+        long wanted = static_cast<long>(count * p / 100.0);
+        long seen = 0;
+        for (int bin = 0; bin <= HISTOGRAM_BINS; ++bin) {
+            seen += histogram[bin];
+            if (seen > wanted) return (bin + 1) * BIN_NS / 1e6;
+        }
+        return HISTOGRAM_BINS * BIN_NS / 1e6;
+    }
+
+    std::string report() const {
+        char line[160];
+        snprintf(line, sizeof(line), "%ld frames, target %.2f ms, mean %.2f ms, p50 %.2f ms, p99 %.2f ms, "
+                 "max %.2f ms, %ld skipped", count, period / 1e6, count ? total / 1e6 / count : 0.0,
+                 percentileMs(50), percentileMs(99), longest / 1e6, skipped);
+        return line;
+    }
+
+private:
+    static constexpr int64_t NS_PER_SECOND = 1000000000;
+    static constexpr int64_t BIN_NS = 10000;      // 10 us buckets
+    static constexpr int HISTOGRAM_BINS = 10000;  // up to 100 ms, the last bucket takes the rest
+    static constexpr int64_t MAX_CATCH_UP = 3;
+
+    static int64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+    }
+
+    void record(int64_t frame_ns) {
+        int64_t bin = frame_ns / BIN_NS;
+        histogram[bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS]++;
+        count++;
+        total += frame_ns;
+        if (frame_ns > longest) longest = frame_ns;
+    }
+
+    int64_t period;
+    int64_t deadline = 0;
+    int64_t last_frame = 0;
+    std::vector<uint32_t> histogram;
+    long count = 0;
+    long skipped = 0;
+    int64_t total = 0;
+    int64_t longest = 0;
+};
+
+#endif
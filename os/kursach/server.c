@@ -1,28 +1,141 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #define PORT 80
 #define BUFFER_SIZE 1024
 #define MAX_MESSAGES 1000
-#define HISTORY_FILE "chat_history.txt"
+#define HISTORY_FILE "chat_history.txt" // old format, imported once
+#define LOG_DIR "chat_log"
+#define SEGMENT_SIZE (1024 * 1024) // a new segment is started past this
 #define POLL_TIMEOUT 10
+#define WORKER_THREADS 4
+#define MAX_EVENTS 256
+#define REQUEST_SIZE (BUFFER_SIZE * 4)
+#define CHUNK_SIZE (64 * 1024) // holds any one rendered message
+#define CHUNK_MESSAGES 256
 
 typedef struct
 {
   char messages[MAX_MESSAGES][BUFFER_SIZE];
   int message_count;
   int oldest_message_idx;
+  long last_seq; // of the newest message, they are numbered from 1 and never
+                 // reused, so a client asks for what came after the last it saw
 } Chat;
 
+// Header of a message in the log, followed by len bytes of text. Segments are
+// LOG_DIR/<seq of their first message>.log and only ever appended to.
+typedef struct
+{
+  uint32_t len;
+  uint32_t crc; // of seq and the text, a torn write at the end fails it
+  int64_t seq;
+} LogRecord;
+
+// Growable byte buffer
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+// A run of rendered messages: each one as a JSON string followed by a comma,
+// offsets[i] being where message first_seq + i starts. Messages are appended
+// in place and never change once written, so every snapshot that covers some
+// of them shares the chunk, and reads only the part it covers.
+typedef struct
+{
+  atomic_int refs;
+  long first_seq;
+  int count; // only the posting thread looks at it
+  size_t offsets[CHUNK_MESSAGES + 1];
+  char json[CHUNK_SIZE];
+} Chunk;
+
+// The rendered history as of one POST, shared read-only by every response
+// until the next POST replaces it. The next one references the same chunks,
+// so a POST renders and copies only its own message.
+typedef struct
+{
+  atomic_int refs;
+  long first_seq;
+  long last_seq;
+  int chunk_count;
+  Chunk *chunks[]; // oldest first, the first may start before first_seq
+} Snapshot;
+
+typedef enum
+{
+  CONN_READING, // request not complete yet
+  CONN_PARKED,  // long-poll GET waiting for a new message
+  CONN_WRITING, // response queued, closed once it is sent
+} ConnState;
+
+// One per client socket, owned by the worker whose epoll it is in
+typedef struct Connection
+{
+  int fd;
+  ConnState state;
+  char request[REQUEST_SIZE + 1];
+  size_t request_len;
+  char head[256];          // status line and headers, and the start of the body
+  struct iovec *out;       // head, body and end of the body, still to be sent
+  struct iovec inline_out[3]; // out, unless the body comes in more pieces
+  int out_count;
+  int out_index;
+  char *response;          // copy of a body the socket did not take at once
+  Snapshot *snapshot;      // held while its json is being sent
+  long since;              // GET /messages?since=, the last seq the client has
+  long deadline;           // ms, when a parked request gets its 204
+  struct Connection *prev; // parked list of the worker, oldest first
+  struct Connection *next;
+} Connection;
+
+// Each worker runs its own epoll loop. They all wait on the listening socket
+// and the kernel hands every new connection to one of them. A POST on any
+// worker signals wakeup_fd of the workers that have parked requests.
+typedef struct
+{
+  int epoll_fd;
+  int wakeup_fd;
+  pthread_t thread;
+  Connection *parked;
+  Connection *parked_tail;
+  atomic_int parked_count; // read by the posting worker
+} Worker;
+
 int server_fd;
-Chat chatroom = { .message_count = 0, .oldest_message_idx = 0 };
+// Set by SIGINT; the workers see it on their wakeup_fd and return
+volatile sig_atomic_t stop_requested = 0;
+Chat chatroom = { .message_count = 0, .oldest_message_idx = 0, .last_seq = 0 };
 pthread_mutex_t chatroom_mutex = PTHREAD_MUTEX_INITIALIZER;
+Worker workers[WORKER_THREADS];
+Snapshot *current_snapshot;
+// Only guards the current_snapshot pointer, held just long enough to take a
+// reference or swap in the next one, so readers and writers never wait on
+// each other's serialization
+pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+// One POST at a time builds the next snapshot
+pthread_mutex_t post_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void
 get_timestamp (char *buffer, size_t size)
@@ -32,140 +145,888 @@ get_timestamp (char *buffer, size_t size)
   strftime (buffer, size, "%Y-%m-%d %H:%M:%S", t);
 }
 
+// Adds a message to the ring, dropping the oldest once it is full
+long
+append_message (const char *text)
+{
+  pthread_mutex_lock (&chatroom_mutex);
+  int idx
+      = (chatroom.oldest_message_idx + chatroom.message_count) % MAX_MESSAGES;
+  strncpy (chatroom.messages[idx], text, BUFFER_SIZE - 1);
+  chatroom.messages[idx][BUFFER_SIZE - 1] = '\0';
+
+  if (chatroom.message_count < MAX_MESSAGES)
+    {
+      chatroom.message_count++;
+    }
+  else
+    {
+      chatroom.oldest_message_idx
+          = (chatroom.oldest_message_idx + 1) % MAX_MESSAGES;
+    }
+  long seq = ++chatroom.last_seq;
+  pthread_mutex_unlock (&chatroom_mutex);
+  return seq;
+}
+
 void
-load_history ()
+buffer_reserve (Buffer *buffer, size_t extra)
 {
-  FILE *file = fopen (HISTORY_FILE, "r");
+  if (buffer->len + extra <= buffer->cap)
+    return;
+  size_t cap = buffer->cap ? buffer->cap : 4096;
+  while (cap < buffer->len + extra)
+    cap *= 2;
+  buffer->data = realloc (buffer->data, cap);
+  buffer->cap = cap;
+}
+
+void
+buffer_append (Buffer *buffer, const char *data, size_t len)
+{
+  buffer_reserve (buffer, len);
+  memcpy (buffer->data + buffer->len, data, len);
+  buffer->len += len;
+}
+
+// "text" with quotes, backslashes and control characters escaped
+void
+buffer_append_json_string (Buffer *buffer, const char *text)
+{
+  size_t len = strlen (text);
+  buffer_reserve (buffer, len * 6 + 2); // worst case, every char as \u00XX
+  char *out = buffer->data + buffer->len;
+  *out++ = '"';
+  for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+      if (*c == '"' || *c == '\\')
+        {
+          *out++ = '\\';
+          *out++ = *c;
+        }
+      else if (*c < 0x20)
+        {
+          out += sprintf (out, "\\u%04x", *c);
+        }
+      else
+        {
+          *out++ = *c;
+        }
+    }
+  *out++ = '"';
+  buffer->len = out - buffer->data;
+}
+
+// The chat log. POSTs only copy their record into pending; the log thread
+// takes everything pending at once, writes it in one go and syncs it with one
+// fdatasync. Records that come in during a sync make up the next batch, so
+// under load one sync covers many messages and a POST never waits for the
+// disk. What was written but not synced yet, at most one batch, is what a
+// power cut can lose; a crashed process loses only what was not written.
+typedef struct
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;
+  pthread_t thread;
+  Buffer pending;         // records not handed to the log thread yet
+  long pending_first_seq; // seq of the first of them
+  int stopping;
+  int fd;                 // current segment, only the log thread writes it
+  size_t segment_len;
+} ChatLog;
+
+ChatLog chat_log = { .mutex = PTHREAD_MUTEX_INITIALIZER,
+                     .ready = PTHREAD_COND_INITIALIZER,
+                     .fd = -1 };
+uint32_t crc_table[256];
+
+void
+crc_init ()
+{
+  for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+        crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+      crc_table[i] = crc;
+    }
+}
+
+// CRC-32, continues from crc so the seq and the text can go in separately
+uint32_t
+log_crc (uint32_t crc, const void *data, size_t len)
+{
+  const unsigned char *bytes = data;
+  crc = ~crc;
+  while (len--)
+    crc = crc_table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+void
+segment_path (char *path, size_t size, long first_seq)
+{
+  snprintf (path, size, "%s/%020ld.log", LOG_DIR, first_seq);
+}
+
+int
+compare_seqs (const void *a, const void *b)
+{
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+// First seqs of the segments in LOG_DIR, oldest first. The caller frees them.
+int
+list_segments (long **first_seqs)
+{
+  int count = 0, cap = 16;
+  *first_seqs = malloc (cap * sizeof (long));
+  DIR *dir = opendir (LOG_DIR);
+  if (!dir)
+    return 0;
+
+  struct dirent *entry;
+  while ((entry = readdir (dir)))
+    {
+      char *end;
+      long seq = strtol (entry->d_name, &end, 10);
+      if (end == entry->d_name || strcmp (end, ".log") != 0)
+        continue;
+      if (count == cap)
+        *first_seqs = realloc (*first_seqs, (cap *= 2) * sizeof (long));
+      (*first_seqs)[count++] = seq;
+    }
+  closedir (dir);
+  qsort (*first_seqs, count, sizeof (long), compare_seqs);
+  return count;
+}
+
+// Makes a new file survive a crash, fsync of the file alone does not cover its
+// directory entry
+void
+sync_log_dir ()
+{
+  int dir_fd = open (LOG_DIR, O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0)
+    {
+      fsync (dir_fd);
+      close (dir_fd);
+    }
+}
+
+void
+open_segment (long first_seq)
+{
+  char path[64];
+  segment_path (path, sizeof (path), first_seq);
+  chat_log.fd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (chat_log.fd < 0)
+    {
+      perror ("Failed to open chat log segment");
+      exit (EXIT_FAILURE);
+    }
+  chat_log.segment_len = 0;
+  sync_log_dir ();
+}
+
+// Starts a segment at first_seq and deletes the ones whose messages have all
+// left the ring, so recovery never has more than a segment or two to read
+void
+rotate_segment (long first_seq)
+{
+  close (chat_log.fd);
+  open_segment (first_seq);
+
+  long *segments;
+  int count = list_segments (&segments);
+  for (int i = 0; i + 1 < count; i++)
+    {
+      if (segments[i + 1] > first_seq - MAX_MESSAGES)
+        break;
+      char path[64];
+      segment_path (path, sizeof (path), segments[i]);
+      unlink (path);
+    }
+  free (segments);
+}
+
+// Only the header and text are copied here, under a lock held for nothing
+// else. Called in seq order, under post_mutex.
+void
+log_append (long seq, const char *text)
+{
+  LogRecord record = { .len = strnlen (text, BUFFER_SIZE - 1), .seq = seq };
+  record.crc = log_crc (log_crc (0, &record.seq, sizeof (record.seq)), text,
+                        record.len);
+
+  pthread_mutex_lock (&chat_log.mutex);
+  if (chat_log.pending.len == 0)
+    chat_log.pending_first_seq = seq;
+  buffer_append (&chat_log.pending, (const char *)&record, sizeof (record));
+  buffer_append (&chat_log.pending, text, record.len);
+  pthread_cond_signal (&chat_log.ready);
+  pthread_mutex_unlock (&chat_log.mutex);
+}
+
+// Writes the whole batch after the good part of the segment and syncs it. On
+// failure the segment is cut back to where it was, so nothing follows a torn
+// record, and 0 is returned.
+int
+write_batch (const Buffer *batch)
+{
+  size_t written = 0;
+  while (written < batch->len)
+    {
+      ssize_t n = write (chat_log.fd, batch->data + written,
+                         batch->len - written);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      written += n;
+    }
+  if (written == batch->len && fdatasync (chat_log.fd) == 0)
+    {
+      chat_log.segment_len += batch->len;
+      return 1;
+    }
+  perror ("Failed to write chat log");
+  ftruncate (chat_log.fd, chat_log.segment_len);
+  return 0;
+}
+
+void *
+log_main (void *arg)
+{
+  (void)arg;
+  Buffer batch = { 0 };
+  long first_seq = 0;
+  while (1)
+    {
+      pthread_mutex_lock (&chat_log.mutex);
+      while (chat_log.pending.len == 0 && batch.len == 0 && !chat_log.stopping)
+        pthread_cond_wait (&chat_log.ready, &chat_log.mutex);
+      if (chat_log.pending.len == 0 && batch.len == 0)
+        {
+          pthread_mutex_unlock (&chat_log.mutex);
+          break; // stopping, and everything is on disk
+        }
+      if (batch.len == 0)
+        {
+          // The buffers trade places, POSTs go on filling the other one
+          Buffer taken = chat_log.pending;
+          chat_log.pending = batch;
+          batch = taken;
+          first_seq = chat_log.pending_first_seq;
+        }
+      else
+        {
+          // A batch that failed is retried with what came in meanwhile
+          // behind it, nothing is ever written after a gap in the seqs
+          if (chat_log.pending.len > 0)
+            buffer_append (&batch, chat_log.pending.data,
+                           chat_log.pending.len);
+        }
+      chat_log.pending.len = 0;
+      int stopping = chat_log.stopping;
+      pthread_mutex_unlock (&chat_log.mutex);
+
+      if (chat_log.segment_len > 0
+          && chat_log.segment_len + batch.len > SEGMENT_SIZE)
+        rotate_segment (first_seq);
+
+      if (write_batch (&batch))
+        {
+          batch.len = 0;
+        }
+      else if (stopping)
+        {
+          fprintf (stderr, "Chat log: %zu bytes could not be saved.\n",
+                   batch.len);
+          break;
+        }
+      else
+        {
+          sleep (1);
+        }
+    }
+  free (batch.data);
+  return NULL;
+}
+
+// Writes out and syncs whatever is pending, then stops the log thread
+void
+log_shutdown ()
+{
+  pthread_mutex_lock (&chat_log.mutex);
+  chat_log.stopping = 1;
+  pthread_cond_signal (&chat_log.ready);
+  pthread_mutex_unlock (&chat_log.mutex);
+  pthread_join (chat_log.thread, NULL);
+  close (chat_log.fd);
+}
+
+// Adds the records of one segment to the ring. Stops at the first one that is
+// cut short, out of sequence or fails its crc, which is what a crash in the
+// middle of a write leaves behind, and returns how many bytes were good.
+off_t
+replay_segment (long first_seq)
+{
+  char path[64];
+  segment_path (path, sizeof (path), first_seq);
+  FILE *file = fopen (path, "rb");
   if (!file)
+    return 0;
+
+  // A segment that does not continue the previous one (one in between is
+  // gone): the ring starts over, its seqs have to be consecutive
+  if (first_seq != chatroom.last_seq + 1)
     {
-      printf ("No history file found.\n");
-      return;
+      chatroom.message_count = 0;
+      chatroom.oldest_message_idx = 0;
+      chatroom.last_seq = first_seq - 1;
+    }
+
+  off_t good = 0;
+  LogRecord record;
+  char text[BUFFER_SIZE];
+  while (fread (&record, sizeof (record), 1, file) == 1)
+    {
+      if (record.len >= BUFFER_SIZE || record.seq != chatroom.last_seq + 1
+          || fread (text, 1, record.len, file) != record.len)
+        break;
+      uint32_t crc = log_crc (0, &record.seq, sizeof (record.seq));
+      if (log_crc (crc, text, record.len) != record.crc)
+        break;
+      text[record.len] = '\0';
+      append_message (text);
+      good += sizeof (record) + record.len;
     }
+  fclose (file);
+  return good;
+}
+
+// Messages of chat_history.txt as the server used to save them, one per line
+void
+import_text_history ()
+{
+  FILE *file = fopen (HISTORY_FILE, "r");
+  if (!file)
+    return;
 
   char line[BUFFER_SIZE];
   while (fgets (line, sizeof (line), file))
     {
       line[strcspn (line, "\n")] = '\0';
-      pthread_mutex_lock (&chatroom_mutex);
-      strncpy (chatroom.messages[chatroom.message_count], line,
-               BUFFER_SIZE - 1);
-      chatroom.message_count++;
-      if (chatroom.message_count >= MAX_MESSAGES)
+      append_message (line);
+    }
+  fclose (file);
+  printf ("Imported %d messages from %s.\n", chatroom.message_count,
+          HISTORY_FILE);
+}
+
+// Fills the ring from the newest segments and opens the last one for
+// appending. Only the segments holding the last MAX_MESSAGES are read, how big
+// the log has grown does not matter. Without a log, the old text history is
+// imported into a new one.
+void
+recover_log ()
+{
+  crc_init ();
+  mkdir (LOG_DIR, 0755);
+
+  long *segments;
+  int count = list_segments (&segments);
+  if (count == 0)
+    {
+      import_text_history ();
+      open_segment (chatroom.last_seq - chatroom.message_count + 1);
+      int index = chatroom.oldest_message_idx;
+      for (int i = 0; i < chatroom.message_count; i++)
         {
-          chatroom.message_count = 0;
-          chatroom.oldest_message_idx
-              = (chatroom.oldest_message_idx + 1) % MAX_MESSAGES;
+          log_append (chatroom.last_seq - chatroom.message_count + 1 + i,
+                      chatroom.messages[index]);
+          index = (index + 1) % MAX_MESSAGES;
         }
-      pthread_mutex_unlock (&chatroom_mutex);
+      free (segments);
+      return;
     }
 
-  fclose (file);
-  printf ("Loaded history from %s.\n", HISTORY_FILE);
+  // The segments before the last one hold as many messages as the gaps
+  // between their names, so where to start is known without reading them
+  int start = count - 1;
+  while (start > 0 && segments[count - 1] - segments[start] < MAX_MESSAGES)
+    start--;
+
+  off_t good = 0;
+  for (int i = start; i < count; i++)
+    good = replay_segment (segments[i]);
+
+  // Cut off a torn record at the end, new ones go right after the good part
+  char path[64];
+  segment_path (path, sizeof (path), segments[count - 1]);
+  truncate (path, good);
+  chat_log.fd = open (path, O_WRONLY | O_APPEND);
+  if (chat_log.fd < 0)
+    {
+      perror ("Failed to open chat log");
+      exit (EXIT_FAILURE);
+    }
+  chat_log.segment_len = good;
+  printf ("Recovered %d messages, up to #%ld, from %s.\n",
+          chatroom.message_count, chatroom.last_seq, LOG_DIR);
+  free (segments);
 }
 
+// Only the main thread takes SIGINT, the others block it. Stopping is left to
+// main: the workers go first, so no POST is acknowledged after the log thread
+// has written its last batch. write is all a handler may safely do here.
 void
-save_history ()
+sigint_handler (int signum)
 {
-  FILE *file = fopen (HISTORY_FILE, "w");
-  if (!file)
+  (void)signum;
+  uint64_t one = 1;
+  stop_requested = 1;
+  for (int i = 0; i < WORKER_THREADS; i++)
+    write (workers[i].wakeup_fd, &one, sizeof (one));
+}
+
+long
+now_ms ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Appended at the tail: every request waits POLL_TIMEOUT, so the list stays
+// ordered by deadline and the head is always the next one to time out
+void
+park (Worker *worker, Connection *conn)
+{
+  conn->state = CONN_PARKED;
+  conn->deadline = now_ms () + POLL_TIMEOUT * 1000;
+  conn->next = NULL;
+  conn->prev = worker->parked_tail;
+  if (worker->parked_tail)
+    worker->parked_tail->next = conn;
+  else
+    worker->parked = conn;
+  worker->parked_tail = conn;
+  atomic_fetch_add (&worker->parked_count, 1);
+}
+
+void
+unpark (Worker *worker, Connection *conn)
+{
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    worker->parked = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  else
+    worker->parked_tail = conn->prev;
+  atomic_fetch_sub (&worker->parked_count, 1);
+}
+
+// One message as it appears in a snapshot
+void
+render_message (Buffer *buffer, const char *text)
+{
+  buffer_append_json_string (buffer, text);
+  buffer_append (buffer, ",", 1);
+}
+
+Snapshot *
+snapshot_empty (long last_seq)
+{
+  Snapshot *snapshot = calloc (1, sizeof (Snapshot));
+  atomic_init (&snapshot->refs, 1); // current_snapshot's reference
+  snapshot->first_seq = last_seq + 1;
+  snapshot->last_seq = last_seq;
+  return snapshot;
+}
+
+void
+snapshot_release (Snapshot *snapshot)
+{
+  if (!snapshot || atomic_fetch_sub (&snapshot->refs, 1) != 1)
+    return;
+  for (int i = 0; i < snapshot->chunk_count; i++)
     {
-      perror ("Failed to save history");
-      return;
+      if (atomic_fetch_sub (&snapshot->chunks[i]->refs, 1) == 1)
+        free (snapshot->chunks[i]);
+    }
+  free (snapshot);
+}
+
+// The next snapshot: the chunks of the old one, less those whose messages all
+// fell out of the last MAX_MESSAGES, plus one rendered message. The message is
+// written past the end of the last chunk, where no published snapshot looks,
+// or into a new chunk once that one is full. Only called on current_snapshot,
+// under post_mutex.
+Snapshot *
+snapshot_append (const Snapshot *old, const char *message, size_t len)
+{
+  long seq = old->last_seq + 1;
+  long first_seq = seq - MAX_MESSAGES + 1;
+  if (first_seq < old->first_seq)
+    first_seq = old->first_seq;
+
+  int skip = 0;
+  while (skip + 1 < old->chunk_count
+         && old->chunks[skip + 1]->first_seq <= first_seq)
+    skip++;
+
+  Chunk *tail = old->chunk_count ? old->chunks[old->chunk_count - 1] : NULL;
+  int fresh = !tail || tail->count == CHUNK_MESSAGES
+              || tail->offsets[tail->count] + len > CHUNK_SIZE;
+
+  int count = old->chunk_count - skip + fresh;
+  Snapshot *snapshot = malloc (sizeof (Snapshot) + count * sizeof (Chunk *));
+  atomic_init (&snapshot->refs, 1);
+  snapshot->first_seq = first_seq;
+  snapshot->last_seq = seq;
+  snapshot->chunk_count = count;
+  for (int i = 0; i < old->chunk_count - skip; i++)
+    {
+      snapshot->chunks[i] = old->chunks[skip + i];
+      atomic_fetch_add (&snapshot->chunks[i]->refs, 1);
     }
+  if (fresh)
+    {
+      tail = malloc (sizeof (Chunk));
+      atomic_init (&tail->refs, 1);
+      tail->first_seq = seq;
+      tail->count = 0;
+      tail->offsets[0] = 0;
+      snapshot->chunks[count - 1] = tail;
+    }
+
+  memcpy (tail->json + tail->offsets[tail->count], message, len);
+  tail->offsets[tail->count + 1] = tail->offsets[tail->count] + len;
+  tail->count++;
+  return snapshot;
+}
 
+// Rendering of the ring as loaded at startup
+Snapshot *
+snapshot_from_ring ()
+{
+  Buffer rendered = { 0 };
   pthread_mutex_lock (&chatroom_mutex);
+  Snapshot *snapshot
+      = snapshot_empty (chatroom.last_seq - chatroom.message_count);
   int index = chatroom.oldest_message_idx;
   for (int i = 0; i < chatroom.message_count; i++)
     {
-      fprintf (file, "%s\n", chatroom.messages[index]);
+      rendered.len = 0;
+      render_message (&rendered, chatroom.messages[index]);
+      Snapshot *next = snapshot_append (snapshot, rendered.data, rendered.len);
+      snapshot_release (snapshot);
+      snapshot = next;
       index = (index + 1) % MAX_MESSAGES;
     }
   pthread_mutex_unlock (&chatroom_mutex);
+  free (rendered.data);
+  return snapshot;
+}
 
-  fclose (file);
-  printf ("Chat history saved to %s.\n", HISTORY_FILE);
+Snapshot *
+snapshot_acquire ()
+{
+  pthread_mutex_lock (&snapshot_mutex);
+  Snapshot *snapshot = current_snapshot;
+  atomic_fetch_add (&snapshot->refs, 1);
+  pthread_mutex_unlock (&snapshot_mutex);
+  return snapshot;
 }
 
+// Responses still sending the old one keep it until they are done
 void
-sigint_handler (int signum)
+publish_snapshot (Snapshot *snapshot)
 {
-  printf ("\nSIGINT. Saving chat history.\n");
-  save_history ();
-  close (server_fd);
-  exit (0);
+  pthread_mutex_lock (&snapshot_mutex);
+  Snapshot *old = current_snapshot;
+  current_snapshot = snapshot;
+  pthread_mutex_unlock (&snapshot_mutex);
+  snapshot_release (old);
 }
 
 void
-send_http_response (int client_socket, const char *status,
-                    const char *content_type, const char *body)
+close_connection (Worker *worker, Connection *conn)
 {
-  char headers[BUFFER_SIZE];
-  snprintf (headers, sizeof (headers),
-            "HTTP/1.1 %s\r\n"
-            "Content-Type: %s\r\n"
-            "Content-Length: %ld\r\n\r\n",
-            status, content_type, strlen (body));
+  if (conn->state == CONN_PARKED)
+    unpark (worker, conn);
 
-  send (client_socket, headers, strlen (headers), 0);
-  send (client_socket, body, strlen (body), 0);
+  epoll_ctl (worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close (conn->fd);
+  free (conn->response);
+  if (conn->out != conn->inline_out)
+    free (conn->out);
+  snapshot_release (conn->snapshot);
+  free (conn);
 }
 
 void
-handle_get (int client_socket, int client_message_count)
+watch (Worker *worker, Connection *conn, uint32_t events)
 {
-  time_t start_time = time (NULL);
+  struct epoll_event event = { .events = events | EPOLLRDHUP,
+                               .data.ptr = conn };
+  epoll_ctl (worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
 
-  while (1)
+// Writes as much as the socket takes, the rest goes out on EPOLLOUT. The
+// connection is closed once the whole response is sent, and 1 is returned.
+int
+flush_response (Worker *worker, Connection *conn)
+{
+  while (conn->out_index < conn->out_count)
     {
-      pthread_mutex_lock (&chatroom_mutex);
-      int message_count = chatroom.message_count;
-      pthread_mutex_unlock (&chatroom_mutex);
-
-      if (message_count > client_message_count)
+      ssize_t sent = writev (conn->fd, conn->out + conn->out_index,
+                             conn->out_count - conn->out_index);
+      if (sent < 0)
         {
-          printf ("Message count > client_message_count: %d > %d\n",
-                  message_count, client_message_count);
-          char body[BUFFER_SIZE * MAX_MESSAGES] = "[";
-
-          pthread_mutex_lock (&chatroom_mutex);
-          int index = chatroom.oldest_message_idx;
-          for (int i = 0; i < message_count; i++)
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
-              strcat (body, "\"");
-              strcat (body, chatroom.messages[index]);
-              strcat (body, "\"");
-              if (i < message_count - 1)
-                {
-                  strcat (body, ",");
-                }
-              index = (index + 1) % MAX_MESSAGES;
+              watch (worker, conn, EPOLLOUT);
+              return 0;
             }
-          pthread_mutex_unlock (&chatroom_mutex);
-
-          strcat (body, "]");
-          send_http_response (client_socket, "200 OK", "application/json",
-                              body);
           break;
         }
-      else if (time (NULL) - start_time >= POLL_TIMEOUT)
+
+      while (conn->out_index < conn->out_count
+             && (size_t)sent >= conn->out[conn->out_index].iov_len)
         {
-          printf ("Timeout.\n");
-          send_http_response (client_socket, "204 No Content",
-                              "application/json", "[]");
-          break;
+          sent -= conn->out[conn->out_index].iov_len;
+          conn->out_index++;
         }
-      else
+      if (conn->out_index < conn->out_count)
         {
-          printf ("Waiting...\n");
-          sleep (1);
+          struct iovec *part = &conn->out[conn->out_index];
+          part->iov_base = (char *)part->iov_base + sent;
+          part->iov_len -= sent;
         }
     }
 
-  close (client_socket);
+  close_connection (worker, conn);
+  return 1;
+}
+
+// Status line and headers into conn->head, followed by prefix, the start of a
+// body content_length long. Returns how much of head that takes.
+size_t
+write_head (Worker *worker, Connection *conn, const char *status,
+            const char *content_type, const char *prefix, size_t prefix_len,
+            size_t content_length)
+{
+  int head_len = snprintf (conn->head, sizeof (conn->head),
+                           "HTTP/1.1 %s\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Length: %zu\r\n"
+                           "Connection: close\r\n\r\n",
+                           status, content_type, content_length);
+  memcpy (conn->head + head_len, prefix, prefix_len);
+
+  if (conn->state == CONN_PARKED)
+    unpark (worker, conn);
+  conn->state = CONN_WRITING;
+  conn->out_index = 0;
+  return head_len + prefix_len;
+}
+
+// prefix and body..suffix make up the body. The body is sent from where it is,
+// the caller has to keep it alive until flush_response is done with it.
+int
+start_response (Worker *worker, Connection *conn, const char *status,
+                const char *content_type, const char *prefix,
+                size_t prefix_len, const char *body, size_t body_len,
+                const char *suffix, size_t suffix_len)
+{
+  size_t head_len = write_head (worker, conn, status, content_type, prefix,
+                                prefix_len,
+                                prefix_len + body_len + suffix_len);
+  conn->out = conn->inline_out;
+  conn->out[0] = (struct iovec){ conn->head, head_len };
+  conn->out[1] = (struct iovec){ (char *)body, body_len };
+  conn->out[2] = (struct iovec){ (char *)suffix, suffix_len };
+  conn->out_count = 3;
+  return flush_response (worker, conn);
+}
+
+// Sent straight from the caller's buffer, only what the socket does not take
+// right away is copied and finished on EPOLLOUT
+void
+send_http_response_len (Worker *worker, Connection *conn, const char *status,
+                        const char *content_type, const char *body,
+                        size_t body_len)
+{
+  if (start_response (worker, conn, status, content_type, "", 0, body,
+                      body_len, "", 0))
+    return;
+
+  struct iovec *rest = &conn->out[1];
+  if (conn->out_index <= 1 && rest->iov_len > 0)
+    {
+      conn->response = malloc (rest->iov_len);
+      memcpy (conn->response, rest->iov_base, rest->iov_len);
+      rest->iov_base = conn->response;
+    }
+}
+
+void
+send_http_response (Worker *worker, Connection *conn, const char *status,
+                    const char *content_type, const char *body)
+{
+  send_http_response_len (worker, conn, status, content_type, body,
+                          strlen (body));
 }
 
+// {"first":F,"last":L,"messages":[...]} with the messages after since, F and
+// L being the seqs of the first and last of them. If since is older than the
+// snapshot, it starts at the oldest message kept; if it is newer than anything
+// (the server restarted), it starts over from the oldest too. F tells the
+// client which. The messages go out as they are in the snapshot's chunks, one
+// slice per chunk, and the connection holds a reference until they are out.
 void
-handle_post (int client_socket, const char *request_body)
+send_messages (Worker *worker, Connection *conn, Snapshot *snapshot)
+{
+  printf ("Sending messages after #%ld\n", conn->since);
+
+  long from = conn->since + 1;
+  if (from < snapshot->first_seq || conn->since > snapshot->last_seq)
+    from = snapshot->first_seq;
+
+  int first_chunk = 0;
+  while (first_chunk + 1 < snapshot->chunk_count
+         && snapshot->chunks[first_chunk + 1]->first_seq <= from)
+    first_chunk++;
+  int slices = from <= snapshot->last_seq
+                   ? snapshot->chunk_count - first_chunk
+                   : 0;
+
+  conn->out = slices + 2 <= 3 ? conn->inline_out
+                              : malloc ((slices + 2) * sizeof (struct iovec));
+  conn->out_count = slices + 2;
+  size_t body_len = 0;
+  for (int i = 0; i < slices; i++)
+    {
+      Chunk *chunk = snapshot->chunks[first_chunk + i];
+      long until = i + 1 < slices ? snapshot->chunks[first_chunk + i + 1]
+                                            ->first_seq
+                                  : snapshot->last_seq + 1;
+      long start = from > chunk->first_seq ? from - chunk->first_seq : 0;
+      size_t begin = chunk->offsets[start];
+      size_t end = chunk->offsets[until - chunk->first_seq];
+      conn->out[i + 1] = (struct iovec){ chunk->json + begin, end - begin };
+      body_len += end - begin;
+    }
+  if (slices > 0)
+    {
+      conn->out[slices].iov_len--; // the comma after the last message
+      body_len--;
+    }
+
+  char prefix[64];
+  int prefix_len = snprintf (prefix, sizeof (prefix),
+                             "{\"first\":%ld,\"last\":%ld,\"messages\":[", from,
+                             snapshot->last_seq);
+
+  atomic_fetch_add (&snapshot->refs, 1);
+  conn->snapshot = snapshot;
+  size_t head_len = write_head (worker, conn, "200 OK", "application/json",
+                                prefix, prefix_len,
+                                prefix_len + body_len + 2);
+  conn->out[0] = (struct iovec){ conn->head, head_len };
+  conn->out[slices + 1] = (struct iovec){ "]}", 2 };
+  flush_response (worker, conn);
+}
+
+// Answers right away if there is something new, otherwise the connection is
+// parked and costs nothing but its socket until a message or the timeout
+void
+handle_get (Worker *worker, Connection *conn, long since)
+{
+  conn->since = since;
+
+  // Parked under snapshot_mutex, so a POST either published before and is
+  // seen here, or publishes after and sees this worker's parked_count
+  Snapshot *snapshot = NULL;
+  pthread_mutex_lock (&snapshot_mutex);
+  if (current_snapshot->last_seq == since)
+    {
+      park (worker, conn);
+    }
+  else
+    {
+      snapshot = current_snapshot;
+      atomic_fetch_add (&snapshot->refs, 1);
+    }
+  pthread_mutex_unlock (&snapshot_mutex);
+
+  if (snapshot)
+    {
+      send_messages (worker, conn, snapshot);
+      snapshot_release (snapshot);
+    }
+}
+
+// Tells the workers with parked requests that there is a new message. Workers
+// with none are left alone, and nobody looks at the room until someone posts.
+void
+wake_parked ()
+{
+  uint64_t one = 1;
+  for (int i = 0; i < WORKER_THREADS; i++)
+    {
+      if (atomic_load (&workers[i].parked_count) > 0)
+        write (workers[i].wakeup_fd, &one, sizeof (one));
+    }
+}
+
+// On wakeup: every parked request of the worker is answered from the same
+// snapshot
+void
+deliver_parked (Worker *worker)
+{
+  uint64_t wakeups;
+  read (worker->wakeup_fd, &wakeups, sizeof (wakeups));
+  if (!worker->parked)
+    return;
+
+  Snapshot *snapshot = snapshot_acquire ();
+  Connection *conn = worker->parked;
+  while (conn)
+    {
+      Connection *next = conn->next;
+      if (snapshot->last_seq != conn->since)
+        send_messages (worker, conn, snapshot);
+      conn = next;
+    }
+  snapshot_release (snapshot);
+}
+
+// Answers the requests whose POLL_TIMEOUT ran out, returns how long epoll_wait
+// may sleep until the next one does. Needs no lock, it only checks deadlines.
+int
+expire_parked (Worker *worker)
+{
+  long now = now_ms ();
+  while (worker->parked && worker->parked->deadline <= now)
+    {
+      printf ("Timeout.\n");
+      send_http_response (worker, worker->parked, "204 No Content",
+                          "application/json", "");
+    }
+  return worker->parked ? (int)(worker->parked->deadline - now) : -1;
+}
+
+void
+handle_post (Worker *worker, Connection *conn, const char *request_body)
 {
   char nickname[BUFFER_SIZE] = "", message[BUFFER_SIZE] = "";
   sscanf (request_body, "{\"nickname\":\"%[^\"]\",\"message\":\"%[^\"]\"}",
@@ -178,35 +1039,31 @@ handle_post (int client_socket, const char *request_body)
   snprintf (formatted_message, BUFFER_SIZE, "[%s] %s: %s", timestamp, nickname,
             message);
 
-  pthread_mutex_lock (&chatroom_mutex);
-  int idx
-      = (chatroom.oldest_message_idx + chatroom.message_count) % MAX_MESSAGES;
-  strncpy (chatroom.messages[idx], formatted_message, BUFFER_SIZE - 1);
+  // Rendered before taking any lock, and only this once
+  Buffer chunk = { 0 };
+  render_message (&chunk, formatted_message);
 
-  if (chatroom.message_count < MAX_MESSAGES)
-    {
-      chatroom.message_count++;
-    }
-  else
-    {
-      chatroom.oldest_message_idx
-          = (chatroom.oldest_message_idx + 1) % MAX_MESSAGES;
-    }
-  pthread_mutex_unlock (&chatroom_mutex);
+  pthread_mutex_lock (&post_mutex);
+  long seq = append_message (formatted_message);
+  log_append (seq, formatted_message);
+  publish_snapshot (snapshot_append (current_snapshot, chunk.data, chunk.len));
+  pthread_mutex_unlock (&post_mutex);
+  free (chunk.data);
+  wake_parked ();
 
-  printf ("Message #%d: %s\n", chatroom.message_count, formatted_message);
+  printf ("Message #%ld: %s\n", seq, formatted_message);
 
-  send_http_response (client_socket, "200 OK", "text/plain",
+  send_http_response (worker, conn, "200 OK", "text/plain",
                       "Message received");
 }
 
 void
-serve_html_page (int client_socket)
+serve_html_page (Worker *worker, Connection *conn)
 {
   FILE *file = fopen ("index.html", "r");
   if (!file)
     {
-      send_http_response (client_socket, "500 Internal Server Error",
+      send_http_response (worker, conn, "500 Internal Server Error",
                           "text/plain", "Failed to load HTML file");
       return;
     }
@@ -220,33 +1077,42 @@ serve_html_page (int client_socket)
   html[size] = '\0';
   fclose (file);
 
-  send_http_response (client_socket, "200 OK", "text/html", html);
+  send_http_response (worker, conn, "200 OK", "text/html", html);
   free (html);
 }
 
+// Headers and, for a POST, as much body as Content-Length announces
+int
+request_complete (Connection *conn)
+{
+  char *headers_end = strstr (conn->request, "\r\n\r\n");
+  if (!headers_end)
+    return 0;
+
+  size_t content_length = 0;
+  char *length = strcasestr (conn->request, "\r\nContent-Length:");
+  if (length && length < headers_end)
+    content_length = strtoul (length + 17, NULL, 10);
+
+  return conn->request_len >= (size_t)(headers_end + 4 - conn->request)
+                                  + content_length;
+}
+
 // routing reqs
 void
-handle_client (int client_socket)
+handle_client (Worker *worker, Connection *conn)
 {
-  char buffer[BUFFER_SIZE];
-  int bytes_read = recv (client_socket, buffer, sizeof (buffer) - 1, 0);
-  if (bytes_read <= 0)
-    {
-      close (client_socket);
-      return;
-    }
-  buffer[bytes_read] = '\0';
+  char *buffer = conn->request;
 
   if (strstr (buffer, "GET / "))
     {
-      serve_html_page (client_socket);
+      serve_html_page (worker, conn);
     }
   else if (strstr (buffer, "GET /messages"))
     {
-      int client_message_count = -1;
-      sscanf (buffer, "GET /messages?lastMessageCount=%d",
-              &client_message_count);
-      handle_get (client_socket, client_message_count);
+      long since = 0;
+      sscanf (buffer, "GET /messages?since=%ld", &since);
+      handle_get (worker, conn, since < 0 ? 0 : since);
     }
   else if (strstr (buffer, "POST /messages"))
     {
@@ -254,21 +1120,162 @@ handle_client (int client_socket)
       if (body)
         {
           body += 4; // Skip over "\r\n\r\n"
-          handle_post (client_socket, body);
+          handle_post (worker, conn, body);
         }
       else
         {
-          send_http_response (client_socket, "400 Bad Request", "text/plain",
+          send_http_response (worker, conn, "400 Bad Request", "text/plain",
                               "Invalid POST request");
         }
     }
   else
     {
-      send_http_response (client_socket, "404 Not Found", "text/plain",
+      send_http_response (worker, conn, "404 Not Found", "text/plain",
                           "Resource not found");
     }
+}
+
+void
+handle_readable (Worker *worker, Connection *conn)
+{
+  while (1)
+    {
+      char *end = conn->request + conn->request_len;
+      size_t room = REQUEST_SIZE - conn->request_len;
+      ssize_t bytes_read = recv (conn->fd, end, room, 0);
+      if (bytes_read == 0
+          || (bytes_read < 0 && errno != EINTR && errno != EAGAIN
+              && errno != EWOULDBLOCK))
+        {
+          // parked clients send nothing, so this is a closed browser tab
+          close_connection (worker, conn);
+          return;
+        }
+      if (bytes_read < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;
+        }
+      if (conn->state != CONN_READING)
+        continue;
+
+      conn->request_len += bytes_read;
+      conn->request[conn->request_len] = '\0';
+      if (request_complete (conn))
+        {
+          handle_client (worker, conn);
+          return;
+        }
+      if (conn->request_len == REQUEST_SIZE)
+        {
+          send_http_response (worker, conn, "413 Payload Too Large",
+                              "text/plain", "Request too large");
+          return;
+        }
+    }
+}
+
+void
+accept_clients (Worker *worker)
+{
+  while (1)
+    {
+      struct sockaddr_in address;
+      socklen_t addrlen = sizeof (address);
+      int client_socket = accept4 (server_fd, (struct sockaddr *)&address,
+                                   &addrlen, SOCK_NONBLOCK);
+      if (client_socket < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror ("Accept failed");
+          return;
+        }
+
+      char client_ip[INET_ADDRSTRLEN];
+      inet_ntop (AF_INET, &address.sin_addr, client_ip, sizeof (client_ip));
+      printf ("Connection accepted from %s:%d\n", client_ip,
+              ntohs (address.sin_port));
+
+      Connection *conn = calloc (1, sizeof (Connection));
+      conn->fd = client_socket;
+      conn->state = CONN_READING;
+
+      struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP,
+                                   .data.ptr = conn };
+      if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, client_socket, &event)
+          < 0)
+        {
+          perror ("epoll_ctl");
+          close (client_socket);
+          free (conn);
+        }
+    }
+}
+
+void *
+worker_main (void *arg)
+{
+  Worker *worker = arg;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (1)
+    {
+      int count = epoll_wait (worker->epoll_fd, events, MAX_EVENTS,
+                              expire_parked (worker));
+      if (count < 0 && errno != EINTR)
+        {
+          perror ("epoll_wait");
+          break;
+        }
+
+      // Delivery closes parked connections, which later events of this batch
+      // may still point to, so it waits until the batch is done
+      int woken = 0;
+      for (int i = 0; i < count; i++)
+        {
+          Connection *conn = events[i].data.ptr;
+          if (!conn)
+            {
+              accept_clients (worker);
+            }
+          else if (events[i].data.ptr == &worker->wakeup_fd)
+            {
+              woken = 1;
+            }
+          else if (conn->state == CONN_WRITING)
+            {
+              if (events[i].events & (EPOLLERR | EPOLLHUP))
+                close_connection (worker, conn);
+              else
+                flush_response (worker, conn);
+            }
+          else
+            {
+              handle_readable (worker, conn);
+            }
+        }
+      if (stop_requested)
+        break;
+      if (woken)
+        deliver_parked (worker);
+    }
 
-  close (client_socket);
+  return NULL;
+}
+
+// Every parked request holds a socket, 1024 descriptors are not enough
+void
+raise_fd_limit ()
+{
+  struct rlimit limit;
+  if (getrlimit (RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit (RLIMIT_NOFILE, &limit);
+    }
 }
 
 int
@@ -278,19 +1285,33 @@ main ()
   signal (SIGPIPE, SIG_IGN); // without this, after all sockets are closed the
                              // server crashes
 
-  int client_socket;
   int opt = 1;
   struct sockaddr_in address;
-  socklen_t addrlen = sizeof (address);
 
-  load_history ();
+  // Blocked in every thread started below, they inherit it; main unblocks it
+  // once they are running
+  sigset_t sigint;
+  sigemptyset (&sigint);
+  sigaddset (&sigint, SIGINT);
+  pthread_sigmask (SIG_BLOCK, &sigint, NULL);
+
+  raise_fd_limit ();
+  recover_log ();
+  current_snapshot = snapshot_from_ring ();
 
-  if ((server_fd = socket (AF_INET, SOCK_STREAM, 0)) == 0)
+  if ((server_fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
     {
       perror ("Socket failed");
       exit (EXIT_FAILURE);
     }
 
+  if (setsockopt (server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt)) < 0)
+    {
+      perror ("setsockopt failed");
+      close (server_fd);
+      exit (EXIT_FAILURE);
+    }
+
   address.sin_family = AF_INET;
   address.sin_addr.s_addr = INADDR_ANY;
   address.sin_port = htons (PORT);
@@ -302,14 +1323,7 @@ main ()
       exit (EXIT_FAILURE);
     }
 
-  if (setsockopt (server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt)) < 0)
-    {
-      perror ("setsockopt failed");
-      close (server_fd);
-      exit (EXIT_FAILURE);
-    }
-
-  if (listen (server_fd, 5) < 0)
+  if (listen (server_fd, SOMAXCONN) < 0)
     {
       perror ("Listen failed");
       close (server_fd);
@@ -317,43 +1331,38 @@ main ()
     }
 
   printf ("Server running on http://localhost:%d\n", PORT);
+  pthread_create (&chat_log.thread, NULL, log_main, NULL);
 
-  while (1)
+  for (int i = 0; i < WORKER_THREADS; i++)
     {
-      if ((client_socket
-           = accept (server_fd, (struct sockaddr *)&address, &addrlen))
-          < 0)
+      workers[i].epoll_fd = epoll_create1 (0);
+      workers[i].wakeup_fd = eventfd (0, EFD_NONBLOCK);
+      // EPOLLEXCLUSIVE: a new connection wakes one worker, not all of them
+      struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE,
+                                   .data.ptr = NULL };
+      struct epoll_event wakeup = { .events = EPOLLIN,
+                                    .data.ptr = &workers[i].wakeup_fd };
+      if (workers[i].epoll_fd < 0 || workers[i].wakeup_fd < 0
+          || epoll_ctl (workers[i].epoll_fd, EPOLL_CTL_ADD, server_fd, &event)
+                 < 0
+          || epoll_ctl (workers[i].epoll_fd, EPOLL_CTL_ADD,
+                        workers[i].wakeup_fd, &wakeup)
+                 < 0)
         {
-          perror ("Accept failed");
-          continue;
+          perror ("epoll");
+          exit (EXIT_FAILURE);
         }
+      pthread_create (&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+  pthread_sigmask (SIG_UNBLOCK, &sigint, NULL);
 
-      char client_ip[INET_ADDRSTRLEN];
-      int client_port;
-
-      if (getpeername (client_socket, (struct sockaddr *)&address,
-                       (socklen_t *)&addrlen)
-          == -1)
-        {
-          perror ("getpeername");
-          close (client_socket);
-          continue;
-        }
-
-      inet_ntop (AF_INET, &address.sin_addr, client_ip, sizeof (client_ip));
-      client_port = ntohs (address.sin_port);
-
-      printf ("Connection accepted from %s:%d\n", client_ip, client_port);
-
-      pthread_t thread;
-      pthread_create (&thread, NULL, (void *)handle_client,
-                      (void *)(int)client_socket);
-
-      pthread_detach (thread);
-      // handle_client (client_socket);
+  for (int i = 0; i < WORKER_THREADS; i++)
+    {
+      pthread_join (workers[i].thread, NULL);
     }
 
-  save_history ();
+  printf ("\nSIGINT. Flushing the chat log.\n");
+  log_shutdown ();
   close (server_fd);
   return 0;
 }